@@ -9,6 +9,10 @@ extern "C" {
 #include <stdint.h>
 #include "kconf.h" // kernel conf can be the basis of values
 
+#ifndef CCM_MEMORY
+#define CCM_MEMORY // a kconf.h of the game without core coupled memory : normal RAM
+#endif
+
 #define BITBOX_KERNEL 0010
 
 void bitbox_init(); // init everything.
@@ -18,6 +18,11 @@
 #		NO_USB,       - when you don't want to use USB input related function)
 #		NO_AUDIO      - disable sound support
 #		USE_SDCARD,   - when you want to use SDcard+fatfs support
+#		                (sector cache size : DISKCACHE_LINES=n, see fatfs/diskcache.h)
+#		USE_SDIMAGE,  - emulator only, with USE_SDCARD : run the real fatfs on a FAT disk image
+#		                ($BITBOX_SDIMAGE or sdcard.img) instead of host files.
+#		                In both cases BITBOX_DISKSTATS=1 prints disk access statistics and
+#		                projected device times at exit, see fatfs/disk_stats.h for SD profiles.
 #
 
 # Internal make variables :
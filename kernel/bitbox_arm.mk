@@ -80,7 +80,7 @@ KERNEL += board_$(BOARD).c \
 
 # Fatfs
 ifdef USE_SDCARD
-SDCARD_FILES := fatfs/stm32f4_lowlevel.c fatfs/stm32f4_discovery_sdio_sd.c fatfs/ff.c fatfs/diskio.c
+SDCARD_FILES := fatfs/stm32f4_lowlevel.c fatfs/stm32f4_discovery_sdio_sd.c fatfs/ff.c fatfs/ff_map.c fatfs/diskio.c fatfs/diskcache.c
 SDCARD_FILES += stm32f4xx_sdio.c stm32f4xx_gpio.c stm32f4xx_dma.c misc.c
 
 DEFINES += USE_SDCARD USE_STDPERIPH_DRIVER
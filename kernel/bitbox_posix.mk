@@ -8,7 +8,7 @@
 # --------------
 #   TYPE= sdl | test
 #   BITBOX NAME GAME_BINARY_FILES GAME_C_FILES DEFINES (VGA_MODE, ...)
-#   GAME_C_OPTS DEFINES NO_USB NO_AUDIO USE_SDCARD
+#   GAME_C_OPTS DEFINES NO_USB NO_AUDIO USE_SDCARD USE_SDIMAGE
 # More arcane defines :
 #   USE_SD_SENSE DISABLE_ESC_EXIT KEYB_FR
 
@@ -60,6 +60,17 @@ KERNEL := bitbox_main.c main_$(TYPE).c micro_palette.c
 
 ifdef USE_SDCARD
   DEFINES += USE_SDCARD
+  ifdef USE_SDIMAGE
+    # real fatfs on a FAT disk image file, see fatfs/diskio_emu.c
+    DEFINES += USE_SDIMAGE
+    KERNEL += fatfs/ff.c fatfs/ff_map.c fatfs/diskcache.c fatfs/diskio_emu.c fatfs/disk_stats.c
+  else
+    # host files shims
+    KERNEL += fatfs/ff_emu.c fatfs/disk_stats.c
+  endif
+else ifeq ($(TYPE),test)
+  # test kernel always provided the host files shims
+  KERNEL += fatfs/ff_emu.c fatfs/disk_stats.c
 endif
 ifdef NO_USB
   DEFINES += NO_USB
@@ -0,0 +1,279 @@
+// disk_stats.c : emulator-only SD card access accounting, see disk_stats.h
+
+#define _POSIX_C_SOURCE 200809L // nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitbox.h"
+#include "disk_stats.h"
+
+#define MAX_FILES 64
+#define MAX_LEVELS 32
+
+struct FileStats {
+	const void *fp;      // FIL object, only valid while opened
+	char name[64];
+	struct DiskCounters c;
+};
+
+struct DiskCounters disk_stats_total;
+struct DiskCounters disk_stats_api[DISK_API_NB];
+uint32_t disk_stats_hist[DISK_STATS_HIST];
+
+static struct FileStats files[MAX_FILES+1]; // last one collects overflow
+static int nb_files;
+
+static struct FileStats levels[MAX_LEVELS+1]; // same, fp unused
+static int nb_levels;
+static struct FileStats *cur_level;
+
+static enum disk_api cur_api = DISK_API_OTHER;
+static struct FileStats *cur_file; // file being accessed by current call, if any
+static uint32_t next_sector;       // sector just after the last request
+
+// rough figures for a card on the bitbox 4-bit SDIO bus (24MHz max, ~12MB/s).
+static const struct SDProfile profiles[] = {
+	// name      call  cmd  read  wcmd  write random cluster
+	{"class4",     10, 1000, 120, 4000, 250, 600, 64},
+	{"class10",    10,  400,  55, 1500,  70, 250, 64},
+	{"uhs1",       10,  250,  43,  800,  45, 100, 64},
+};
+struct SDProfile disk_stats_profile;
+
+static int sd_delay;         // really sleep the simulated time
+static uint32_t delay_debt;  // simulated time not slept yet, in us
+
+static const char *api_names[DISK_API_NB] = {
+	"f_open", "f_close", "f_read", "f_write", "f_lseek", "f_opendir", "f_readdir", "f_mount", "(other)"
+};
+
+static void select_profile(const char *name)
+{
+	disk_stats_profile = profiles[1];
+	if (!name || !*name)
+		return;
+
+	for (int i=0;i<(int)(sizeof(profiles)/sizeof(profiles[0]));i++)
+		if (!strcmp(name, profiles[i].name)) {
+			disk_stats_profile = profiles[i];
+			return;
+		}
+
+	unsigned cmd, rd, wcmd, wr, rnd, cluster=64;
+	const int nb = sscanf(name, "%u,%u,%u,%u,%u,%u", &cmd, &rd, &wcmd, &wr, &rnd, &cluster);
+	if ((nb==5 || nb==6) && cluster && cluster<=128 && !(cluster & (cluster-1))) {
+		disk_stats_profile.name = "custom";
+		disk_stats_profile.cmd_us = cmd;
+		disk_stats_profile.read_us = rd;
+		disk_stats_profile.wcmd_us = wcmd;
+		disk_stats_profile.write_us = wr;
+		disk_stats_profile.random_us = rnd;
+		disk_stats_profile.cluster = cluster;
+	} else {
+		message("unknown SD profile %s, using %s\n", name, disk_stats_profile.name);
+	}
+}
+
+static void disk_stats_init(void)
+{
+	static int done;
+	if (done) return;
+	done = 1;
+
+	select_profile(getenv("BITBOX_SDPROFILE"));
+
+	const char *env = getenv("BITBOX_SDDELAY");
+	sd_delay = env && *env && *env!='0';
+
+	env = getenv("BITBOX_DISKSTATS");
+	if (env && *env && *env!='0')
+		atexit(disk_stats_print);
+}
+
+static void charge(uint32_t us)
+{
+	if (!sd_delay) return;
+
+	// sleep by at least 1ms steps, nanosleep overhead would dominate otherwise
+	delay_debt += us;
+	if (delay_debt >= 1000) {
+		struct timespec ts = { delay_debt/1000000, (delay_debt%1000000)*1000 };
+		nanosleep(&ts, 0);
+		delay_debt = 0;
+	}
+}
+
+static struct FileStats *find_file(const void *fp)
+{
+	// most recent first, a FIL object can be reused for another file
+	for (int i=nb_files-1;i>=0;i--)
+		if (files[i].fp == fp)
+			return &files[i];
+	return 0;
+}
+
+static void count_call(struct DiskCounters *c)
+{
+	c->calls++;
+	c->time_us += disk_stats_profile.call_us;
+}
+
+void disk_stats_open (const void *fp, const char *path)
+{
+	disk_stats_init();
+
+	struct FileStats *f = find_file(fp);
+	if (f) f->fp = 0; // forget previous use of this object
+
+	if (nb_files<MAX_FILES) {
+		f = &files[nb_files++];
+		strncpy(f->name, path, sizeof(f->name)-1);
+	} else {
+		f = &files[MAX_FILES];
+		strcpy(f->name, "(other files)");
+	}
+	f->fp = fp;
+
+	cur_api = DISK_API_OPEN;
+	cur_file = f;
+	count_call(&disk_stats_api[DISK_API_OPEN]);
+	count_call(&disk_stats_total);
+	count_call(&f->c);
+	if (cur_level)
+		count_call(&cur_level->c);
+	charge(disk_stats_profile.call_us);
+}
+
+void disk_stats_call (enum disk_api api, const void *obj)
+{
+	disk_stats_init();
+
+	cur_api = api;
+	cur_file = obj ? find_file(obj) : 0;
+
+	count_call(&disk_stats_api[api]);
+	count_call(&disk_stats_total);
+	if (cur_file)
+		count_call(&cur_file->c);
+	if (cur_level)
+		count_call(&cur_level->c);
+	charge(disk_stats_profile.call_us);
+}
+
+void disk_stats_level (const char *name)
+{
+	disk_stats_init();
+
+	if (!name) {
+		cur_level = 0;
+		return;
+	}
+
+	// reuse a level with the same name, so reloading a level accumulates
+	for (int i=0;i<nb_levels;i++)
+		if (!strcmp(levels[i].name, name)) {
+			cur_level = &levels[i];
+			return;
+		}
+
+	if (nb_levels<MAX_LEVELS) {
+		cur_level = &levels[nb_levels++];
+		strncpy(cur_level->name, name, sizeof(cur_level->name)-1);
+	} else {
+		cur_level = &levels[MAX_LEVELS];
+		strcpy(cur_level->name, "(other levels)");
+	}
+}
+
+static void count(struct DiskCounters *c, int write, unsigned n, int seek, uint32_t us)
+{
+	if (write) {
+		c->write_cmds++;
+		c->sectors_written += n;
+	} else {
+		c->read_cmds++;
+		c->sectors_read += n;
+	}
+	c->seeks += seek;
+	c->time_us += us;
+}
+
+void disk_stats_request (int write, uint32_t sector, unsigned n)
+{
+	disk_stats_init();
+
+	const int seek = sector != next_sector;
+	next_sector = sector+n;
+
+	const struct SDProfile *p = &disk_stats_profile;
+	uint32_t us = write ? p->wcmd_us + n*p->write_us : p->cmd_us + n*p->read_us;
+	if (seek)
+		us += p->random_us;
+
+	int bucket=0;
+	while (bucket<DISK_STATS_HIST-1 && n > 1u<<bucket)
+		bucket++;
+	disk_stats_hist[bucket]++;
+
+	count(&disk_stats_total, write, n, seek, us);
+	count(&disk_stats_api[cur_api], write, n, seek, us);
+	if (cur_file)
+		count(&cur_file->c, write, n, seek, us);
+	if (cur_level)
+		count(&cur_level->c, write, n, seek, us);
+	charge(us);
+}
+
+void disk_stats_reset (void)
+{
+	memset(&disk_stats_total, 0, sizeof(disk_stats_total));
+	memset(disk_stats_api, 0, sizeof(disk_stats_api));
+	memset(disk_stats_hist, 0, sizeof(disk_stats_hist));
+	for (int i=0;i<=MAX_FILES;i++)
+		memset(&files[i].c, 0, sizeof(files[i].c));
+	for (int i=0;i<=MAX_LEVELS;i++)
+		memset(&levels[i].c, 0, sizeof(levels[i].c));
+}
+
+static void print_counters(const char *name, const struct DiskCounters *c)
+{
+	message("  %-24.24s %7u %7u %7u %8u %8u %7u %9.1f\n", name, c->calls,
+		c->read_cmds, c->write_cmds, c->sectors_read, c->sectors_written, c->seeks,
+		c->time_us/1000.);
+}
+
+void disk_stats_print (void)
+{
+	disk_stats_init();
+
+	const struct SDProfile *p = &disk_stats_profile;
+	message("--- disk statistics, SD profile %s (us : cmd %u+%u/sect, write cmd %u+%u/sect, random %u ; cluster %u sect)\n",
+		p->name, p->cmd_us, p->read_us, p->wcmd_us, p->write_us, p->random_us, p->cluster);
+	message("  %-24s %7s %7s %7s %8s %8s %7s %9s\n", "", "calls", "rd cmd", "wr cmd", "rd sect", "wr sect", "seeks", "dev ms");
+	print_counters("total", &disk_stats_total);
+
+	message(" per call :\n");
+	for (int i=0;i<DISK_API_NB;i++)
+		if (disk_stats_api[i].calls || disk_stats_api[i].read_cmds || disk_stats_api[i].write_cmds)
+			print_counters(api_names[i], &disk_stats_api[i]);
+
+	message(" per file :\n");
+	for (int i=0;i<=MAX_FILES;i++)
+		if (files[i].c.calls)
+			print_counters(files[i].name, &files[i].c);
+
+	if (nb_levels) {
+		message(" per level :\n");
+		for (int i=0;i<=MAX_LEVELS;i++)
+			if (levels[i].c.calls)
+				print_counters(levels[i].name, &levels[i].c);
+	}
+
+	message(" request sizes (sectors) :\n ");
+	for (int i=0;i<DISK_STATS_HIST;i++)
+		message(" <=%d:%u", 1<<i, disk_stats_hist[i]);
+	message("\n");
+}
@@ -0,0 +1,84 @@
+/* disk_stats : emulator-only accounting of SD card accesses.
+
+   Fed by the disk image backend (diskio_emu.c, running the real ff.c) or by the host
+   file shims (ff_emu.c), which model files on clusters of the size of the profile. Counts, per fatfs API call and per opened file, the disk commands
+   issued, sectors read/written, multi-sector request sizes and seeks (requests not
+   contiguous to the previous one).
+
+   Each disk command and API call is also charged a simulated device time from an SD card
+   profile, so that the report gives the projected load time on the console per file, per
+   call and per level (see disk_stats_level). Environment :
+
+     BITBOX_DISKSTATS=1       report at exit (or call disk_stats_print() yourself)
+     BITBOX_SDPROFILE=name    card profile : class4, class10 (default), uhs1, or custom
+                              timings in us "cmd,read,wcmd,write,random[,cluster]" (see SDProfile)
+     BITBOX_SDDELAY=1         really wait the simulated time, to feel loading times
+
+   On device all of this compiles to nothing.
+*/
+#pragma once
+
+#include <stdint.h>
+
+enum disk_api {
+	DISK_API_OPEN,
+	DISK_API_CLOSE,
+	DISK_API_READ,
+	DISK_API_WRITE,
+	DISK_API_LSEEK,
+	DISK_API_OPENDIR,
+	DISK_API_READDIR,
+	DISK_API_MOUNT,
+	DISK_API_OTHER,  // disk accesses not attributed to a call (sync, ...)
+	DISK_API_NB
+};
+
+#define DISK_STATS_HIST 9 // request size histogram : 1,2,3-4,5-8, ... 129-256 sectors
+
+struct DiskCounters {
+	uint32_t calls;           // fatfs API calls
+	uint32_t read_cmds;       // disk read requests (one multi-sector command each)
+	uint32_t write_cmds;
+	uint32_t sectors_read;
+	uint32_t sectors_written;
+	uint32_t seeks;           // requests not starting where the previous one ended
+	uint64_t time_us;         // projected time on device
+};
+
+// SD card timing model, all in microseconds
+struct SDProfile {
+	const char *name;
+	uint16_t call_us;    // CPU time of a fatfs API call, excluding disk accesses
+	uint16_t cmd_us;     // read command : SDIO command + card access latency
+	uint16_t read_us;    // per sector read (bus and card throughput)
+	uint16_t wcmd_us;    // write command : includes the card busy / programming time
+	uint16_t write_us;   // per sector written
+	uint16_t random_us;  // extra latency of a request not contiguous to the previous one
+	uint8_t cluster;     // sectors per cluster, modelled by ff_emu.c : 64 (32k) for SDHC cards
+};
+
+#ifdef EMULATOR
+
+extern struct DiskCounters disk_stats_total;
+extern struct DiskCounters disk_stats_api[DISK_API_NB];
+extern uint32_t disk_stats_hist[DISK_STATS_HIST];
+extern struct SDProfile disk_stats_profile;
+
+void disk_stats_call (enum disk_api api, const void *obj); // start of an API call on a FIL/DIR object
+void disk_stats_open (const void *fp, const char *path);   // start of f_open : names the file object
+void disk_stats_request (int write, uint32_t sector, unsigned count); // one disk command
+
+void disk_stats_level (const char *name); // following accesses are accounted to this level (0 : none)
+void disk_stats_reset (void);
+void disk_stats_print (void);
+
+#else
+
+#define disk_stats_level(name)
+#define disk_stats_call(api,obj)
+#define disk_stats_open(fp,path)
+#define disk_stats_request(write,sector,count)
+#define disk_stats_reset()
+#define disk_stats_print()
+
+#endif
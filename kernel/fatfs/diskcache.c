@@ -0,0 +1,228 @@
+// diskcache.c : LRU sector cache with read-ahead, see diskcache.h
+
+#include <string.h> // memcpy
+
+#include "bitbox.h"
+#include "diskcache.h"
+
+#define BLOCK_SIZE 512
+#define LINE_BYTES (DISKCACHE_LINE*BLOCK_SIZE)
+
+struct DiskCacheStats disk_cache_stats;
+
+// NOT ON THE STACK, stack is in CCM !
+static uint32_t bounce[DISKCACHE_READAHEAD*LINE_BYTES/4];
+
+#if DISKCACHE_LINES
+
+static uint32_t lines[DISKCACHE_LINES][LINE_BYTES/4]; // contiguous, read-ahead fills adjacent lines
+static DWORD line_tag[DISKCACHE_LINES];  // 1 + first sector / DISKCACHE_LINE, 0 if empty
+static uint32_t line_used[DISKCACHE_LINES]; // last access time, for LRU
+static uint32_t now;
+static DWORD next_line; // line following the last one read from the card (0 : none)
+
+void disk_cache_invalidate(void)
+{
+	memset(line_tag, 0, sizeof(line_tag));
+	next_line = 0;
+}
+
+static int find_line(DWORD tag)
+{
+	for (int i=0;i<DISKCACHE_LINES;i++)
+		if (line_tag[i]==tag+1)
+			return i;
+	return -1;
+}
+
+// choose n adjacent lines, starting on a multiple of n, least recently used
+static int victim(int n)
+{
+	int best = 0;
+	uint32_t best_age = 0;
+	for (int i=0;i+n<=DISKCACHE_LINES;i+=n) {
+		uint32_t age = 0xFFFFFFFF;
+		for (int j=i;j<i+n;j++) {
+			if (!line_tag[j]) {
+				age = 0xFFFFFFFF;
+				break;
+			}
+			if (now-line_used[j] < age)
+				age = now-line_used[j];
+		}
+		if (age >= best_age) {
+			best = i;
+			best_age = age;
+		}
+		if (age==0xFFFFFFFF)
+			break;
+	}
+	return best;
+}
+
+// read the line tag from the card, returns its index or -1 on error.
+static int fill(DWORD tag)
+{
+	// sequential miss : read ahead next lines in the same command
+	int n = (next_line && tag==next_line) ? DISKCACHE_READAHEAD : 1;
+	if (n > DISKCACHE_LINES) n = DISKCACHE_LINES;
+	for (int i=1;i<n;i++) // stop before a line already there : never two copies of a line
+		if (find_line(tag+i)>=0) {
+			n = i;
+			break;
+		}
+
+	int l = victim(n);
+	for (int i=0;i<n;i++)
+		line_tag[l+i] = 0;
+	disk_cache_stats.ll_reads++;
+	disk_cache_stats.ll_sectors += n*DISKCACHE_LINE;
+	if (disk_read_lowlevel((BYTE*)lines[l], tag*DISKCACHE_LINE, n*DISKCACHE_LINE) != RES_OK) {
+		// read ahead can go past the end of the card, retry alone
+		if (n==1) return -1;
+		n = 1;
+		disk_cache_stats.ll_reads++;
+		disk_cache_stats.ll_sectors += DISKCACHE_LINE;
+		if (disk_read_lowlevel((BYTE*)lines[l], tag*DISKCACHE_LINE, DISKCACHE_LINE) != RES_OK)
+			return -1;
+	}
+	next_line = tag+n;
+
+	disk_cache_stats.misses++;
+	disk_cache_stats.readaheads += n-1;
+	for (int i=0;i<n;i++) {
+		line_tag[l+i] = tag+i+1;
+		line_used[l+i] = now - 1; // read ahead, not used yet
+	}
+	return l;
+}
+
+#else
+
+void disk_cache_invalidate(void) {}
+
+#endif
+
+// direct reads, bounced by whole runs when the destination is not word aligned
+static DRESULT read_direct(BYTE *buff, DWORD sector, UINT count)
+{
+	disk_cache_stats.bypass++;
+	if (!((uintptr_t)buff & 3)) {
+		disk_cache_stats.ll_reads++;
+		disk_cache_stats.ll_sectors += count;
+		return disk_read_lowlevel(buff, sector, count);
+	}
+
+	while (count) {
+		UINT n = count < sizeof(bounce)/BLOCK_SIZE ? count : sizeof(bounce)/BLOCK_SIZE;
+		disk_cache_stats.bounced++;
+		disk_cache_stats.ll_reads++;
+		disk_cache_stats.ll_sectors += n;
+		DRESULT res = disk_read_lowlevel((BYTE*)bounce, sector, n);
+		if (res != RES_OK)
+			return res;
+		memcpy(buff, bounce, n*BLOCK_SIZE);
+		buff += n*BLOCK_SIZE;
+		sector += n;
+		count -= n;
+	}
+	return RES_OK;
+}
+
+DRESULT disk_read (
+	BYTE drv,		/* Physical drive nmuber (0..) */
+	BYTE *buff,		/* Data buffer to store read data */
+	DWORD sector,	/* Sector address (LBA) */
+	UINT count		/* Number of sectors to read (1..255) */
+)
+{
+	if (drv)
+		return RES_PARERR;
+	disk_cache_stats.reads++;
+
+#if DISKCACHE_LINES
+	now++;
+
+	// big reads go directly to the destination. The card is always up to date (write through).
+	if (count >= DISKCACHE_LINE) {
+		next_line = (sector+count)/DISKCACHE_LINE;
+		return read_direct(buff, sector, count);
+	}
+
+	while (count) {
+		const DWORD tag = sector/DISKCACHE_LINE;
+		UINT ofs = sector%DISKCACHE_LINE;
+		UINT n = DISKCACHE_LINE-ofs < count ? DISKCACHE_LINE-ofs : count;
+
+		int l = find_line(tag);
+		if (l>=0) {
+			disk_cache_stats.hits += n;
+		} else if ((l = fill(tag)) < 0) {
+			// incomplete last line of the card (or a real error), read uncached
+			DRESULT res = read_direct(buff, sector, n);
+			if (res != RES_OK)
+				return res;
+			buff += n*BLOCK_SIZE;
+			sector += n;
+			count -= n;
+			continue;
+		}
+		line_used[l] = now;
+
+		memcpy(buff, (BYTE*)lines[l]+ofs*BLOCK_SIZE, n*BLOCK_SIZE);
+		buff += n*BLOCK_SIZE;
+		sector += n;
+		count -= n;
+	}
+	return RES_OK;
+#else
+	return read_direct(buff, sector, count);
+#endif
+}
+
+DRESULT disk_write (
+	BYTE drv,			/* Physical drive nmuber (0..) */
+	const BYTE *buff,	/* Data to be written */
+	DWORD sector,		/* Sector address (LBA) */
+	UINT count			/* Number of sectors to write (1..255) */
+)
+{
+	if (drv)
+		return RES_PARERR;
+	disk_cache_stats.writes++;
+
+#if DISKCACHE_LINES
+	// update cached copies (write through)
+	for (UINT i=0;i<count;i++) {
+		int l = find_line((sector+i)/DISKCACHE_LINE);
+		if (l>=0)
+			memcpy((BYTE*)lines[l]+(sector+i)%DISKCACHE_LINE*BLOCK_SIZE, buff+i*BLOCK_SIZE, BLOCK_SIZE);
+	}
+#endif
+
+	if (!((uintptr_t)buff & 3))
+		return disk_write_lowlevel(buff, sector, count);
+
+	while (count) {
+		UINT n = count < sizeof(bounce)/BLOCK_SIZE ? count : sizeof(bounce)/BLOCK_SIZE;
+		disk_cache_stats.bounced++;
+		memcpy(bounce, buff, n*BLOCK_SIZE);
+		DRESULT res = disk_write_lowlevel((BYTE*)bounce, sector, n);
+		if (res != RES_OK)
+			return res;
+		buff += n*BLOCK_SIZE;
+		sector += n;
+		count -= n;
+	}
+	return RES_OK;
+}
+
+void disk_cache_print(void)
+{
+	const struct DiskCacheStats *s = &disk_cache_stats;
+	message("--- disk cache : %d lines of %d sectors, read-ahead %d lines\n",
+		DISKCACHE_LINES, DISKCACHE_LINE, DISKCACHE_READAHEAD);
+	message("  reads %u : sectors hit %u, line fills %u (+%u read ahead), direct %u, bounced %u\n",
+		s->reads, s->hits, s->misses, s->readaheads, s->bypass, s->bounced);
+	message("  writes %u, low level : %u reads, %u sectors\n", s->writes, s->ll_reads, s->ll_sectors);
+}
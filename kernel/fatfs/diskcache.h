@@ -0,0 +1,56 @@
+/* diskcache : small sector cache between fatfs and the SD driver.
+
+   disk_read / disk_write are implemented here, on top of the low level driver
+   (disk_read_lowlevel / disk_write_lowlevel, in diskio.c on device or diskio_emu.c on
+   the emulator disk image backend).
+
+   - small reads (FAT, directories, FIL sector buffers) are served from an LRU cache of
+     lines of DISKCACHE_LINE contiguous sectors, filled with a single multi-sector command.
+   - a miss just after the previous one (sequential access) fills DISKCACHE_READAHEAD lines
+     in one command.
+   - reads of at least a line go directly to the destination buffer, through an aligned
+     bounce buffer by whole runs if the destination is not word aligned (DMA requirement).
+   - writes go through to the card and update cached copies.
+
+   Buffers are static so they stay out of the CCM (not reachable by DMA, this is where
+   the stack lives). Memory used is DISKCACHE_LINES*DISKCACHE_LINE*512 bytes + bounce buffer
+   of DISKCACHE_READAHEAD lines. Define DISKCACHE_LINES=0 to disable the cache.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "integer.h"
+#include "diskio.h"
+
+#ifndef DISKCACHE_LINES
+#define DISKCACHE_LINES 8      // number of cache lines
+#endif
+
+#ifndef DISKCACHE_LINE
+#define DISKCACHE_LINE 2       // sectors per line
+#endif
+
+#ifndef DISKCACHE_READAHEAD
+#define DISKCACHE_READAHEAD 2  // lines filled at once on sequential misses, also bounce buffer size
+#endif
+
+struct DiskCacheStats {
+	uint32_t reads;         // disk_read calls
+	uint32_t hits;          // sectors served from cache
+	uint32_t misses;        // line fills
+	uint32_t readaheads;    // line fills done for read-ahead
+	uint32_t bypass;        // reads going directly to destination
+	uint32_t bounced;       // commands done through the bounce buffer
+	uint32_t writes;        // disk_write calls
+	uint32_t ll_reads;      // low level read commands issued
+	uint32_t ll_sectors;    // and sectors read
+};
+
+extern struct DiskCacheStats disk_cache_stats;
+
+void disk_cache_invalidate (void); // forget all cached sectors (card change, mount)
+void disk_cache_print (void);      // print statistics with message()
+
+// provided by the low level driver, buff is always word aligned
+DRESULT disk_read_lowlevel (BYTE *buff, DWORD sector, UINT count);
+DRESULT disk_write_lowlevel (const BYTE *buff, DWORD sector, UINT count);
@@ -6,8 +6,7 @@
 /*-----------------------------------------------------------------------*/
 
 #include "diskio.h"
-
-#include <string.h> // memcpy
+#include "diskcache.h"
 
 #include "stm32f4xx.h"
 #include "stm32f4_discovery_sdio_sd.h"
@@ -52,6 +51,8 @@ DSTATUS disk_initialize (
 		stat |= STA_NOINIT;
 	}
 
+	disk_cache_invalidate();
+
 	return(stat);
 }
 
@@ -89,15 +90,10 @@ DSTATUS disk_status (
 
 /*-----------------------------------------------------------------------*/
 /* Read Sector(s)                                                        */
+/* called by diskcache.c, which provides disk_read with aligned buffers  */
 
-// NOT ON THE STACK , stack is in CCM ! 
-static DWORD scratch[BLOCK_SIZE / 4]; // Alignment assured, you'll need a sufficiently big stack
-
-
-
-DRESULT disk_read (
-        BYTE drv,               /* Physical drive nmuber (0..) */
-        BYTE *buff,             /* Data buffer to store read data */
+DRESULT disk_read_lowlevel (
+        BYTE *buff,             /* Data buffer to store read data, word aligned */
         DWORD sector,   				/* Sector address (LBA) */
         UINT count              /* Number of sectors to read (1..255) */
 )
@@ -107,26 +103,6 @@ DRESULT disk_read (
 	if (SD_Detect() != SD_PRESENT)
 		return(RES_NOTRDY);
 
-	if ((DWORD)buff & 3) 
-	// DMA Alignment failure, do single up to aligned buffer
-	{
-		DRESULT res = RES_OK;
-
-		while(count--)
-		{
-			res = disk_read(drv, (void *)scratch, sector++, 1);
-
-			if (res != RES_OK)
-				break;
-
-			memcpy(buff, scratch, BLOCK_SIZE);
-
-			buff += BLOCK_SIZE;
-		}
-
-		return(res);
-	}
-	
 	Status = SD_ReadMultiBlocksFIXED(buff, sector, BLOCK_SIZE, count); // 4GB Compliant
 
 	if (Status == SD_OK)
@@ -150,9 +126,8 @@ DRESULT disk_read (
 /* Write Sector(s)                                                       */
 
 #if _READONLY == 0
-DRESULT disk_write (
-        BYTE drv,                /* Physical drive nmuber (0..) */
-        const BYTE *buff,       /* Data to be written */
+DRESULT disk_write_lowlevel (
+        const BYTE *buff,       /* Data to be written, word aligned */
         DWORD sector,           /* Sector address (LBA) */
         UINT count              /* Number of sectors to write (1..255) */
 )
@@ -160,32 +135,12 @@ DRESULT disk_write (
 	SD_Error Status;
 
 #ifdef DBGIO
-	printf("disk_write %d %p %10d %d\n",drv,buff,sector,count);
+	printf("disk_write %p %10d %d\n",buff,sector,count);
 #endif
 	
 	if (SD_Detect() != SD_PRESENT)
 		return(RES_NOTRDY);
 
-	if ((DWORD)buff & 3) // DMA Alignment failure, do single up to aligned buffer
-	{
-		DRESULT res = RES_OK;
-		// WORD scratch[BLOCK_SIZE / 4]; // Alignment assured, you'll need a sufficiently big stack NOPE NOT ON THE STACK
-
-		while(count--)
-		{
-			memcpy(scratch, buff, BLOCK_SIZE);
-
-			res = disk_write(drv, (void *)scratch, sector++, 1);
-
-			if (res != RES_OK)
-				break;
-
-			buff += BLOCK_SIZE;
-		}
-
-		return(res);
-	}
-
   Status = SD_WriteMultiBlocksFIXED((uint8_t *)buff, sector, BLOCK_SIZE, count); // 4GB Compliant
 
 	if (Status == SD_OK)
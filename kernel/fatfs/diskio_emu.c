@@ -0,0 +1,180 @@
+/*-----------------------------------------------------------------------*/
+/* Emulator disk I/O : FAT disk image file backend                       */
+/*-----------------------------------------------------------------------*/
+/* Lets the emulator run the real ff.c against an image of an SD card,   */
+/* so that file access patterns (and their cost) are those of the device. */
+/*                                                                       */
+/* The image is read from $BITBOX_SDIMAGE, or sdcard.img by default.     */
+/* It can be a raw FAT volume or a partitioned disk, create it with by   */
+/* example mkfs.fat -C sdcard.img 65536 ; mcopy -i sdcard.img files ::   */
+/* or kernel/mk_sdimage.py                                               */
+/*-----------------------------------------------------------------------*/
+
+#define _XOPEN_SOURCE 700 // pread, pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bitbox.h"
+#include "diskio.h"
+#include "ff.h" // get_fattime
+#include "diskcache.h"
+#include "disk_stats.h"
+
+#define BLOCK_SIZE 512 /* Block Size in Bytes */
+
+static int disk_fd = -1;
+static DWORD disk_sectors;
+static DSTATUS disk_stat = STA_NOINIT;
+
+/*-----------------------------------------------------------------------*/
+/* Inidialize a Drive                                                    */
+
+DSTATUS disk_initialize (
+	BYTE drv				/* Physical drive nmuber (0..) */
+)
+{
+	/* Supports only single drive */
+	if (drv)
+		return STA_NOINIT;
+
+	if (disk_fd >= 0)
+		return disk_stat;
+
+	disk_cache_invalidate();
+
+	const char *path = getenv("BITBOX_SDIMAGE");
+	if (!path || !*path)
+		path = "sdcard.img";
+
+	disk_stat = 0;
+	disk_fd = open(path, O_RDWR);
+	if (disk_fd < 0) {
+		disk_fd = open(path, O_RDONLY);
+		disk_stat |= STA_PROTECT;
+	}
+	if (disk_fd < 0) {
+		message("Error opening SD card image %s\n", path);
+		disk_stat = STA_NOINIT | STA_NODISK;
+		return disk_stat;
+	}
+
+	struct stat st;
+	fstat(disk_fd, &st);
+	disk_sectors = st.st_size / BLOCK_SIZE;
+
+	return disk_stat;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Return Disk Status                                                    */
+
+DSTATUS disk_status (
+	BYTE drv				/* Physical drive nmuber (0..) */
+)
+{
+	return drv ? STA_NOINIT : disk_stat;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s), called by diskcache.c                                 */
+
+DRESULT disk_read_lowlevel (
+	BYTE *buff,				/* Data buffer to store read data */
+	DWORD sector,			/* Sector address (LBA) */
+	UINT count				/* Number of sectors to read (1..255) */
+)
+{
+	if (disk_stat & STA_NOINIT)
+		return RES_NOTRDY;
+	if (sector+count > disk_sectors)
+		return RES_PARERR;
+
+	disk_stats_request(0, sector, count);
+
+	ssize_t n = pread(disk_fd, buff, count*BLOCK_SIZE, (off_t)sector*BLOCK_SIZE);
+	return n == (ssize_t)(count*BLOCK_SIZE) ? RES_OK : RES_ERROR;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s), called by diskcache.c                                */
+
+DRESULT disk_write_lowlevel (
+	const BYTE *buff,		/* Data to be written */
+	DWORD sector,			/* Sector address (LBA) */
+	UINT count				/* Number of sectors to write (1..255) */
+)
+{
+	if (disk_stat & STA_NOINIT)
+		return RES_NOTRDY;
+	if (disk_stat & STA_PROTECT)
+		return RES_WRPRT;
+	if (sector+count > disk_sectors)
+		return RES_PARERR;
+
+	disk_stats_request(1, sector, count);
+
+	ssize_t n = pwrite(disk_fd, buff, count*BLOCK_SIZE, (off_t)sector*BLOCK_SIZE);
+	return n == (ssize_t)(count*BLOCK_SIZE) ? RES_OK : RES_ERROR;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+
+DRESULT disk_ioctl (
+	BYTE drv,				/* Physical drive nmuber (0..) */
+	BYTE ctrl,				/* Control code */
+	void *buff				/* Buffer to send/receive control data */
+)
+{
+	if (drv || disk_stat & STA_NOINIT)
+		return RES_NOTRDY;
+
+	switch (ctrl) {
+		case CTRL_SYNC :
+			return fsync(disk_fd) ? RES_ERROR : RES_OK;
+		case GET_SECTOR_COUNT :
+			*(DWORD*)buff = disk_sectors;
+			return RES_OK;
+		case GET_SECTOR_SIZE :
+			*(WORD*)buff = BLOCK_SIZE;
+			return RES_OK;
+		case GET_BLOCK_SIZE :
+			*(DWORD*)buff = 1;
+			return RES_OK;
+		default :
+			return RES_PARERR;
+	}
+}
+
+// misc pseudo unicode, same as device
+WCHAR ff_convert (WCHAR wch, UINT dir)
+{
+	return wch < 0x80 ? wch : 0; // ASCII only
+}
+
+WCHAR ff_wtoupper (WCHAR wch)
+{
+	if (wch < 0x80) {
+		if (wch >= 'a' && wch <= 'z')
+			wch &= ~0x20;
+		return wch;
+	}
+	return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Get current time                                                      */
+/*-----------------------------------------------------------------------*/
+DWORD get_fattime(void)
+{
+	time_t t = time(0);
+	struct tm *tm = localtime(&t);
+
+	return (DWORD)(tm->tm_year-80) << 25 | (DWORD)(tm->tm_mon+1) << 21 | (DWORD)tm->tm_mday << 16 |
+		(DWORD)tm->tm_hour << 11 | (DWORD)tm->tm_min << 5 | (DWORD)tm->tm_sec >> 1;
+}
@@ -115,6 +115,7 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of disk I/O functions */
+#include "disk_stats.h"	/* Emulator access statistics (nothing on device) */
 
 
 
@@ -2374,6 +2375,7 @@ FRESULT f_mount (
 	FRESULT res;
 	const TCHAR *rp = path;
 
+	disk_stats_call(DISK_API_MOUNT, 0);
 
 	vol = get_ldnumber(&rp);
 	if (vol < 0) return FR_INVALID_DRIVE;
@@ -2423,6 +2425,7 @@ FRESULT f_open (
 
 
 	if (!fp) return FR_INVALID_OBJECT;
+	disk_stats_open(fp, path);
 	fp->fs = 0;			/* Clear file object */
 
 	/* Get logical drive number */
@@ -2559,6 +2562,7 @@ FRESULT f_read (
 
 
 	*br = 0;	/* Clear read byte counter */
+	disk_stats_call(DISK_API_READ, fp);
 
 	res = validate(fp);							/* Check validity */
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
@@ -2661,6 +2665,7 @@ FRESULT f_write (
 
 
 	*bw = 0;	/* Clear write byte counter */
+	disk_stats_call(DISK_API_WRITE, fp);
 
 	res = validate(fp);						/* Check validity */
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
@@ -2822,6 +2827,7 @@ FRESULT f_close (
 {
 	FRESULT res;
 
+	disk_stats_call(DISK_API_CLOSE, fp);
 
 #if !_FS_READONLY
 	res = f_sync(fp);					/* Flush cached data */
@@ -2995,6 +3001,7 @@ FRESULT f_lseek (
 {
 	FRESULT res;
 
+	disk_stats_call(DISK_API_LSEEK, fp);
 
 	res = validate(fp);					/* Check validity of the object */
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
@@ -3157,6 +3164,7 @@ FRESULT f_opendir (
 
 
 	if (!dp) return FR_INVALID_OBJECT;
+	disk_stats_call(DISK_API_OPENDIR, 0);
 
 	/* Get logical drive number */
 	res = find_volume(&fs, &path, 0);
@@ -3242,6 +3250,7 @@ FRESULT f_readdir (
 	FRESULT res;
 	DEF_NAMEBUF;
 
+	disk_stats_call(DISK_API_READDIR, 0);
 
 	res = validate(dp);						/* Check validity of the object */
 	if (res == FR_OK) {
@@ -0,0 +1,450 @@
+// ff_emu.c : limited fatfs-related functions for the emulator, using host files.
+// XXX add non readonly features
+// This is the default emulator backend, see diskio_emu.c to run the real fatfs on a disk image.
+//
+// Disk accesses are not real here, so the commands fatfs would issue on device are estimated
+// and fed to disk_stats to get the projected SD card times : files are supposed contiguous,
+// on FAT32 with the cluster size of the SD profile, and we mimic the fatfs sector buffer
+// of each FIL object.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define DIR NIX_DIR // prevents name clashes with datfs DIR
+#include <dirent.h>
+#undef DIR
+
+#include "ff.h"
+#include "ff_map.h"
+#include "disk_stats.h"
+
+// -- SD card access model
+
+#define SECT 512
+#define FAT_ENTRIES 128       // FAT32 entries per FAT sector
+#define DIR_AREA 0x1000       // virtual sectors of directories ...
+#define FAT_AREA 0x2000       // ... of the FAT
+#define DATA_AREA 0x10000     // ... and of file data
+#define NO_SECTOR 0xFFFFFFFF
+
+static DWORD cluster_sectors = 64; // from the SD profile at f_mount, see disk_stats.h
+
+static DWORD hash_path(const char *path)
+{
+    DWORD h = 2166136261u; // FNV-1a
+    for (;*path;path++)
+        h = (h ^ *path) * 16777619u;
+    return h;
+}
+
+// virtual first sector of a file, stable across reopens
+static DWORD file_base(const char *path, DWORD size)
+{
+    static struct {DWORD hash, base;} table[256];
+    static int nb;
+    static DWORD next_base = DATA_AREA;
+
+    const DWORD h = hash_path(path);
+    for (int i=0;i<nb;i++)
+        if (table[i].hash == h)
+            return table[i].base;
+
+    DWORD base = next_base;
+    next_base += (size/SECT/cluster_sectors + 1) * cluster_sectors + cluster_sectors; // leave room to grow
+    if (nb<256) {
+        table[nb].hash = h;
+        table[nb++].base = base;
+    }
+    return base;
+}
+
+// FAT sectors read to follow the cluster chain from cluster a to b (file relative)
+static void model_chain(const FIL *fp, DWORD from, DWORD to)
+{
+    const DWORD fat0 = FAT_AREA + (fp->sclust-DATA_AREA)/cluster_sectors/FAT_ENTRIES;
+    for (DWORD f=from/FAT_ENTRIES; f<=to/FAT_ENTRIES; f++)
+        disk_stats_request(0, fat0+f, 1);
+}
+
+// flush sector buffer if dirty
+static void model_flush(FIL *fp)
+{
+    if (fp->flag & FA__DIRTY) {
+        disk_stats_request(1, fp->dsect, 1);
+        fp->flag &= ~FA__DIRTY;
+    }
+}
+
+// accesses done by fatfs f_read / f_write of n bytes at fp->fptr, updates fptr
+static void model_rw(FIL *fp, UINT n, int write)
+{
+    while (n) {
+        const DWORD sect = fp->sclust + fp->fptr/SECT;
+        const UINT ofs = fp->fptr%SECT;
+
+        if (ofs==0 && fp->fptr && fp->fptr%(cluster_sectors*SECT)==0) {
+            // next cluster : a FAT lookup, one FAT sector covers many clusters
+            // (not needed with a link map)
+            const DWORD cl = fp->fptr/SECT/cluster_sectors;
+            if (!fp->cltbl && cl%FAT_ENTRIES==0)
+                model_chain(fp, cl, cl);
+        }
+
+        UINT cc = n/SECT;
+        if (ofs==0 && cc) {
+            // whole sectors go directly to/from the user buffer, up to the cluster end
+            const UINT left = cluster_sectors - (fp->fptr/SECT)%cluster_sectors;
+            if (cc > left) cc = left;
+            if (fp->dsect - sect < cc) // buffered sector is overwritten or stale
+                model_flush(fp);
+            disk_stats_request(write, sect, cc);
+            fp->fptr += cc*SECT;
+            n -= cc*SECT;
+            continue;
+        }
+
+        // partial sector through the FIL buffer
+        if (fp->dsect != sect) {
+            model_flush(fp);
+            if (!write || fp->fptr < fp->fsize)
+                disk_stats_request(0, sect, 1);
+            fp->dsect = sect;
+        }
+        UINT k = SECT-ofs < n ? SECT-ofs : n;
+        if (write)
+            fp->flag |= FA__DIRTY;
+        fp->fptr += k;
+        n -= k;
+    }
+    if (write && fp->fptr > fp->fsize) {
+        fp->fsize = fp->fptr;
+        fp->flag |= FA__WRITTEN;
+    }
+}
+
+// directory lookup of a path, one directory sector per element
+static void model_lookup(const char *path)
+{
+    DWORD dir = 0;
+    disk_stats_request(0, DIR_AREA, 1); // root
+    for (const char *p=path; *p; p++)
+        if (*p=='/' && p[1]) {
+            dir = dir*31 + (p-path);
+            disk_stats_request(0, DIR_AREA + 1 + dir%0xFFF, 1);
+        }
+}
+
+// -- fatfs API
+
+// the modelled card is the SD profile : its cluster size is reported in fs, as fatfs does
+FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt)
+{
+    disk_stats_call(DISK_API_MOUNT, 0); // selects the profile
+    cluster_sectors = disk_stats_profile.cluster;
+    if (fs)
+        fs->csize = cluster_sectors;
+    disk_stats_request(0, 0, 1); // boot sector
+    return FR_OK;
+}
+
+FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
+{
+    char *mode_host=0;
+
+    disk_stats_open(fp, path);
+    model_lookup(path);
+
+    // XXX quite buggy ...
+    if (mode & FA_OPEN_ALWAYS) {
+        if (!access(path, F_OK)) // 0 if OK
+            mode_host = "r+";
+        else
+            mode_host = "w+";
+
+    } else switch (mode) {
+        // Not a very good approximation, should rewrite to handle properly
+        case FA_READ | FA_OPEN_EXISTING : mode_host="r"; break;
+        case FA_READ | FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break;
+        case FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break; // faked
+
+        case FA_WRITE | FA_CREATE_NEW : mode_host="wx"; break;
+        case FA_READ | FA_WRITE | FA_CREATE_NEW : mode_host="wx+"; break;
+
+        case FA_READ | FA_WRITE | FA_CREATE_ALWAYS : mode_host="w+"; break;
+        case FA_WRITE | FA_CREATE_ALWAYS : mode_host="w"; break;
+
+        default :
+            return FR_INVALID_PARAMETER;
+    }
+
+    // fill size field
+    struct stat st;
+    if (stat(path, &st) == 0)
+        fp->fsize= st.st_size;
+    else
+        fp->fsize=-1;
+
+    fp->fs = (FATFS*) fopen ((const char*)path,mode_host); // now ignores mode.
+    if (fp->fs) {
+        fp->fptr = 0;
+        fp->flag = 0;
+        fp->dsect = NO_SECTOR;
+        fp->cltbl = 0;
+        fp->sclust = file_base(path, fp->fsize);
+        if (mode_host[0]=='w') {
+            fp->fsize = 0;
+            // directory entry and FAT updates of a created or truncated file
+            disk_stats_request(1, DIR_AREA, 1);
+            disk_stats_request(1, FAT_AREA, 1);
+        }
+        return FR_OK;
+    }
+
+    switch(errno) {
+        case ENOENT:
+            return FR_NO_FILE;
+        case EACCES:
+            return FR_WRITE_PROTECTED;
+        case EEXIST:
+            return FR_EXIST;
+        default:
+            return FR_INT_ERR;
+    }
+
+}
+
+FRESULT f_close (FIL* fp)
+{
+    disk_stats_call(DISK_API_CLOSE, fp);
+    model_flush(fp);
+    if (fp->flag & FA__WRITTEN) {
+        disk_stats_request(1, DIR_AREA, 1); // directory entry
+        disk_stats_request(1, FAT_AREA, 1);
+    }
+
+    int res = fclose( (FILE*) fp->fs);
+    fp->fs=NULL;
+    return res?FR_DISK_ERR:FR_OK; // FIXME handle reasons ?
+}
+
+FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br)
+{
+    disk_stats_call(DISK_API_READ, fp);
+    *br = fread ( buff, 1,btr, (FILE *)fp->fs);
+    model_rw(fp, *br, 0);
+    return FR_OK; // XXX handle ferror
+}
+
+FRESULT f_write (FIL* fp, const void* buff, UINT btr, UINT* br)
+{
+    disk_stats_call(DISK_API_WRITE, fp);
+    *br = fwrite ( buff,1, btr, (FILE *)fp->fs);
+    model_rw(fp, *br, 1);
+    return FR_OK; // XXX handle ferror
+}
+
+
+FRESULT f_lseek (FIL* fp, DWORD ofs)
+{
+    disk_stats_call(DISK_API_LSEEK, fp);
+
+    if (fp->cltbl && ofs == CREATE_LINKMAP) {
+        // host files are seen as contiguous : a single fragment
+        const DWORD nclust = fp->fsize/SECT/cluster_sectors + 1;
+        model_chain(fp, 0, nclust-1);
+        if (fp->cltbl[0] < 4) {
+            fp->cltbl[0] = 4;
+            return FR_NOT_ENOUGH_CORE;
+        }
+        fp->cltbl[0] = 4;
+        fp->cltbl[1] = nclust;
+        fp->cltbl[2] = fp->sclust/cluster_sectors;
+        fp->cltbl[3] = 0;
+        return FR_OK;
+    }
+
+    int res = fseek ( (FILE *)fp->fs, ofs, SEEK_SET);
+    if (res)
+        return FR_DISK_ERR;
+
+    // fatfs follows the cluster chain, from the start if going backwards (unless mapped)
+    const DWORD cl_from = ofs < fp->fptr ? 0 : fp->fptr/SECT/cluster_sectors;
+    const DWORD cl_to = ofs/SECT/cluster_sectors;
+    if (!fp->cltbl && (cl_to > cl_from || (ofs < fp->fptr && cl_to)))
+        model_chain(fp, cl_from, cl_to);
+
+    // and loads the new sector if not at a sector boundary
+    const DWORD sect = fp->sclust + ofs/SECT;
+    if (ofs%SECT && sect != fp->dsect) {
+        model_flush(fp);
+        disk_stats_request(0, sect, 1);
+        fp->dsect = sect;
+    }
+    fp->fptr = ofs;
+    return FR_OK; // always from start
+}
+
+/* Change current directory */
+FRESULT f_chdir (const char* path)
+{
+    int res = chdir(path);
+    return res ? FR_DISK_ERR : FR_OK;
+}
+
+
+FRESULT f_opendir ( DIR* dp, const TCHAR* path )
+{
+    if (path[0] == 0)
+        path = ".";
+    disk_stats_call(DISK_API_OPENDIR, 0);
+    model_lookup(path);
+    NIX_DIR *res = opendir(path);
+    if (res) {
+        dp->fs = (FATFS*) res; // hides it in the fs field as a fatfs variable
+        dp->dir = (unsigned char *)path;
+        dp->index = 0;
+        return FR_OK;
+    } else {
+        printf("Error opening directory %s: %s\n", path, strerror(errno));
+        return FR_DISK_ERR;
+    }
+}
+
+FRESULT f_readdir ( DIR* dp, FILINFO* fno )
+{
+    errno=0;
+    char buffer[512]; // assumes max path size for FAT32
+
+    disk_stats_call(DISK_API_READDIR, 0);
+    struct dirent *de = readdir((NIX_DIR *)dp->fs);
+    if (de && (dp->index++ % (SECT/32/2))==0) // 32 bytes entries, about half of them long names
+        disk_stats_request(0, DIR_AREA + 0x800 + dp->index/8, 1);
+
+    if (de) {
+        if (strlen(de->d_name)<=12) {
+            // not long filename
+            for (int i=0;i<13;i++)
+                fno->fname[i]=de->d_name[i];
+            if (fno->lfname) fno->lfname[0]='\0';
+        } else {
+            // first make short name
+            // copy first 6 chars
+            for (int i=0;i<6;i++)
+                fno->fname[i]=de->d_name[i];
+            fno->fname[6]='~';
+            fno->fname[7]='0'; // FIXME : multiple files
+            fno->fname[8]='.';
+
+            // copy extension and terminating zero (fname is 13 chars)
+            for (int i=0;i<4;i++)
+                fno->fname[9+i]=de->d_name[strlen(de->d_name)-3+i];
+
+            // make long name
+            if (_USE_LFN && fno->lfname && fno->lfsize) {
+                strncpy(fno->lfname,de->d_name,fno->lfsize-1);
+                fno->lfname[fno->lfsize-1]='\0';
+            }
+        }
+
+
+        fno->fattrib = 0;
+
+        // check attributes of found file
+        strncpy(buffer,(char *)dp->dir,sizeof(buffer)); // BYTE->char
+        strcat(buffer,"/");
+        strcat(buffer,de->d_name); // host name, not the short one
+
+        struct stat stbuf;
+        stat(buffer,&stbuf);
+
+        if (S_ISDIR(stbuf.st_mode))
+             fno->fattrib = AM_DIR;
+        return FR_OK;
+
+    } else {
+        if (errno) {
+            printf("Error reading directory %s: %s\n",dp->dir, strerror(errno)); // not neces an erro, can be end of dir.
+            return FR_DISK_ERR;
+        } else {
+            fno->fname[0]='\0';
+            return FR_OK;
+        }
+    }
+}
+
+FRESULT f_closedir (DIR* dp)
+{
+    if (!closedir((NIX_DIR *)dp->fs)) {
+        return FR_OK ;
+    } else {
+        printf("Error closing directory %s : %s\n",dp->dir, strerror(errno));
+        return FR_DISK_ERR;
+    }
+}
+
+FRESULT f_rename (const char *file_from, const char *file_to)
+{
+    if (!rename(file_from,file_to) ) {
+        return FR_OK;
+    } else {
+        printf("Error renaming %s to %s : : %s\n",file_from, file_to, strerror(errno));
+        return FR_DISK_ERR;
+    }
+}
+
+// read only mapping of host files, see ff_map.h
+const void *f_map (const TCHAR *path, DWORD offset, DWORD *len)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd<0 || fstat(fd, &st)) {
+        printf("Error mapping %s : %s\n", path, strerror(errno));
+        if (fd>=0) close(fd);
+        return 0;
+    }
+
+    if (offset > st.st_size)
+        offset = st.st_size;
+    if (!*len || *len > st.st_size-offset)
+        *len = st.st_size-offset;
+
+    // account as the device would load it
+    static FIL map_fil;
+    disk_stats_open(&map_fil, path);
+    model_lookup(path);
+    map_fil.fptr = offset;
+    map_fil.fsize = st.st_size;
+    map_fil.dsect = NO_SECTOR;
+    map_fil.cltbl = 0;
+    map_fil.sclust = file_base(path, st.st_size);
+    model_rw(&map_fil, *len, 0);
+
+    if (!*len) {
+        close(fd);
+        return "";
+    }
+
+    // mmap offsets must be page aligned
+    const DWORD delta = offset % sysconf(_SC_PAGESIZE);
+    void *p = mmap(0, *len+delta, PROT_READ, MAP_SHARED, fd, offset-delta);
+    close(fd);
+    if (p == MAP_FAILED) {
+        printf("Error mapping %s : %s\n", path, strerror(errno));
+        return 0;
+    }
+    return (const char *)p + delta;
+}
+
+void f_unmap (const void *data, DWORD len)
+{
+    if (!data || !len)
+        return;
+    const DWORD delta = (uintptr_t)data % sysconf(_SC_PAGESIZE);
+    munmap((char *)data - delta, len+delta);
+}
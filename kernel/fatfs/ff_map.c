@@ -0,0 +1,47 @@
+// ff_map.c : f_map fallback, loading the region into RAM allocated by tinymalloc. See ff_map.h
+// (the emulator host files backend mmaps files instead, see ff_emu.c)
+
+#include "bitbox.h"
+#include "ff_map.h"
+#include "lib/resources/tinymalloc.h" // no libc heap on device
+
+const void *f_map (const TCHAR *path, DWORD offset, DWORD *len)
+{
+	FIL f;
+	UINT br;
+
+	FRESULT res = f_open(&f, path, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK) {
+		message("f_map: error %d opening %s\n", res, path);
+		return 0;
+	}
+
+	if (offset > f_size(&f))
+		offset = f_size(&f);
+	if (!*len || *len > f_size(&f)-offset)
+		*len = f_size(&f)-offset;
+
+	void *data = t_malloc(*len ? *len : 1);
+	if (!data) {
+		message("f_map: cannot allocate %u bytes for %s\n", *len, path);
+		f_close(&f);
+		return 0;
+	}
+
+	res = f_lseek(&f, offset);
+	if (res == FR_OK)
+		res = f_read(&f, data, *len, &br);
+	f_close(&f);
+
+	if (res != FR_OK || br != *len) {
+		message("f_map: error %d reading %s\n", res, path);
+		t_free(data);
+		return 0;
+	}
+	return data;
+}
+
+void f_unmap (const void *data, DWORD len)
+{
+	t_free((void *)data);
+}
@@ -0,0 +1,24 @@
+/* ff_map : read-only access to a region of a file as a const pointer.
+
+   On the emulator with the host files backend, the file is mmap'ed : no copy, instant
+   even for big asset sets, and pages are shared between several running instances.
+   Elsewhere (device, emulator disk image) the region is loaded into a buffer from
+   tinymalloc, so the data must fit in RAM : tinymalloc must be implemented by the game
+   (TINYMALLOC_IMPLEMENTATION) and given memory with t_addchunk.
+
+   Use it for assets treated as const (sprites, tilemaps, btc4 videos, ...) :
+
+	DWORD len = 0;
+	const uint8_t *spr = f_map("tiles.spr", 0, &len);
+	...
+	f_unmap(spr, len);
+*/
+#pragma once
+#include "ff.h"
+
+// Maps len bytes of file path starting at offset (len 0 : up to the end of file).
+// *len is set to the mapped length. Returns 0 on error.
+const void *f_map (const TCHAR *path, DWORD offset, DWORD *len);
+
+// Releases a region returned by f_map, with its length
+void f_unmap (const void *data, DWORD len);
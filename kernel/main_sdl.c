@@ -16,12 +16,6 @@
 #include "bitbox.h"
 #undef draw_buffer
 
-#define DIR NIX_DIR // prevents name clashes with datfs DIR
-#include <dirent.h>
-#undef DIR
-
-#include "fatfs/ff.h"
-
 // ticks in ms
 #define TICK_INTERVAL 1000/60
 #define USER_BUTTON_KEY SDLK_F12
@@ -572,197 +566,6 @@ static bool handle_events()
     return false; // don't exit  now
 }
 
-// -------------------------------------------------
-// limited fatfs-related functions.
-// XXX add non readonly features
-
-#ifdef USE_SDCARD
-
-FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt)
-{
-    return FR_OK;
-}
-
-FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
-{
-    char *mode_host=0;
-
-    // XXX quite buggy ...
-    if (mode & FA_OPEN_ALWAYS) {
-        if (!access(path, F_OK)) // 0 if OK
-            mode_host = "r+";
-        else
-            mode_host = "w+";
-
-    } else switch (mode) {
-        // Not a very good approximation, should rewrite to handle properly
-        case FA_READ | FA_OPEN_EXISTING : mode_host="r"; break;
-        case FA_READ | FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break;
-        case FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break; // faked
-
-        case FA_WRITE | FA_CREATE_NEW : mode_host="wx"; break;
-        case FA_READ | FA_WRITE | FA_CREATE_NEW : mode_host="wx+"; break;
-
-        case FA_READ | FA_WRITE | FA_CREATE_ALWAYS : mode_host="w+"; break;
-        case FA_WRITE | FA_CREATE_ALWAYS : mode_host="w"; break;
-
-        default :
-            return FR_INVALID_PARAMETER;
-    }
-
-    // fill size field
-    struct stat st;
-    if (stat(path, &st) == 0)
-        fp->fsize= st.st_size;
-    else
-        fp->fsize=-1;
-
-    fp->fs = (FATFS*) fopen ((const char*)path,mode_host); // now ignores mode.
-    if (fp->fs) return FR_OK;
-
-    switch(errno) {
-        case ENOENT:
-            return FR_NO_FILE;
-        case EACCES:
-            return FR_WRITE_PROTECTED;
-        case EEXIST:
-            return FR_EXIST;
-        default:
-            return FR_INT_ERR;
-    }
-
-}
-
-FRESULT f_close (FIL* fp)
-{
-    int res = fclose( (FILE*) fp->fs);
-    fp->fs=NULL;
-    return res?FR_DISK_ERR:FR_OK; // FIXME handle reasons ?
-}
-
-FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br)
-{
-    *br = fread ( buff, 1,btr, (FILE *)fp->fs);
-    return FR_OK; // XXX handle ferror
-}
-
-FRESULT f_write (FIL* fp, const void* buff, UINT btr, UINT* br)
-{
-    *br = fwrite ( buff,1, btr, (FILE *)fp->fs);
-    return FR_OK; // XXX handle ferror
-}
-
-
-FRESULT f_lseek (FIL* fp, DWORD ofs)
-{
-    int res = fseek ( (FILE *)fp->fs, ofs, SEEK_SET);
-    return res ? FR_DISK_ERR : FR_OK; // always from start
-}
-
-/* Change current directory */
-FRESULT f_chdir (const char* path)
-{
-    int res = chdir(path);
-    return res ? FR_DISK_ERR : FR_OK;
-}
-
-
-FRESULT f_opendir ( DIR* dp, const TCHAR* path )
-{
-    if (path[0] == 0)
-        path = ".";
-    NIX_DIR *res = opendir(path);
-    if (res) {
-        dp->fs = (FATFS*) res; // hides it in the fs field as a fatfs variable
-        dp->dir = (unsigned char *)path;
-        return FR_OK;
-    } else {
-        printf("Error opening directory %s: %s\n", path, strerror(errno));
-        return FR_DISK_ERR;
-    }
-}
-
-FRESULT f_readdir ( DIR* dp, FILINFO* fno )
-{
-    errno=0;
-    char buffer[512]; // assumes max path size for FAT32
-
-    struct dirent *de = readdir((NIX_DIR *)dp->fs);
-
-    if (de) {
-        if (strlen(de->d_name)<=12) {
-            // not long filename
-            for (int i=0;i<13;i++)
-                fno->fname[i]=de->d_name[i];
-            fno->lfname[0]='\0';
-        } else {
-            // first make short name
-            // copy first 6 chars
-            for (int i=0;i<6;i++)
-                fno->fname[i]=de->d_name[i];
-            fno->fname[6]='~';
-            fno->fname[7]='0'; // FIXME : multiple files
-            fno->fname[8]='.';
-
-            // copy extension
-            for (int i=0;i<4;i++)
-                fno->fname[9+i]=de->d_name[strlen(de->d_name)-3+i];
-            fno->fname[14]='\0';
-
-            // make long name
-            if(_USE_LFN) {
-                strncpy(fno->lfname,de->d_name,_MAX_LFN);
-            } else {
-                fno->lfname[0]='\0';
-            }
-        }
-
-
-        fno->fattrib = 0;
-
-        // check attributes of found file
-        strncpy(buffer,(char *)dp->dir,sizeof(buffer)); // BYTE->char
-        strcat(buffer,"/");
-        strcat(buffer,fno->fname);
-
-        struct stat stbuf;
-        stat(buffer,&stbuf);
-
-        if (S_ISDIR(stbuf.st_mode))
-             fno->fattrib = AM_DIR;
-        return FR_OK;
-
-    } else {
-        if (errno) {
-            printf("Error reading directory %s: %s\n",dp->dir, strerror(errno)); // not neces an erro, can be end of dir.
-            return FR_DISK_ERR;
-        } else {
-            fno->fname[0]='\0';
-            return FR_OK;
-        }
-    }
-}
-
-FRESULT f_closedir (DIR* dp)
-{
-    if (!closedir((NIX_DIR *)dp->fs)) {
-        return FR_OK ;
-    } else {
-        printf("Error closing directory %s : %s\n",dp->dir, strerror(errno));
-        return FR_DISK_ERR;
-    }
-}
-
-FRESULT f_rename (const char *file_from, const char *file_to)
-{
-    if (!rename(file_from,file_to) ) {
-        return FR_OK;
-    } else {
-        printf("Error renaming %s to %s : : %s\n",file_from, file_to, strerror(errno));
-        return FR_DISK_ERR;
-    }
-}
-#endif // USE_SDCARD
 // -- misc bitbox functions
 
 // user button
@@ -25,12 +25,6 @@ and provide bitbox API stubs
 // emulated interfaces
 #include "bitbox.h"
 
-#define DIR NIX_DIR // prevents name clashes with datfs DIR
-#include <dirent.h>
-#undef DIR
-
-#include "fatfs/ff.h"
-
 
 // ----------------------------- kernel ----------------------------------
 /* The only function of the kernel is
@@ -129,105 +123,6 @@ static void handle_gamepad()
     // XXX generate random keyboard events ?
 }
 
-// -------------------------------------------------
-// limited fatfs-related functions.
-FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt)
-{
-    return FR_OK;
-}
-
-FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode)
-{
-    char *mode_host=0;
-
-    // XXX quite buggy ...
-    if (mode & FA_OPEN_ALWAYS) {
-        if (!access(path, F_OK)) // 0 if OK
-            mode_host = "r+";
-        else
-            mode_host = "w+";
-
-    } else switch (mode) {
-        // Not a very good approximation, should rewrite to handle properly
-        case FA_READ | FA_OPEN_EXISTING : mode_host="r"; break;
-        case FA_READ | FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break;
-        case FA_WRITE | FA_OPEN_EXISTING : mode_host="r+"; break; // faked
-
-        case FA_WRITE | FA_CREATE_NEW : mode_host="wx"; break;
-        case FA_READ | FA_WRITE | FA_CREATE_NEW : mode_host="wx+"; break;
-
-        case FA_READ | FA_WRITE | FA_CREATE_ALWAYS : mode_host="w+"; break;
-        case FA_WRITE | FA_CREATE_ALWAYS : mode_host="w"; break;
-
-        default :
-            return FR_DISK_ERR;
-    }
-
-    fp->fs = (FATFS*) fopen ((const char*)path,mode_host); // now ignores mode.
-    return fp->fs ? FR_OK : FR_DISK_ERR; // XXX duh.
-}
-
-FRESULT f_close (FIL* fp)
-{
-    int res = fclose( (FILE*) fp->fs);
-    fp->fs=NULL;
-    return res?FR_DISK_ERR:FR_OK; // FIXME handle reasons ?
-}
-
-FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br)
-{
-    *br = fread ( buff, 1,btr, (FILE *)fp->fs);
-    return FR_OK; // XXX handle ferror
-}
-
-FRESULT f_write (FIL* fp, const void* buff, UINT btr, UINT* br)
-{
-    *br = fwrite ( buff,1, btr, (FILE *)fp->fs);
-    return FR_OK; // XXX handle ferror
-}
-
-
-FRESULT f_lseek (FIL* fp, DWORD ofs)
-{
-    int res = fseek ( (FILE *)fp->fs, ofs, SEEK_SET);
-    return res ? FR_DISK_ERR : FR_OK; // always from start
-}
-
-/* Change current directory */
-FRESULT f_chdir (const char* path)
-{
-    int res = chdir(path);
-    return res ? FR_DISK_ERR : FR_OK;
-}
-
-
-FRESULT f_opendir ( DIR* dp, const TCHAR* path )
-{
-    NIX_DIR *res = opendir(path);
-    if (res) {
-        dp->fs = (FATFS*) res; // hides it in the fs field as a fatfs variable
-        dp->dir = (unsigned char *)path;
-        return FR_OK;
-    } else {
-        printf("Error opening directory : %s\n",strerror(errno));
-        return FR_DISK_ERR;
-    }
-}
-
-
-FRESULT f_readdir ( DIR* dp, FILINFO* fno )
-{
-    struct dirent *de = readdir((NIX_DIR *)dp->fs); // updates ?
-    if (de) {
-        for (int i=0;i<13;i++)
-            fno->fname[i]=de->d_name[i];
-        return FR_OK;
-    } else {
-        printf("Error reading directory %s : %s\n",dp->dir, strerror(errno));
-        return FR_DISK_ERR;
-    }
-}
-
 // user button
 int button_state() {
     return user_button;
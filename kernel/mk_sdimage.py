@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""make a FAT16 SD card image from a directory, for the emulator USE_SDIMAGE backend.
+
+usage : mk_sdimage.py directory [-o sdcard.img] [-s size_in_MB]
+
+The image is a raw FAT16 volume (no partition table), files are stored with
+long file names and contiguous clusters, in directory listing order.
+Use mkfs.fat + mtools instead if you want a FAT32 or fragmented volume.
+"""
+
+import os
+import sys
+import struct
+import argparse
+
+SECTOR = 512
+ROOT_ENTRIES = 512
+RESERVED = 1
+NB_FATS = 2
+
+
+def layout(total):
+    "find sectors per cluster and FAT size for a FAT16 volume of total sectors"
+    root_sectors = ROOT_ENTRIES * 32 // SECTOR
+    # cluster size of usual formatters first, so that multi-sector reads look like on a real card
+    mb = total * SECTOR >> 20
+    usual = 4 if mb <= 256 else 8 if mb <= 512 else 16 if mb <= 1024 else 32
+    for spc in sorted((1, 2, 4, 8, 16, 32, 64), key=lambda s: (s != usual, s)):
+        fat_size = 1
+        while True:
+            data = total - RESERVED - NB_FATS * fat_size - root_sectors
+            clusters = data // spc
+            need = ((clusters + 2) * 2 + SECTOR - 1) // SECTOR
+            if need <= fat_size:
+                break
+            fat_size = need
+        if 4085 <= clusters < 65525:
+            return spc, fat_size, clusters
+    raise ValueError("volume size not suitable for FAT16")
+
+
+def lfn_checksum(sfn):
+    s = 0
+    for c in sfn:
+        s = (((s & 1) << 7) + (s >> 1) + c) & 0xFF
+    return s
+
+
+def short_name(name, used):
+    "8.3 name, returns (sfn bytes, needs lfn)"
+    base, _, ext = name.rpartition(".") if "." in name[1:] else (name, "", "")
+    ok = lambda s: "".join(c for c in s.upper() if c.isalnum() or c in "_-~!#$%&'()@^{}")
+    b, e = ok(base), ok(ext)[:3]
+    if b == base and e == ext and len(b) <= 8 and len(ext) <= 3:
+        sfn = b.ljust(8).encode() + e.ljust(3).encode()
+        if sfn not in used:
+            return sfn, False
+    n = 1
+    while True:
+        tail = "~%d" % n
+        sfn = (b[: 8 - len(tail)] + tail).ljust(8).encode() + e.ljust(3).encode()
+        if sfn not in used:
+            return sfn, True
+        n += 1
+
+
+def dir_entry(sfn, attr, cluster, size):
+    return struct.pack("<11sBBBHHHHHHHI", sfn, attr, 0, 0, 0, 0x21, 0x21, 0, 0, 0x21, cluster, size)
+
+
+def lfn_entries(name, sfn):
+    chk = lfn_checksum(sfn)
+    chars = [ord(c) for c in name] + [0]
+    chars += [0xFFFF] * (-len(chars) % 13)
+    parts = [chars[i : i + 13] for i in range(0, len(chars), 13)]
+    entries = []
+    for n, p in enumerate(parts):
+        order = n + 1 | (0x40 if n == len(parts) - 1 else 0)
+        entries.append(
+            struct.pack("<B5HBBB6HH2H", order, *p[:5], 0x0F, 0, chk, *p[5:11], 0, *p[11:13])
+        )
+    return b"".join(reversed(entries))
+
+
+class Volume:
+    def __init__(self, size):
+        self.total = size // SECTOR
+        self.spc, self.fat_size, self.clusters = layout(self.total)
+        self.fat = [0xFFF8, 0xFFFF] + [0] * self.clusters
+        self.next_cluster = 2
+        self.data = {}  # cluster -> bytes
+
+    def alloc(self, data):
+        "store data in a contiguous cluster chain, returns first cluster"
+        csize = self.spc * SECTOR
+        n = max(1, (len(data) + csize - 1) // csize)
+        first = self.next_cluster
+        if first + n > self.clusters + 2:
+            raise ValueError("image too small")
+        for i in range(n):
+            c = first + i
+            self.fat[c] = c + 1 if i < n - 1 else 0xFFFF
+            self.data[c] = data[i * csize : (i + 1) * csize]
+        self.next_cluster += n
+        return first
+
+    def add_dir(self, path):
+        "store directory content, returns its entries as bytes"
+        entries = []
+        used = set()
+        for name in sorted(os.listdir(path)):
+            full = os.path.join(path, name)
+            sfn, long = short_name(name, used)
+            used.add(sfn)
+            if long:
+                entries.append(lfn_entries(name, sfn))
+            if os.path.isdir(full):
+                entries.append((sfn, full))  # placeholder, needs its cluster
+            else:
+                data = open(full, "rb").read()
+                cluster = self.alloc(data) if data else 0
+                entries.append(dir_entry(sfn, 0x20, cluster, len(data)))
+        return entries
+
+    def build_dir(self, path, own_cluster, parent_cluster):
+        out = b""
+        if own_cluster:
+            out += dir_entry(b".          ", 0x10, own_cluster, 0)
+            out += dir_entry(b"..         ", 0x10, parent_cluster, 0)
+        for e in self.add_dir(path):
+            if type(e) == tuple:
+                sfn, full = e
+                # reserve the subdirectory clusters first, then fill them
+                sub = self.build_subdir(full, own_cluster)
+                e = dir_entry(sfn, 0x10, sub, 0)
+            out += e
+        return out
+
+    def build_subdir(self, path, parent_cluster):
+        nb_entries = 2 + sum(
+            1 + (len(n) + 12) // 13 for n in os.listdir(path)
+        )  # upper bound
+        csize = self.spc * SECTOR
+        nclust = max(1, (nb_entries * 32 + csize - 1) // csize)
+        first = self.alloc(bytes(nclust * csize))
+        content = self.build_dir(path, first, parent_cluster)
+        for i in range(nclust):
+            self.data[first + i] = content[i * csize : (i + 1) * csize]
+        return first
+
+    def write(self, filename, root_path, label):
+        root = self.build_dir(root_path, 0, 0)
+        if len(root) > ROOT_ENTRIES * 32:
+            raise ValueError("too many entries in root directory")
+
+        boot = struct.pack(
+            "<3s8sHBHBHHBHHHIIBBBI11s8s",
+            b"\xEB\x3C\x90", b"BITBOX  ", SECTOR, self.spc, RESERVED, NB_FATS, ROOT_ENTRIES,
+            self.total if self.total < 65536 else 0, 0xF8, self.fat_size, 32, 64, 0,
+            self.total if self.total >= 65536 else 0, 0x80, 0, 0x29, 0xB17B0001,
+            label.upper().ljust(11).encode()[:11], b"FAT16   ",
+        )
+        boot = boot.ljust(510, b"\0") + b"\x55\xAA"
+
+        fat = struct.pack("<%dH" % len(self.fat), *self.fat).ljust(self.fat_size * SECTOR, b"\0")
+        data_start = RESERVED + NB_FATS * self.fat_size + ROOT_ENTRIES * 32 // SECTOR
+
+        with open(filename, "wb") as f:
+            f.truncate(self.total * SECTOR)
+            f.write(boot)
+            f.seek(RESERVED * SECTOR)
+            f.write(fat * NB_FATS)
+            f.write(root)
+            for c, d in sorted(self.data.items()):
+                f.seek((data_start + (c - 2) * self.spc) * SECTOR)
+                f.write(d)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("directory", help="directory to copy to the image root")
+    parser.add_argument("-o", "--output", default="sdcard.img", help="image file (default sdcard.img)")
+    parser.add_argument("-s", "--size", type=int, default=32, help="size in MB (default 32, 4 to 2047)")
+    parser.add_argument("-l", "--label", default="BITBOX", help="volume label")
+    args = parser.parse_args()
+
+    vol = Volume(args.size * 1024 * 1024)
+    vol.write(args.output, args.directory, args.label)
+    print("%s : %d clusters of %d bytes, %d used" % (
+        args.output, vol.clusters, vol.spc * SECTOR, vol.next_cluster - 2), file=sys.stderr)
@@ -0,0 +1,205 @@
+/* host benchmark of the mode 7 tilemap lines
+
+build & run on the host with :
+	gcc -O2 -std=gnu99 -DEMULATOR -DBOARD_BITBOX -DVGA_MODE=320 -I../.. -I../../kernel \
+		bench_mode7.c blitter_mode7.c blitter_tmap.c -lm -o bench_mode7 && ./bench_mode7 [tilemap cycles]
+
+A perspective floor on the lower half of a 320x240 screen, and a rotating map, are drawn
+from a random 64x64 map of 16x16 tiles. Lines are checked against a plain reference sampler
+and timed against lines of a scrolling tilemap of the same tileset. The ratio, applied to
+the device cycles of a tilemap line, gives the device cycles of a mode 7 line, printed
+against the line budget of the board (SYSCLK/VGA_VFREQ).
+
+The tilemap line cycles are an estimate (see TMAP_TILE_CYCLES) unless given as argument :
+measure it on the device as blitter_stats.max of a screen showing only such a tilemap.
+*/
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "blitter.h"
+
+#define MAP 64
+#define TILES 64
+#define FRAMES 200
+
+/* device cycles per 16 pixel tile of tilemap_u8_line8 : index load and test, 16 bytes copied
+   as 4 word loads and stores (unaligned when scrolled) and the loop, counted from the code for
+   the Cortex-M4 running from flash through the ART cache. An estimate, not a measure. */
+#define TMAP_TILE_CYCLES 30
+
+// device clock, as kconf.h (not defined for the emulator)
+#define DEVICE_SYSCLK (8000000UL * PLL_N / PLL_P / PLL_M)
+
+// kernel side
+uint32_t vga_line;
+volatile uint32_t vga_frame;
+#ifdef VGA_SKIPLINE
+volatile int vga_odd;
+#endif
+static pixel_t line_buffer[VGA_H_PIXELS+128];
+pixel_t *draw_buffer = line_buffer+64;
+
+void message (const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static struct {
+	struct TilesetFile header;
+	uint8_t data[TILES*16*16];
+} tileset = {.header = {.tilesize=16, .datacode=1, .nbtiles=TILES}};
+static uint8_t map[MAP*MAP];
+
+// pixel at 16.16 map position, looped
+static pixel_t sample_ref (uint32_t u, uint32_t v, pixel_t under)
+{
+	const int pu = (u>>16) % (MAP*16), pv = (v>>16) % (MAP*16);
+	const int t = map[pv/16*MAP + pu/16];
+	return t ? tileset.data[(t-1)*256 + pv%16*16 + pu%16] : under;
+}
+
+static int check_line (object *o, const struct Mode7Line *l)
+{
+	memset(line_buffer, 0x5a, sizeof(line_buffer));
+	o->line(o);
+
+	int bad = 0;
+	for (int x=-64;x<VGA_H_PIXELS+64;x++) {
+		const int i = x-o->x;
+		pixel_t expected = 0x5a;
+		if (x>=0 && x<VGA_H_PIXELS && i>=0 && i<o->w)
+			expected = sample_ref(l->u + (uint32_t)l->du*i, l->v + (uint32_t)l->dv*i, 0x5a);
+		bad += draw_buffer[x] != expected;
+	}
+	return bad;
+}
+
+static double now (void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+// parameters shown : what the blitter does at vsync after mode7_swap
+static void show (object *o)
+{
+	struct Mode7 *m = (struct Mode7 *)o->c;
+	m->front = !m->front;
+}
+
+// ns per line, drawing all lines of the object for some frames
+static double time_lines (object *o, void (*update)(object *o, int frame))
+{
+	const double start = now();
+	for (int f=0;f<FRAMES;f++) {
+		if (update) {
+			update(o, f);
+			show(o);
+		}
+		for (vga_line=o->y; (int)vga_line<o->y+o->h; vga_line++)
+			o->line(o);
+	}
+	return (now()-start)*1e9/FRAMES/o->h;
+}
+
+static struct Mode7Line floor_table[2*VGA_V_PIXELS]; // double buffered
+static struct Mode7 floor_m, rot_m;
+
+static void turn_floor (object *o, int f)
+{
+	const float a = f*0.02f;
+	const struct Mode7Camera cam = {
+		.x=(int32_t)(f*3.5f*65536), .y=(int32_t)(f*1.25f*65536),
+		.cos=(int32_t)(cosf(a)*65536), .sin=(int32_t)(sinf(a)*65536),
+		.height=24, .focal=VGA_H_PIXELS/2,
+	};
+	mode7_perspective(o, floor_table, &cam);
+}
+
+static void turn_map (object *o, int f)
+{
+	const float a = f*0.03f;
+	mode7_rotate(o, 512<<16, 512<<16, (int32_t)(cosf(a)*65536), (int32_t)(sinf(a)*65536), (1<<16) + f*300);
+}
+
+int main (int argc, char **argv)
+{
+	srand(7);
+	for (int i=0;i<(int)sizeof(tileset.data);i++)
+		tileset.data[i] = rand();
+	for (int i=0;i<MAP*MAP;i++)
+		map[i] = rand()%16 ? 1+rand()%(TILES-1) : 0; // some transparent tiles
+
+	int bad = 0;
+
+	// perspective floor : lower half of the screen
+	object floor;
+	mode7_init(&floor, &tileset.header, MAP, MAP, map, &floor_m);
+	floor.x = 0; floor.y = VGA_V_PIXELS/2; floor.h = VGA_V_PIXELS/2;
+	for (int f=0;f<FRAMES;f+=37) {
+		turn_floor(&floor, f);
+		show(&floor);
+		for (vga_line=floor.y; (int)vga_line<floor.y+floor.h; vga_line++)
+			bad += check_line(&floor, &floor_m.params[floor_m.front].table[vga_line-floor.y]);
+	}
+
+	// rotating map, moved partly off screen on both sides
+	object rot;
+	mode7_init(&rot, &tileset.header, MAP, MAP, map, &rot_m);
+	rot.y = 0;
+	for (int f=0;f<FRAMES;f+=41) {
+		turn_map(&rot, f);
+		show(&rot);
+		const struct Mode7Params *p = &rot_m.params[rot_m.front];
+		for (rot.x=-100; rot.x<=100; rot.x+=100)
+			for (vga_line=0; vga_line<rot.h; vga_line+=7) {
+				const struct Mode7Line l = {
+					p->start.u + (uint32_t)p->dudy*vga_line, p->start.v + (uint32_t)p->dvdy*vga_line,
+					p->start.du, p->start.dv
+				};
+				bad += check_line(&rot, &l);
+			}
+	}
+	printf("check : %d bad pixels\n", bad);
+
+	// timings
+	object tmap;
+	tilemap_init(&tmap, &tileset.header, MAP, MAP, map);
+	tmap.x = -5; tmap.y = 0; tmap.w = VGA_H_PIXELS+16; tmap.h = VGA_V_PIXELS/2;
+
+	rot.x = 0;
+	const double t_tmap = time_lines(&tmap, 0);
+	const double t_floor = time_lines(&floor, turn_floor);
+	const double t_rot = time_lines(&rot, turn_map);
+
+	printf("%-18s %8.1f ns/line %6.2f ns/pixel\n", "tilemap", t_tmap, t_tmap/VGA_H_PIXELS);
+	printf("%-18s %8.1f ns/line %6.2f ns/pixel  x%.1f tilemap\n", "mode7 floor", t_floor, t_floor/VGA_H_PIXELS, t_floor/t_tmap);
+	printf("%-18s %8.1f ns/line %6.2f ns/pixel  x%.1f tilemap\n", "mode7 rotation", t_rot, t_rot/VGA_H_PIXELS, t_rot/t_tmap);
+
+	// on device, assuming the same ratios to the tilemap line
+	const double c_tmap = argc>1 ? atof(argv[1]) : TMAP_TILE_CYCLES * ((VGA_H_PIXELS+15)/16 + 1);
+	const unsigned budget = DEVICE_SYSCLK/VGA_VFREQ;
+	printf("\ndevice at %lu MHz, line budget %u cycles%s, tilemap line %s\n", DEVICE_SYSCLK/1000000, budget,
+#ifdef VGA_SKIPLINE
+		" (a line is drawn over 2 half lines)",
+#else
+		"",
+#endif
+		argc>1 ? "measured" : "estimated");
+	printf("%-18s %8.0f cycles/line %5.1f%% budget\n", "tilemap", c_tmap, 100*c_tmap/budget);
+	printf("%-18s %8.0f cycles/line %5.1f%% budget\n", "mode7 floor", c_tmap*t_floor/t_tmap, 100*c_tmap*t_floor/t_tmap/budget);
+	printf("%-18s %8.0f cycles/line %5.1f%% budget\n", "mode7 rotation", c_tmap*t_rot/t_tmap, 100*c_tmap*t_rot/t_tmap/budget);
+
+	return bad != 0;
+}
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
 #include "blitter.h"
 
 #include <stdint.h>
@@ -19,6 +21,27 @@
 
 extern int line_time;
 
+// line timing : cycles on device, ns on emulator
+#ifdef EMULATOR
+#include <time.h>
+static inline uint32_t line_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+#ifdef VGA_VFREQ
+#define LINE_BUDGET (1000000000u/VGA_VFREQ) // as the emulated board
+#else
+#define LINE_BUDGET (1000000000u/VGA_FPS/VGA_V_BLANK) // kconf_emu : VGA_V_BLANK is the whole frame
+#endif
+#else
+#define line_clock() (DWT->CYCCNT)
+#define LINE_BUDGET (SYSCLK/VGA_VFREQ)
+#endif
+
+struct blitter_stats blitter_stats = {.budget=LINE_BUDGET};
+
 typedef struct {
     object *toactivate_head; // top of display list, sorted by Y. not yet active.
     object *active_head;     // top of the active list (currently active on this line), sorted by Z.
@@ -38,45 +61,127 @@ static void __attribute__((unused)) blitter_print_state(char *str)
     message("active: ");        for ( object *o=blt.active_head    ;o; o = o->next) message("%x - ", o); message("\n");
     message("inactive: ");      for ( object *o=blt.inactive_head  ;o; o = o->next) message("%x - ", o); message("\n");
 }
-// insert to blitter. not yet active
-void blitter_insert(struct object *o, int16_t x, int16_t y, int16_t z)
+
+// --- pending changes : objects are linked, unlinked and moved at vsync only, never during display.
+// Game code stores the changes in the object and links it once to the pending list, lock free :
+// graph_vsync can interrupt it on device. graph_vsync takes the whole list and applies them.
+// Repeated moves or frames of an object before vsync are merged, so game code never waits.
+
+enum {
+    PENDING_INSERT=1, PENDING_REMOVE=2, PENDING_MOVE=4, PENDING_FRAME=8, PENDING_RASTER=16, PENDING_MODE7=32,
+    PENDING_LINKED=128 // in the pending list
+};
+
+static object * volatile pending_head;
+static volatile int pending_count; // objects linked
+
+static void set_pending(object *o, uint8_t set, uint8_t clear)
 {
-    o->x=x; o->y=y; o->z=z;
+    uint8_t old;
+    do {
+        old = o->pending;
+    } while (!__sync_bool_compare_and_swap(&o->pending, old, (old & ~clear) | set | PENDING_LINKED));
+
+    if (!(old & PENDING_LINKED)) {
+        __sync_fetch_and_add(&pending_count, 1);
+        object *head;
+        do {
+            head = pending_head;
+            o->pending_next = head;
+        } while (!__sync_bool_compare_and_swap(&pending_head, head, o));
+    }
+}
 
-    // prepend since we don't care of order and it's faster
-    LL_PREPEND(blt.inactive_head, o);
+static void set_position(object *o, int16_t x, int16_t y, int16_t z)
+{
+    o->pending_xy = (uint16_t)x | (uint32_t)(uint16_t)y<<16; // x and y written at once
+    o->pending_z = z;
 }
 
-static void ensure_in(object *o, object *head, char *str) {
-    object *elt;
-    LL_FOREACH(head,elt) {
-        if (o==elt) {
-            message ("found & removed object %x\n",o);
-            return;
-        }
-    }
-    message ("ERROR : object %x NOT FOUND in %s\n",o,str);
-    blitter_print_state("not found in:");
-    bitbox_die(1,1);
+// insert to blitter, shown from next frame
+void blitter_insert(struct object *o, int16_t x, int16_t y, int16_t z)
+{
+    set_position(o, x, y, z);
+    set_pending(o, PENDING_INSERT | PENDING_MOVE, PENDING_REMOVE);
 }
 
 void blitter_remove(object *o)
 {
-    message("removing %x y=%d h=%d, vga_line=%d : ",o, o->y, o->h, vga_line);
-    // object should not be in its active zone
-    if ((int)vga_line<o->y) { // not yet reached
-        ensure_in(o,blt.toactivate_head,"toactivate");
-        LL_DELETE(blt.toactivate_head, o);
-    } else if ((int)vga_line>o->y+o->h) {
-        ensure_in(o,blt.inactive_head,"inactive");
-        LL_DELETE(blt.inactive_head, o);
-    } else if ((int)vga_line>=VGA_V_PIXELS) { // OK object was not removed but we're past screen display
-        ensure_in(o,blt.active_head,"active");
-        LL_DELETE(blt.active_head, o);
-    } else {
-        // we're in active zone, danger !
-        bitbox_die(4,3);
-        message ("ERROR : cannot remove active object from blitter yet !\n");
+    set_pending(o, PENDING_REMOVE, PENDING_INSERT);
+}
+
+void blitter_move(object *o, int16_t x, int16_t y, int16_t z)
+{
+    set_position(o, x, y, z);
+    set_pending(o, PENDING_MOVE, 0);
+}
+
+void blitter_set_frame(object *o, uint16_t fr)
+{
+    o->pending_fr = fr;
+    set_pending(o, PENDING_FRAME, 0);
+}
+
+void raster_swap(object *o)
+{
+    set_pending(o, PENDING_RASTER, 0);
+}
+
+void mode7_swap(object *o)
+{
+    set_pending(o, PENDING_MODE7, 0);
+}
+
+void raster_init(object *o, struct RasterTable *t, struct RasterLine *lines, int first, int nb_lines)
+{
+    memset(lines, 0, 2*nb_lines*sizeof(*lines));
+    t->first = first;
+    t->nb_lines = nb_lines;
+    t->front = 0;
+    t->lines[0] = lines;
+    t->lines[1] = lines+nb_lines;
+    o->d = (uintptr_t)t;
+}
+
+int blitter_pending(void)
+{
+    return pending_count;
+}
+
+static int in_list(object *head, object *o)
+{
+    for (;head;head=head->next)
+        if (head==o) return 1;
+    return 0;
+}
+
+// all objects are in toactivate list now
+static void apply_pending(void)
+{
+    object *next;
+    for (object *o = __atomic_exchange_n(&pending_head, 0, __ATOMIC_SEQ_CST); o; o=next) {
+        next = o->pending_next;
+        const uint8_t ops = __atomic_exchange_n(&o->pending, 0, __ATOMIC_SEQ_CST);
+        __sync_fetch_and_sub(&pending_count, 1);
+
+        if ((ops & PENDING_REMOVE) && in_list(blt.toactivate_head, o)) // removing twice does nothing
+            LL_DELETE(blt.toactivate_head, o);
+        if ((ops & PENDING_INSERT) && !in_list(blt.toactivate_head, o)) { // inserting twice just moves it
+            o->cost=0;
+            LL_PREPEND(blt.toactivate_head, o);
+        }
+        if (ops & PENDING_MOVE) {
+            const uint32_t xy = o->pending_xy;
+            o->x = (int16_t)(xy & 0xffff);
+            o->y = (int16_t)(xy >> 16);
+            o->z = o->pending_z;
+        }
+        if (ops & PENDING_FRAME)
+            o->fr = o->pending_fr;
+        if (ops & PENDING_RASTER)
+            ((struct RasterTable *)o->d)->front ^= 1;
+        if (ops & PENDING_MODE7)
+            ((struct Mode7 *)o->c)->front ^= 1;
     }
 }
 
@@ -97,6 +202,8 @@ void graph_vsync()
             blt.active_head   = 0;
             blt.inactive_head = 0;
 
+            apply_pending();
+
             // sort to_activate along Y (should be almost sorted)
             LL_SORT(blt.toactivate_head, cmp_y);
             break;
@@ -136,10 +243,30 @@ static inline void drop_old_objects ()
     }
 }
 
+// time of a line of an object, kept to estimate the next one
+static inline void object_line(object *o)
+{
+    const uint32_t start = line_clock();
+    o->line(o);
+    const uint32_t time = line_clock()-start;
+    o->cost = time < 0xffff ? time : 0xffff;
+}
+
+static inline void line_stats(uint32_t start)
+{
+    const uint32_t time = line_clock()-start;
+    blitter_stats.lines++;
+    if (time > blitter_stats.budget)
+        blitter_stats.over_budget++;
+    if (time > blitter_stats.max)
+        blitter_stats.max = time;
+}
+
 void graph_line()
 {
-    // persist between calls so that one line can continue blitting objects next semi-line. cut is done at z=128
+    // persist between calls so that one line can continue blitting objects next semi-line.
     static object *o;
+    const uint32_t start = line_clock();
 
     if (!vga_odd) { // only on even lines
 
@@ -154,54 +281,58 @@ void graph_line()
     drop_old_objects(); // also drops just added but too late
 
     // now trigger each element of activelist, in Z descending order
-    LL_FOREACH(blt.active_head,o) {
-        #ifdef VGA_SKIPLINE // multiline blit
-        if (o->z<128) break; // stop here, will finish on odd line
-        #endif
-        o->line(o);
+    #ifdef VGA_SKIPLINE
+    // multiline blit : split the objects of the line in two halves of the same cost, as
+    // measured on last line. The second half is blitted on odd line.
+    uint32_t total=0;
+    LL_FOREACH(blt.active_head,o)
+        total += o->cost;
+
+    uint32_t done=0;
+    for (o=blt.active_head; o; o=o->next) {
+        if (2*done + o->cost > total) break; // more than half of it on the other side
+        done += o->cost;
+        object_line(o);
     }
+    #else
+    LL_FOREACH(blt.active_head,o)
+        o->line(o);
+    #endif
 
     } else { // odd
         // continue with o
         for (;o;o=o->next)
-            o->line(o);
+            object_line(o);
     }
+
+    line_stats(start);
 }
 
 
-void fast_fill(uint16_t x1, uint16_t x2, uint16_t c)
+void fast_fill(int x1, int x2, pixel_t c)
 {
-    // ensures start is 32bit-aligned
-    if (x1 & 1)
-    {
-        draw_buffer[x1]=c;
-        x1++;
-    }
+    pixel_t * restrict dst = &draw_buffer[x1];
+    pixel_t * const end = &draw_buffer[x2];
 
-    // ensures end is written if unaligned
-    if (!(x2 & 1)) {
-        draw_buffer[x2]=c; // why this +1 ????
-        x2--;
-    }
+    // up to a 32bit-aligned start
+    while (dst<end && ((uintptr_t)dst & 3))
+        *dst++ = c;
 
     // 32 bit blit, manually unrolled
-    uint32_t * restrict dst32 = (uint32_t*)&draw_buffer[x1];
-    int i=(x2-x1)/2;
+    const uint32_t c32 = (uint32_t)c * (0xffffffffu / ((1u<<(8*sizeof(pixel_t)))-1)); // c repeated
+    uint32_t * restrict dst32 = (uint32_t*)dst;
+    uint32_t * const end32 = (uint32_t*)((uintptr_t)end & ~3);
 
-    for (;i>=8;i-=8)
-    {
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
-        *dst32++ = c<<16 | c;
+    for (;end32-dst32>=8;dst32+=8) {
+        dst32[0] = c32; dst32[1] = c32; dst32[2] = c32; dst32[3] = c32;
+        dst32[4] = c32; dst32[5] = c32; dst32[6] = c32; dst32[7] = c32;
     }
+    while (dst32<end32)
+        *dst32++ = c32;
 
-    for (;i>=0;i--)
-        *dst32++ = c<<16 | c;
+    // unaligned end
+    for (dst=(pixel_t*)dst32; dst<end; dst++)
+        *dst = c;
 } __attribute__((hot))
 
 
@@ -225,3 +356,29 @@ void rect_init(struct object *o,uint16_t w, uint16_t h, pixel_t  color)
     o->line=color_blit;
 }
 
+// --- blending
+
+const uint8_t *blend_luts[4];
+
+// a : color, b : row of the blend table for this color
+static void color_blend(object *o)
+{
+    const int16_t x1 = o->x<0?0:o->x;
+    const int16_t x2 = o->x+o->w>VGA_H_PIXELS ? VGA_H_PIXELS : o->x+o->w;
+    const uint8_t * restrict row = (const uint8_t *)o->b;
+
+    for (pixel_t *dst=&draw_buffer[x1]; dst<&draw_buffer[x2]; dst++)
+        *dst = row[*dst];
+}
+
+void rect_init_blend(struct object *o, uint16_t w, uint16_t h, pixel_t color, int mode)
+{
+    if (!blend_luts[mode&3]) {
+        message("Error : blend table %d not set\n", mode);
+        bitbox_die(8,9);
+    }
+    rect_init(o,w,h,color);
+    o->b = (uintptr_t)&blend_luts[mode&3][color<<8];
+    o->line=color_blend;
+}
+
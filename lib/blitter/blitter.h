@@ -16,8 +16,12 @@ new tilemaps (multi)
 #include <bitbox.h>
 
 /* Blitter : tilemap engine for bitbox.
-    don't modify an object or add, or remove objects during active video ! (ie if vga_line<VGA_H_PIXELS)
-
+    Objects are inserted, removed, moved and change frames at the next vsync : the functions below
+    keep these changes in the object, so game code can call them at any time during display.
+    Several moves or frame changes before vsync are merged, the last one is shown.
+    Call them from game code only, not from the line or frame callbacks of objects.
+    Writing x, y, h or data of an object directly during active video is not safe.
+    Objects are static or zeroed before their init function : the engine keeps state in them.
 */
 
 typedef struct object
@@ -32,18 +36,149 @@ typedef struct object
 
 	uintptr_t a,b,c,d; // various 32b used for each blitter as extra parameters or internally
 
-	// inline single linked lists (engine internal)
-	struct object *next;
+	// engine internal
+	uint16_t cost; // time of last line, to balance lines in skipline modes
+	struct object *next; // inline single linked lists
+
+	// changes applied at next vsync
+	volatile uint8_t pending;
+	int16_t pending_z;
+	uint16_t pending_fr;
+	volatile uint32_t pending_xy;
+	struct object *pending_next;
 } object;
 
 
 void blitter_insert(object *o, int16_t x, int16_t y, int16_t z); // insert to display list
-void blitter_remove(object *o);
+void blitter_remove(object *o); // object memory can be reused once applied, see blitter_pending
+void blitter_move(object *o, int16_t x, int16_t y, int16_t z);
+void blitter_set_frame(object *o, uint16_t fr);
+int  blitter_pending(void); // number of objects with changes not applied yet
+
+/* line drawing times, in cycles on device and ns on emulator. In skipline modes, objects of a
+   line are drawn over both half lines, split by their cost : each half line is one line here. */
+struct blitter_stats {
+	uint32_t lines;       // lines drawn
+	uint32_t over_budget; // lines longer than budget : missed
+	uint32_t max;         // longest line
+	uint32_t budget;      // time of a line
+};
+extern struct blitter_stats blitter_stats;
+
+// ---------------------------------------------------------------------------------------------------
+// --- Raster tables : per line parameters of tilemaps, surfaces and btc4 pictures (parallax, waves ...)
+
+/* A table gives for each screen line of [first, first+nb_lines) an x offset, a y offset and
+   optionally another tileset (tilemaps) or palette (16 couples for surfaces, 256 colors for btc4).
+   It is double buffered : game code writes all lines of raster_back() during display, then
+   raster_swap() shows them from next frame. Uses the d field of the object.
+*/
+struct RasterLine {
+	int16_t x;       // added to object x on this line
+	int16_t y;       // added to the object line read : tilemaps loop, other objects skip the line if out
+	const void *set; // tileset or palette of this line, 0 for the object's one
+};
+
+struct RasterTable {
+	uint16_t first, nb_lines;
+	volatile uint8_t front; // table shown, other one is written
+	struct RasterLine *lines[2];
+};
+
+// lines is 2*nb_lines entries, all set to 0 (no change)
+void raster_init (struct object *o, struct RasterTable *t, struct RasterLine *lines, int first, int nb_lines);
+void raster_swap (struct object *o); // applied at next vsync, call once per frame
+static inline struct RasterLine *raster_back (struct RasterTable *t) { return t->lines[!t->front]; }
+
+// parameters of the current line of an object, or 0 (in line functions)
+static inline const struct RasterLine *raster_line (const struct object *o)
+{
+	const struct RasterTable *t = (const struct RasterTable *)o->d;
+	const unsigned line = vga_line - (t ? t->first : 0);
+	return t && line < t->nb_lines ? &t->lines[t->front][line] : 0;
+}
 
 // ---------------------------------------------------------------------------------------------------
 // --- Rect
 
 void rect_init(struct object *o, uint16_t w, uint16_t h, pixel_t color);
+void fast_fill(int x1, int x2, pixel_t c); // fills draw_buffer [x1, x2) in line callbacks, 32 bits at a time
+
+// ---------------------------------------------------------------------------------------------------
+// --- Polygons : flat filled vector shapes, no framebuffer
+
+/* Shapes are closed polygons, convex or not (even-odd rule), drawn in order : later ones over.
+   Points are relative to the object, x and y >= 0 : object w and h follow the shapes.
+   At vsync, edges of all shapes are sorted by their top line into edges. Each line then
+   fills the spans between the edges it crosses, so a line costs its edges and spans.
+   Shapes can be changed during display, they are read at vsync.
+*/
+#ifndef POLYGON_MAX_ACTIVE
+#define POLYGON_MAX_ACTIVE 64 // edges crossing a line, more are not drawn
+#endif
+
+struct PolyShape {
+	const int16_t *points; // nb_points x,y pairs
+	uint8_t nb_points;
+	pixel_t color;
+};
+
+struct PolyEdge {
+	int32_t x, dx;  // 16.16 x on line y1, step per line
+	int16_t y1, y2; // covers lines [y1, y2)
+	uint16_t shape; // draw order
+};
+
+struct Polygons {
+	const struct PolyShape *shapes;
+	uint16_t nb_shapes;
+	uint16_t max_edges;       // room in edges : at least all points of all shapes
+	struct PolyEdge *edges;   // sorted by y1
+
+	// internal
+	uint16_t nb_edges, next;  // next edge to cross a line
+	uint16_t nb_active;
+	uint16_t active[POLYGON_MAX_ACTIVE]; // crossing the last line, by shape and x
+};
+
+void polygon_init (struct object *o, struct Polygons *p, const struct PolyShape *shapes, int nb_shapes, struct PolyEdge *edges, int max_edges);
+
+// ---------------------------------------------------------------------------------------------------
+// --- Blending
+
+/* Translucent rects and sprites : pixels drawn are blend_lut[src<<8 | dst] with 64k tables made
+   for the game palette by scripts/mk_blend.py, only for the modes used. Register them once,
+   objects then refer to them by mode :
+
+	#include "blend_luts.h" // mk_blend.py -p game.png -m mix,darken -o blend_luts.c
+	blend_luts[BLEND_MIX] = blend_lut_mix;
+	rect_init_blend(&shadow, 32, 8, RGB(64,64,64), BLEND_DARKEN);
+*/
+enum { BLEND_NONE, BLEND_MIX, BLEND_ADD, BLEND_DARKEN }; // 50% mix, additive, multiply
+extern const uint8_t *blend_luts[4];
+
+void rect_init_blend(struct object *o, uint16_t w, uint16_t h, pixel_t color, int mode);
+
+// same blends on 16 bit colors (xRRRRRGGGGGBBBBB, as vga_palette and btc4 palettes), bit 15 kept
+static inline uint16_t blend16_mix (uint16_t a, uint16_t b)
+{
+	return (((a^b) & 0x7bde) >> 1) + (a&b);
+}
+
+static inline uint16_t blend16_add (uint16_t a, uint16_t b)
+{
+	// green moved to the upper half word : each channel has room for its carry
+	const uint32_t m = 0x03e07c1f;
+	uint32_t s = ((a | a<<16) & m) + ((b | b<<16) & m);
+	const uint32_t over = s & 0x04008020; // carries
+	s = (s | (over - (over>>5))) & m;     // saturated
+	return s | s>>16 | ((a|b) & 0x8000);
+}
+
+static inline uint16_t blend16_darken (uint16_t a, uint16_t b)
+{
+	return ((a>>10 & 31)*(b>>10 & 31)/31) << 10 | ((a>>5 & 31)*(b>>5 & 31)/31) << 5 | (a & 31)*(b & 31)/31 | (a & b & 0x8000);
+}
 
 // ---------------------------------------------------------------------------------------------------
 // --- Sprites
@@ -62,8 +197,15 @@ void sprite3_load (struct object *o, const void *sprite_data);
 static inline uint8_t sprite3_nbframes(const object *o) { return ((uint8_t *)o->a)[6]; }
 
 
+void sprite3_set_zoom(object *o, int zoom); // integer zoom 1 to 4, sets w and h
 void sprite3_toggle2X(object *o); // toggle between standard and 2X mode
 void sprite3_set_solid(object *o, pixel_t color); // set solid color or 0 to reset
+
+// mirror frames when drawn, from next frame
+#define SPRITE3_HFLIP 4
+#define SPRITE3_VFLIP 8
+void sprite3_set_flip(object *o, int flip); // SPRITE3_HFLIP | SPRITE3_VFLIP or 0
+void sprite3_set_blend(object *o, int mode); // BLEND_xxx, table set, or BLEND_NONE
 inline void sprite3_setdata(object *o, uint8_t value) {
 	o->b = value;
 }
@@ -76,6 +218,28 @@ inline uint8_t sprite3_getdata(object *o) {
 
 void btc4_init    (struct object *o, const uint32_t *btc);
 void btc4_2x_init (struct object *o, const uint32_t *btc);
+void btc4_line    (struct object *o); // draws a btc4 picture : data is palette + blocks
+
+// btc4 videos (.btv made by btc4.py) : each frame stores a mask of the 4x4 blocks changed since
+// the previous frame, then the changed blocks. They are applied to a RAM copy of the picture
+// (palette + blocks), drawn as a btc4 image.
+struct BTC4Video {
+	uint32_t magic; // 'BTCV'
+	uint16_t w,h,nb_frames;
+	uint8_t fps, key; // key : full frame every key frames, 0 if only the first one
+	uint32_t align; // frames start at multiples of this in the file
+	uint16_t palette[256];
+	uint32_t frame_offset[]; // nb_frames+1 offsets from start of file, last is the end
+};
+
+#define BTC4_VIDEO_MAGIC 0x56435442 // 'BTCV'
+#define BTC4_VIDEO_BUFSZ(w,h) (256*2 + (w)*(h)/4) // RAM copy in bytes, u32 aligned
+
+// plays a video in memory at its frame rate and loops it. Returns 0 or -1 if not a video
+int btc4_video_init (struct object *o, const struct BTC4Video *video, uint32_t *buffer);
+
+// applies the changed blocks of a frame to the nb_blocks blocks of a picture
+void btc4_video_apply (uint32_t *blocks, int nb_blocks, const uint32_t *frame);
 
 // ---------------------------------------------------------------------------------------------------
 // --- tilemaps
@@ -107,6 +271,7 @@ struct TilesetFile {
 // initialize a tilemap from a tileset and some tilemap data. u8 indices for now.
 void tilemap_init (struct object *o, const struct TilesetFile *tileset, int map_w, int map_h, const void *tilemap );
 void tilemap_init_file (struct object *o, const struct TilesetFile *tileset, const struct TilemapFile *tilemap);
+void tilemap_set_zoom (struct object *o, int zoom); // integer zoom 1 to 4, scales w and h
 
 // pointer to data for layer N. data is u16 but the real data could be u8 !
 void *tmap_layer_ofs (const struct TilemapFile *tmap_file, const unsigned n);
@@ -117,6 +282,52 @@ const struct TilemapFileObject *tmap_objects(const struct TilemapFile *tmap_file
 // copy a file layer to object tilemap. will not change tileset
 void tmap_blit_file(object *tm, int x, int y, const struct TilemapFile *tf, const unsigned layer);
 
+// ---------------------------------------------------------------------------------------------------
+// --- Mode 7 : 8bpp tilemaps drawn through an affine transform (rotating maps, perspective floors)
+
+/* Each line samples the map from a start point with a step per screen pixel, all in 16.16 map
+   pixels. Start and step come from a matrix (start moves by a step per line) or from a table
+   of o->h lines, as made by mode7_perspective. The map loops : its width and height in tiles
+   are powers of two. Tile 0 is transparent.
+   Parameters are double buffered : game code sets mode7_back(), then mode7_swap() shows
+   them from next frame, as raster tables. Perspective tables are double buffered with them.
+   See bench_mode7.c for a host benchmark.
+*/
+struct Mode7Line {
+	int32_t u,v;   // map position of the first pixel of the line
+	int32_t du,dv; // step per screen pixel
+};
+
+struct Mode7Params {
+	struct Mode7Line start;        // line 0
+	int32_t dudy, dvdy;            // added to the start each line
+	const struct Mode7Line *table; // if not 0, o->h lines used instead
+};
+
+struct Mode7 {
+	struct Mode7Params params[2];
+	volatile uint8_t front; // flipped at vsync by mode7_swap
+};
+
+// a viewer above the floor, looking along (cos, sin). Line 0 of the object is just below the horizon
+struct Mode7Camera {
+	int32_t x,y;      // map position, 16.16
+	int32_t cos,sin;  // view direction, 16.16
+	int16_t height;   // above the floor in map pixels
+	int16_t focal;    // in screen pixels : w/2 for a 90 degrees view
+};
+
+// object is VGA_H_PIXELS x VGA_V_PIXELS, can be changed before the table is made
+void mode7_init (struct object *o, const struct TilesetFile *tileset, int map_w, int map_h, const void *tilemap, struct Mode7 *m);
+static inline struct Mode7Params *mode7_back (struct object *o) { struct Mode7 *m = (struct Mode7 *)o->c; return &m->params[!m->front]; }
+void mode7_swap (struct object *o); // applied at next vsync, call once per frame
+
+// back parameters : map point x,y (16.16) at the center of the object, turned by (cos, sin), scaled (16.16, 1<<16 for 1:1)
+void mode7_rotate (struct object *o, int32_t x, int32_t y, int32_t cos, int32_t sin, int32_t scale);
+// back parameters : perspective floor. lines is 2*o->h lines, always given the same : the half
+// of the back parameters is written while the other one is shown
+void mode7_perspective (struct object *o, struct Mode7Line *lines, const struct Mode7Camera *cam);
+
 // ---------------------------------------------------------------------------------------------------
 // --- surfaces : 2bpp fast-blit elements
 
@@ -128,6 +339,7 @@ void surface_init (struct object *o, int _w, int _h, void *_data); // width a mu
 void surface_clear (struct object *o);
 void surface_setpalette (struct object *o, const pixel_t *pal);
 void surface_fillrect (struct object *o, int x1, int y1, int x2, int y2, uint8_t color);
+void surface_set_zoom (struct object *o, int zoom); // integer zoom 1 to 4, scales w and h, clipped if zoomed
 
 // structure of font file (see mk_font)
 struct Font {
@@ -142,6 +354,29 @@ int surface_char (struct object *o, const char c, int x, int y, const void *font
 // draw a string, including \n, \t characters
 void surface_text (struct object *o, const char *text, int x, int y,const void *fontdata);
 
+// ---------------------------------------------------------------------------------------------------
+// --- Text : glyphs drawn from the font at each line, no surface buffer
+
+/* A text object keeps a pointer to its string : text buffers can be rewritten at any time.
+   Laid out as surface_text : \n, \t, spaces of 2 pixels, not wrapped but clipped to the
+   object width and screen. Characters 1 to TEXT_COLORS select the colors of the following
+   text, as "HP \x02" "42". Font color 0 is transparent.
+   Styles are shared by text objects : font and 2bpp to pixels expansions of each color set.
+*/
+#ifndef TEXT_COLORS
+#define TEXT_COLORS 4 // at most 8 : \t is 9
+#endif
+
+struct TextStyle {
+	const struct Font *font;
+	uint16_t couples[TEXT_COLORS][16]; // 2 pixels of 2bpp to couples, as surface palettes
+};
+
+// colors[i][1..3] are the colors of set i (colors[i][0] unused)
+void text_style_init (struct TextStyle *s, const struct Font *font, const pixel_t colors[][4], int nb_colors);
+void text_init (struct object *o, const struct TextStyle *style, const char *text, int w); // w 0 : widest line
+void text_set (struct object *o, const char *text); // shown from next frame, h follows the number of lines
+
 
 #ifdef __cplusplus
 } // extern C
@@ -1,4 +1,5 @@
 #include "blitter.h"
+#include <string.h> // memcpy
 
 // --- BTC4 (single and 2x magnification)
 // ---------------------------------------------------------------------------
@@ -14,20 +15,29 @@ void btc4_init(object *o, const uint32_t *btc)
     o->data = (uint32_t*)btc;
 
     o->line=btc4_line;
+    o->d=0; // no raster table, palettes of 256 colors
 }
 
 // switch16 version (fastest so far. could be made faster by coding to ASM (?) or blitting 4 lines at a time - full blocks, loading palette progressively ...)
 void btc4_line (object *o)
 {
     int line=vga_line-o->y;
-    uint16_t *palette = (uint16_t*)(o->data);
+    const uint16_t *palette = (uint16_t*)(o->data);
+    int x = o->x;
+    const struct RasterLine *raster = raster_line(o);
+    if (raster) {
+        x += raster->x;
+        line += raster->y;
+        if (line<0 || line>=o->h) return;
+        if (raster->set) palette = raster->set;
+    }
 
     // palette is 256 u16 so 128 u32 after start (no padding)
     // data advances width/4 words per block (and a block is line/4)
     uint32_t *src =  ((uint32_t*)(o->data)) + 128 + (o->w/4)*(line / 4);
     //uint32_t linemask = 3<<((line&3)*4); // test of bits starts with this mask, 16,20,24,28
 
-    int x = (o->x) & 0xfffffffe; // ensure word aligned ... case unaligned TBD
+    x &= 0xfffffffe; // ensure word aligned ... case unaligned TBD
     uint32_t *dst = (uint32_t*) (&draw_buffer[x]);
     int n=o->w/4;
 
@@ -74,19 +84,29 @@ void btc4_2x_init(object * o, const uint32_t *btc)
     o->data = (uint32_t*)btc;
 
     o->line=btc4_2x_line;
+    o->d=0;
 }
 
 // switch16 version (fastest so far. could be made faster by coding to ASM (?) or blitting 4 lines at a time - full blocks, loading palette progressively ...)
 void btc4_2x_line (object *o)
 {
-    int line=(vga_line-o->y)/2; // line into the buffer, zoomed 2x vertically
-    uint16_t *palette = (uint16_t*)(o->data);
+    int line=vga_line-o->y;
+    const uint16_t *palette = (uint16_t*)(o->data);
+    int x = o->x;
+    const struct RasterLine *raster = raster_line(o);
+    if (raster) {
+        x += raster->x;
+        line += raster->y;
+        if (line<0 || line>=o->h) return;
+        if (raster->set) palette = raster->set;
+    }
+    line /= 2; // line into the buffer, zoomed 2x vertically
 
     // palette is 256 u16 so 128 u32 after start (no padding)
     // data advances width/8 *words* per blockline (and a block is line/4)
     uint32_t *src =  ((uint32_t*)(o->data)) + 128 + (o->w/8)*(line / 4);
 
-    int x = (o->x) & 0xfffffffe; // ensure word aligned ... case unaligned TBD
+    x &= 0xfffffffe; // ensure word aligned ... case unaligned TBD
     uint32_t *dst = (uint32_t*) (&draw_buffer[x]);
     int n=o->w/8;
 
@@ -118,3 +138,50 @@ void btc4_2x_line (object *o)
         }
     }
 }
+
+// --- BTC4 videos : changed blocks of each frame applied to a RAM copy, drawn by btc4_line
+
+void btc4_video_apply (uint32_t *blocks, int nb_blocks, const uint32_t *frame)
+{
+    const uint32_t *mask = frame;
+    const uint32_t *src = frame + (nb_blocks+31)/32; // changed blocks follow the mask
+
+    for (int i=0;i<nb_blocks;i+=32)
+        for (uint32_t m=*mask++; m; m &= m-1) // each set bit
+            blocks[i+__builtin_ctz(m)] = *src++;
+}
+
+// called at vsync : applies frames due at the video frame rate
+static void btc4_video_frame (object *o, int line)
+{
+    const struct BTC4Video *v = (const struct BTC4Video *)o->a;
+    const uint32_t due = (vga_frame - o->b) * v->fps / VGA_FPS;
+    uint32_t *blocks = (uint32_t*)o->data + 128;
+
+    // frames only store changes : when late, catch up two frames per frame instead of dropping
+    for (int n=0; n<2 && o->c <= due; n++, o->c++) {
+        o->fr = o->c % v->nb_frames; // first frame is a full frame, so looping is seamless
+        btc4_video_apply(blocks, (o->w/4)*(o->h/4), (const uint32_t *)((const uint8_t *)v + v->frame_offset[o->fr]));
+    }
+}
+
+int btc4_video_init (struct object *o, const struct BTC4Video *video, uint32_t *buffer)
+{
+    if (video->magic != BTC4_VIDEO_MAGIC || !video->nb_frames) {
+        message("btc4: not a video\n");
+        return -1;
+    }
+    o->w = video->w;
+    o->h = video->h;
+    memcpy(buffer, video->palette, sizeof(video->palette)); // palette start + blocks, as btc4
+    o->data = buffer;
+    o->line = btc4_line;
+    o->frame = btc4_video_frame;
+
+    o->a = (uintptr_t)video;
+    o->b = vga_frame; // start of playback
+    o->c = 0;         // next frame to show, from start
+    o->d = 0;         // no raster table
+    btc4_video_frame(o, 0);
+    return 0;
+}
@@ -0,0 +1,287 @@
+// btc4 video streamed from the SD card, see blitter_btc_stream.h
+
+#include <string.h>
+
+#include "blitter_btc_stream.h"
+#include "lib/sampler/sampler.h"
+
+#define SECTOR 512
+#define HEADER_SIZE sizeof(struct BTC4Video) // header and palette, then frame offsets
+
+// frame due now at the video frame rate
+static inline uint32_t stream_due(const struct btc4_stream *s)
+{
+	return (vga_frame - s->start) * s->fps / VGA_FPS;
+}
+
+// reads at most n bytes, up to the sector where the budget ends. Returns bytes read, or -1
+static int read_budget(FIL *f, void *dest, uint32_t n, int *budget)
+{
+	const uint32_t start = f_tell(f);
+	const uint32_t end = (start/SECTOR + (*budget+SECTOR-1)/SECTOR) * SECTOR;
+	if (n > end-start)
+		n = end-start;
+
+	UINT br;
+	if (f_read(f, dest, n, &br) != FR_OK)
+		return -1;
+	*budget -= (start+br+SECTOR-1)/SECTOR*SECTOR - start/SECTOR*SECTOR;
+	return br;
+}
+
+// start and end of frame n, reading the offsets table around it if needed
+static int frame_extent(struct btc4_stream *s, int n, int *budget, uint32_t *start, uint32_t *end)
+{
+	if (n < s->offsets_first || n+1 > s->offsets_first+BTC4_STREAM_OFFSETS) {
+		uint32_t nb = s->nb_frames+1-n;
+		if (nb > BTC4_STREAM_OFFSETS+1)
+			nb = BTC4_STREAM_OFFSETS+1;
+
+		int table_budget = 2*SECTOR + nb*4; // always read whole
+		if (f_lseek(&s->file, HEADER_SIZE + n*4) != FR_OK || read_budget(&s->file, s->offsets, nb*4, &table_budget) != (int)nb*4)
+			return -1;
+		*budget -= 2*SECTOR + nb*4 - table_budget;
+		s->offsets_first = n;
+	}
+	*start = s->offsets[n - s->offsets_first];
+	*end = s->offsets[n+1 - s->offsets_first];
+	return 0;
+}
+
+// loads frames into free buffers. Returns -1 on error
+static int load_frames(struct btc4_stream *s, int *budget)
+{
+	while (*budget > 0 && s->next < s->nb_frames && s->loaded[s->load] < 0) {
+		// late by more than a key interval : go on from the last key frame due
+		if (!s->pos && s->key) {
+			const uint32_t due = stream_due(s);
+			if (due > (uint32_t)s->next + s->key) {
+				const int k = (due < s->nb_frames ? due : s->nb_frames-1u) / s->key * s->key;
+				if (k > s->next) {
+					s->dropped += k - s->next;
+					s->next = k;
+				}
+			}
+		}
+
+		uint32_t start, end;
+		if (frame_extent(s, s->next, budget, &start, &end))
+			return -1;
+		if (end < start) {
+			message("btc4: frame %d corrupted\n", s->next);
+			return -1;
+		}
+		if (*budget <= 0)
+			break;
+
+		// up to the next frame, but alignment padding can make it bigger than the biggest frame
+		uint32_t size = end-start;
+		const uint32_t framesz = BTC4_STREAM_FRAMESZ(s->o->w, s->o->h);
+		if (size > framesz)
+			size = framesz;
+
+		if (f_tell(&s->file) != start+s->pos && f_lseek(&s->file, start+s->pos) != FR_OK)
+			return -1;
+		const int n = read_budget(&s->file, (uint8_t*)s->frames[s->load] + s->pos, size-s->pos, budget);
+		if (n <= 0)
+			return -1;
+
+		s->pos += n;
+		if (s->pos == size) {
+			s->loaded[s->load] = s->next++;
+			s->load ^= 1;
+			s->pos = 0;
+		}
+	}
+	return 0;
+}
+
+// refills the sound ring buffer behind the voice. Returns -1 on error
+static int load_audio(struct btc4_stream *s, int *budget)
+{
+	const uint32_t bpf = s->wav.channels * s->wav.bits/8; // bytes per sample frame
+	const uint32_t total = s->wav.frames * bpf;
+
+	if (s->voice >= 0) {
+		// update must be called before the voice goes around the whole buffer
+		const int ring = s->audio_size / bpf;
+		const int p = sample_position(s->voice);
+		s->played += (p - s->last_position + ring) % ring * bpf;
+		s->last_position = p;
+		if (s->played >= total) {
+			stop_sample(s->voice);
+			s->voice = -1;
+			f_close(&s->audio_file);
+			return 0;
+		}
+	}
+
+	while (*budget > 0 && s->written - s->played < s->audio_size) {
+		const uint32_t at = s->written % s->audio_size;
+		uint32_t n = s->audio_size - (s->written - s->played);
+		if (n > s->audio_size - at)
+			n = s->audio_size - at;
+
+		if (s->written >= total) { // played until the voice is stopped
+			memset(s->audio+at, s->wav.bits == 8 ? 0x80 : 0, n);
+			s->written += n;
+			continue;
+		}
+
+		if (n > total - s->written)
+			n = total - s->written;
+		const int r = read_budget(&s->audio_file, s->audio+at, n, budget);
+		if (r <= 0)
+			return -1;
+		s->written += r;
+	}
+	return 0;
+}
+
+static int open_audio(struct btc4_stream *s, const char *path)
+{
+	struct riff r;
+	if (riff_open_file(&r, path) < 0 || wav_open(&s->wav, &r) < 0)
+		return -1;
+
+	FRESULT res = f_open(&s->audio_file, path, FA_READ | FA_OPEN_EXISTING);
+	if (res == FR_OK)
+		res = f_lseek(&s->audio_file, s->wav.data_offset);
+	if (res != FR_OK) {
+		message("btc4: error %d opening %s\n", res, path);
+		return -1;
+	}
+
+	const uint32_t bpf = s->wav.channels * s->wav.bits/8;
+	s->audio_size = BTC4_STREAM_AUDIO / bpf * bpf;
+	int budget = BTC4_STREAM_AUDIO + SECTOR;
+	if (load_audio(s, &budget))
+		return -1;
+
+	// loops over the ring buffer, refilled as it plays
+	s->voice = play_sample_format(s->audio, s->audio_size/bpf, s->wav.sample_format, wav_speed(&s->wav), 0, 255, 255);
+	if (s->voice < 0)
+		message("btc4: no free voice for %s\n", path);
+	return 0;
+}
+
+// shows the next frame at vsync if it is due and loaded
+static void btc4_stream_vsync (object *o, int line)
+{
+	struct btc4_stream *s = (struct btc4_stream *)o->a;
+	if (o->fr+1 >= s->nb_frames || stream_due(s) <= o->fr)
+		return;
+
+	const int32_t f = s->loaded[s->show];
+	if (f < 0) {
+		s->late++;
+		return;
+	}
+	btc4_video_apply((uint32_t*)o->data + 128, s->nb_blocks, s->frames[s->show]);
+	o->fr = f;
+	s->shown++;
+	s->loaded[s->show] = -1;
+	s->show ^= 1;
+}
+
+int btc4_stream_open (struct btc4_stream *s, struct object *o, const char *path, const char *wav_path, uint32_t *buffer, uint32_t bufsize)
+{
+	memset(s, 0, sizeof(*s));
+	s->o = o;
+	s->voice = -1;
+
+	FRESULT res = f_open(&s->file, path, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK) {
+		message("btc4: error %d opening %s\n", res, path);
+		return -1;
+	}
+	// map clusters once : reading the offsets table seeks back
+	s->file.cltbl = s->linkmap;
+	s->linkmap[0] = BTC4_STREAM_LINKMAP;
+	if (f_lseek(&s->file, CREATE_LINKMAP) != FR_OK)
+		s->file.cltbl = 0;
+
+	struct BTC4Video header;
+	UINT br;
+	res = f_read(&s->file, &header, sizeof(header), &br);
+	if (res != FR_OK || br != sizeof(header) || header.magic != BTC4_VIDEO_MAGIC || !header.nb_frames) {
+		message("btc4: %s is not a video\n", path);
+		goto fail;
+	}
+	if (bufsize < (uint32_t)BTC4_STREAM_BUFSZ(header.w, header.h)) {
+		message("btc4: buffer too small for %dx%d video\n", header.w, header.h);
+		goto fail;
+	}
+
+	s->nb_frames = header.nb_frames;
+	s->nb_blocks = header.w/4 * (header.h/4);
+	s->fps = header.fps;
+	s->key = header.key;
+	s->offsets_first = -BTC4_STREAM_OFFSETS-1; // none read
+
+	memcpy(buffer, header.palette, sizeof(header.palette)); // palette start + blocks, as btc4
+	s->frames[0] = buffer + BTC4_VIDEO_BUFSZ(header.w, header.h)/4;
+	s->frames[1] = s->frames[0] + BTC4_STREAM_FRAMESZ(header.w, header.h)/4;
+	s->loaded[0] = s->loaded[1] = -1;
+
+	o->w = header.w;
+	o->h = header.h;
+	o->data = buffer;
+	o->line = btc4_line;
+	o->frame = btc4_stream_vsync;
+	o->a = (uintptr_t)s;
+	o->d = 0; // no raster table
+
+	// first frame now, shown at once (not late : it is due from now)
+	s->start = vga_frame;
+	int budget = 2*SECTOR + BTC4_STREAM_FRAMESZ(header.w, header.h) + 4*(BTC4_STREAM_OFFSETS+1);
+	if (load_frames(s, &budget) || s->loaded[0] < 0) {
+		message("btc4: error reading %s\n", path);
+		goto fail;
+	}
+	btc4_video_apply(buffer + 128, s->nb_blocks, s->frames[0]);
+	s->loaded[0] = -1;
+	s->show = 1;
+	s->shown = 1;
+	o->fr = 0;
+
+	if (wav_path && open_audio(s, wav_path))
+		goto fail;
+	s->start = vga_frame;
+	return 0;
+
+fail:
+	btc4_stream_close(s);
+	return -1;
+}
+
+int btc4_stream_update (struct btc4_stream *s, int max_sectors)
+{
+	int budget = max_sectors*SECTOR;
+
+	// sound first : a gap is heard, a late frame is hardly seen
+	if (s->audio_file.fs && load_audio(s, &budget)) {
+		message("btc4: error reading sound, stopped\n");
+		if (s->voice >= 0)
+			stop_sample(s->voice);
+		s->voice = -1;
+		f_close(&s->audio_file);
+	}
+
+	if (load_frames(s, &budget)) {
+		message("btc4: error reading frame %d, video ends there\n", s->next);
+		s->nb_frames = s->next;
+	}
+	return s->o->fr+1 < s->nb_frames || s->voice >= 0;
+}
+
+void btc4_stream_close (struct btc4_stream *s)
+{
+	if (s->voice >= 0)
+		stop_sample(s->voice);
+	s->voice = -1;
+	if (s->file.fs)
+		f_close(&s->file);
+	if (s->audio_file.fs)
+		f_close(&s->audio_file);
+}
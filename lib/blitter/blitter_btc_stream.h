@@ -0,0 +1,88 @@
+/* btc4 video streamed from the SD card
+
+   Plays a .btv video (btc4.py) from a file, with an optional WAV sound track played by the
+   sampler. Frames are read into two frame buffers : while one waits to be shown, the other
+   is loaded a few sectors per frame by btc4_stream_update, called from game_frame (not from
+   graph_vsync : SD transfers cannot complete in the VGA interrupt). At vsync, the next frame
+   is applied to the picture when due at the video frame rate.
+
+   A frame not loaded in time is shown late (counted in late). If the video has key frames
+   (btc4.py --key) and loading falls behind by more than a key interval, frames are dropped up
+   to the next key frame (counted in dropped). Sound is read first, it starts with the video.
+
+   Needs USE_SDCARD (fatfs mounted), lib/sampler and lib/resources/tinyriff.c for sound.
+
+   Example :
+
+	static struct btc4_stream movie;
+	static uint32_t movie_buf[BTC4_STREAM_BUFSZ(320,240)/4];
+	static object movie_obj;
+
+	btc4_stream_open(&movie, &movie_obj, "intro.btv", "intro.wav", movie_buf, sizeof(movie_buf));
+	blitter_insert(&movie_obj, 0, 0, 0);
+	...
+	void game_frame() {
+		if (!btc4_stream_update(&movie, 16)) // 16 sectors : 8kB per frame, 480kB/s
+			end_of_intro();
+	}
+ */
+#pragma once
+#include <stdint.h>
+
+#include "blitter.h"
+#include "fatfs/ff.h"
+#include "lib/resources/tinyriff.h"
+
+#ifndef BTC4_STREAM_AUDIO
+#define BTC4_STREAM_AUDIO 8192  // sound ring buffer in bytes, 256ms of 8 bit mono
+#endif
+
+#define BTC4_STREAM_OFFSETS 128 // frame offsets read at a time
+#define BTC4_STREAM_LINKMAP 32  // fatfs cluster link map, in DWORDs
+
+// biggest frame : block mask and all blocks
+#define BTC4_STREAM_FRAMESZ(w,h) (((w)/4*((h)/4)+31)/32*4 + (w)/4*((h)/4)*4)
+// buffer for a video of this size : picture, then two frames
+#define BTC4_STREAM_BUFSZ(w,h) (BTC4_VIDEO_BUFSZ(w,h) + 2*BTC4_STREAM_FRAMESZ(w,h))
+
+struct btc4_stream {
+	struct object *o;
+	FIL file;
+	DWORD linkmap[BTC4_STREAM_LINKMAP];
+	uint16_t nb_frames, nb_blocks;
+	uint8_t fps, key;
+	uint32_t start;              // vga_frame of first frame
+
+	uint32_t *frames[2];         // frame buffers
+	volatile int32_t loaded[2];  // frame in each buffer, -1 if free. Set by update, freed at vsync
+	int load, show;              // buffer being loaded, next buffer shown
+	int next;                    // frame being loaded
+	uint32_t pos;                // bytes of it already read
+
+	uint32_t offsets[BTC4_STREAM_OFFSETS+1]; // frame offsets, from frame offsets_first
+	int offsets_first;
+
+	// sound track
+	FIL audio_file;
+	struct wav wav;
+	int voice;                   // -1 if none
+	uint32_t audio_size;         // ring buffer, whole sample frames
+	uint32_t written, played;    // bytes since start
+	int last_position;
+	uint8_t audio[BTC4_STREAM_AUDIO];
+
+	// stats
+	volatile uint32_t shown, late;
+	uint32_t dropped;
+};
+
+/* opens a video and its sound track (wav_path can be 0) and starts playing it : the object
+   is ready to be inserted. buffer is BTC4_STREAM_BUFSZ(w,h) bytes, 32 bit aligned.
+   Returns 0, or -1 if the files cannot be read or the buffer is too small. */
+int btc4_stream_open (struct btc4_stream *s, struct object *o, const char *path, const char *wav_path, uint32_t *buffer, uint32_t bufsize);
+
+// loads frames and sound, reading at most about max_sectors sectors. Returns 0 once the last frame is shown and the sound played.
+int btc4_stream_update (struct btc4_stream *s, int max_sectors);
+
+// stops playing and closes files. Remove the object from the blitter first, and wait until blitter_pending() is 0 to reuse it
+void btc4_stream_close (struct btc4_stream *s);
@@ -0,0 +1,148 @@
+
+// --- Mode 7 : affine transformed 8bpp tilemaps
+// --------------------------------------------------------------------------------------
+
+/*
+    RAM data :
+
+        *data : tilemap, u8 indices
+        a : tileset, offset to start at index 1 (as tilemaps)
+        b : log2 of map width in tiles | log2 of map height << 8 | log2 of tile size << 16
+        c : struct Mode7 *, parameters
+        d : unused
+
+    Start and step of a line are in 16.16 map pixels. Pixels are sampled on the map looped
+    as a power of two size, so start and steps can wrap around.
+ */
+#include "blitter.h"
+
+#define min(a,b) (a<b?a:b)
+
+static inline int log2_exact(int n)
+{
+    int l=0;
+    while ((1<<l) < n) l++;
+    return (1<<l)==n ? l : -1;
+}
+
+__attribute__((always_inline)) static inline void mode7_line(object *o, const int tbits)
+{
+    const struct Mode7 *m = (const struct Mode7 *)o->c;
+    const struct Mode7Params *p = &m->params[m->front];
+    const int y = vga_line-o->y;
+
+    // unsigned : wraps around the map
+    uint32_t u, v;
+    int32_t du, dv;
+    if (p->table) {
+        const struct Mode7Line *l = &p->table[y];
+        u=l->u; v=l->v; du=l->du; dv=l->dv;
+    } else {
+        u = p->start.u + (uint32_t)p->dudy*y;
+        v = p->start.v + (uint32_t)p->dvdy*y;
+        du = p->start.du; dv = p->start.dv;
+    }
+
+    int x1 = o->x;
+    const int x2 = min(o->x+o->w, VGA_H_PIXELS);
+    if (x1<0) { // skip pixels left of the screen
+        u -= (uint32_t)du*x1;
+        v -= (uint32_t)dv*x1;
+        x1 = 0;
+    }
+
+    const unsigned wbits = o->b & 0xff;
+    const unsigned hbits = o->b>>8 & 0xff;
+    const uint32_t umask = (1u<<(wbits+tbits))-1; // map pixels
+    const uint32_t vmask = (1u<<(hbits+tbits))-1;
+    const unsigned tmask = (1u<<tbits)-1;
+    const uint8_t *map = (const uint8_t *)o->data;
+    const uint8_t *tiles = (const uint8_t *)o->a;
+
+    for (pixel_t * restrict dst=&draw_buffer[x1]; dst<&draw_buffer[x2]; dst++) {
+        const unsigned pu = u>>16 & umask;
+        const unsigned pv = v>>16 & vmask;
+        const unsigned t = map[(pv>>tbits)<<wbits | pu>>tbits];
+        if (t)
+            *dst = tiles[t<<2*tbits | (pv&tmask)<<tbits | (pu&tmask)];
+        u += du;
+        v += dv;
+    }
+}
+
+// specialize by tile size
+void mode7_line8  (object *o) { mode7_line(o, 3); }
+void mode7_line16 (object *o) { mode7_line(o, 4); }
+
+void mode7_init (struct object *o, const struct TilesetFile *tileset, int map_w, int map_h, const void *tilemap, struct Mode7 *m)
+{
+    if (tileset->nbtiles > 256) {
+        message("only 8bit tilemap indices handled for now\n");
+        bitbox_die(4,5);
+    }
+    if (tileset->datacode != 1) {
+        message("only 8bit tilesets can be blit on 8bpp displays\n");
+        bitbox_die(4,7);
+    }
+    const int wbits = log2_exact(map_w), hbits = log2_exact(map_h);
+    if (wbits<0 || hbits<0 || (tileset->tilesize!=8 && tileset->tilesize!=16)) {
+        message("mode7 maps are a power of two tiles of 8 or 16 pixels, not %dx%d of %d\n", map_w, map_h, tileset->tilesize);
+        bitbox_die(4,8);
+    }
+    const int tbits = tileset->tilesize==8 ? 3 : 4;
+
+    o->data = (uint32_t *)tilemap;
+    o->a = ((uintptr_t)(tileset->data))-tileset->tilesize*tileset->tilesize; // to start at index 1
+    o->b = wbits | hbits<<8 | tbits<<16;
+    o->c = (uintptr_t)m;
+    o->d = 0;
+
+    o->w = VGA_H_PIXELS;
+    o->h = VGA_V_PIXELS;
+    o->fr = 0;
+
+    // 1:1, not turned
+    m->front = 0;
+    for (int i=0;i<2;i++)
+        m->params[i] = (struct Mode7Params) {.start = {.du=1<<16}, .dvdy=1<<16};
+
+    o->frame = 0; // parameters are swapped by the blitter at vsync
+    o->line = tbits==3 ? mode7_line8 : mode7_line16;
+}
+
+void mode7_rotate (struct object *o, int32_t x, int32_t y, int32_t cos, int32_t sin, int32_t scale)
+{
+    struct Mode7Params *p = mode7_back(o);
+    const int32_t c = (int64_t)cos*scale>>16;
+    const int32_t s = (int64_t)sin*scale>>16;
+
+    // screen x along (cos, sin), screen y along (-sin, cos)
+    p->start.du = c;
+    p->start.dv = s;
+    p->dudy = -s;
+    p->dvdy = c;
+    p->start.u = (int32_t)(x - (int64_t)c*(o->w/2) + (int64_t)s*(o->h/2)); // 64 bit, wraps around the map
+    p->start.v = (int32_t)(y - (int64_t)s*(o->w/2) - (int64_t)c*(o->h/2));
+    p->table = 0;
+}
+
+void mode7_perspective (struct object *o, struct Mode7Line *lines, const struct Mode7Camera *cam)
+{
+    const struct Mode7 *m = (const struct Mode7 *)o->c;
+    struct Mode7Line *table = &lines[m->front ? 0 : o->h]; // back half : front one may be shown
+    for (int i=0;i<o->h;i++) {
+        // map pixels per screen pixel, at the distance seen on this line
+        const int32_t s = ((int64_t)cam->height<<16)/(i+1);
+        const int64_t dist = (int64_t)s*cam->focal;
+
+        // right of the view is (-sin, cos)
+        const int32_t du = (int64_t)-cam->sin*s>>16;
+        const int32_t dv = (int64_t)cam->cos*s>>16;
+        // 64 bit : steps grow with the height, far lines wrap around the map
+        table[i].u = (int32_t)(cam->x + (cam->cos*dist>>16) - (int64_t)du*(o->w/2));
+        table[i].v = (int32_t)(cam->y + (cam->sin*dist>>16) - (int64_t)dv*(o->w/2));
+        table[i].du = du;
+        table[i].dv = dv;
+    }
+    mode7_back(o)->table = table;
+}
@@ -0,0 +1,126 @@
+
+// --- Polygons : flat filled shapes drawn by spans
+// --------------------------------------------------------------------------------------
+
+/*
+    RAM data :
+
+        a : struct Polygons *
+        b,c,d, data : unused
+
+    An edge from a to b (a above b) covers lines [a.y, b.y) : shared vertices are crossed once,
+    horizontal edges never. On a line, pixels from ceil(x) of an edge are filled up to ceil(x)
+    of the next edge of the same shape.
+ */
+#include "blitter.h"
+
+// builds the edge table, sorted by top line
+static void polygon_frame (object *o, int first_line)
+{
+    struct Polygons *p = (struct Polygons *)o->a;
+    int n=0, w=0, h=0;
+
+    for (int s=0;s<p->nb_shapes;s++) {
+        const struct PolyShape *shape = &p->shapes[s];
+        for (int i=0;i<shape->nb_points;i++) {
+            const int16_t *a = &shape->points[2*i];
+            const int16_t *b = &shape->points[i+1<shape->nb_points ? 2*i+2 : 0];
+            if (a[0]>w) w=a[0];
+            if (a[1]>h) h=a[1];
+
+            if (a[1]==b[1] || n==p->max_edges)
+                continue;
+            if (a[1]>b[1]) {
+                const int16_t *t=a; a=b; b=t;
+            }
+
+            const struct PolyEdge e = {
+                .x = a[0]<<16,
+                .dx = (b[0]-a[0])*65536 / (b[1]-a[1]),
+                .y1 = a[1], .y2 = b[1],
+                .shape = s,
+            };
+            int j=n++;
+            for (;j>0 && p->edges[j-1].y1 > e.y1;j--)
+                p->edges[j] = p->edges[j-1];
+            p->edges[j] = e;
+        }
+    }
+
+    o->w = w;
+    o->h = h;
+    p->nb_edges = n;
+    p->next = 0;
+    p->nb_active = 0;
+}
+
+static void polygon_line (object *o)
+{
+    struct Polygons *p = (struct Polygons *)o->a;
+    const int y = vga_line-o->y;
+
+    // edges starting here (or before, if the first lines were not drawn)
+    while (p->next < p->nb_edges && p->edges[p->next].y1 <= y) {
+        if (p->nb_active < POLYGON_MAX_ACTIVE)
+            p->active[p->nb_active++] = p->next;
+        p->next++;
+    }
+
+    // drop ended edges, sort others by shape then x : almost sorted from last line
+    uint32_t key[POLYGON_MAX_ACTIVE];
+    int n=0;
+    for (int i=0;i<p->nb_active;i++) {
+        const uint16_t id = p->active[i];
+        const struct PolyEdge *e = &p->edges[id];
+        if (e->y2 <= y)
+            continue;
+
+        const int x = (e->x + e->dx*(y-e->y1) + 0xffff) >> 16; // ceil
+        const uint32_t k = e->shape<<16 | (uint16_t)(x+0x8000);
+        int j=n++;
+        for (;j>0 && key[j-1]>k;j--) {
+            key[j] = key[j-1];
+            p->active[j] = p->active[j-1];
+        }
+        key[j] = k;
+        p->active[j] = id;
+    }
+    p->nb_active = n;
+
+    // spans between pairs of edges of a shape
+    for (int i=0;i+1<n;i+=2) {
+        if (key[i]>>16 != key[i+1]>>16) { // odd crossings (edges not drawn) : skip one
+            i--;
+            continue;
+        }
+        int x1 = o->x + (int)(key[i]   & 0xffff) - 0x8000;
+        int x2 = o->x + (int)(key[i+1] & 0xffff) - 0x8000;
+        if (x1<0) x1=0;
+        if (x2>VGA_H_PIXELS) x2=VGA_H_PIXELS;
+        if (x1<x2)
+            fast_fill(x1, x2, p->shapes[key[i]>>16].color);
+    }
+}
+
+void polygon_init (struct object *o, struct Polygons *p, const struct PolyShape *shapes, int nb_shapes, struct PolyEdge *edges, int max_edges)
+{
+    int nb_points=0;
+    for (int s=0;s<nb_shapes;s++)
+        nb_points += shapes[s].nb_points;
+    if (nb_points > max_edges) {
+        message("polygons : %d points, room for %d edges\n", nb_points, max_edges);
+        bitbox_die(4,9);
+    }
+
+    p->shapes = shapes;
+    p->nb_shapes = nb_shapes;
+    p->edges = edges;
+    p->max_edges = max_edges;
+
+    o->a = (uintptr_t)p;
+    o->data = 0;
+    o->fr = 0;
+    o->frame = polygon_frame;
+    o->line = polygon_line;
+    polygon_frame(o, 0); // sizes
+}
@@ -6,8 +6,11 @@
  b : palette if couple palette
  c : unused, can be used as custom user property !
  d : if hi u16 not zero, replace with this color. (solid flashes). Feature disbled if BLITTER_NO_SOLID_SPRITES defined
-     if d&1 render with size = 2x (modify w/h as needed!)
      if d&2 make it invisible
+     if d&4 (SPRITE3_HFLIP) mirror left-right : same blits, drawn from the right
+     if d&8 (SPRITE3_VFLIP) mirror top-bottom : lines read from the bottom
+     d>>4 & 3 : zoom-1, integer zoom 1X to 4X (w/h are zoomed sizes, set by sprite3_set_zoom)
+     d>>6 & 3 : blend mode (BLEND_xxx), drawn through blend_luts[mode] if not BLEND_NONE
 
  */
 
@@ -22,9 +25,28 @@ void sprite3_line_noclip         (struct object *o);
 void sprite3_line_clip           (struct object *o);
 void sprite3_cpl_line_clip       (struct object *o);
 void sprite3_cpl_line_noclip     (struct object *o);
-void sprite3_cpl_line_noclip_2X  (struct object *o);
 void sprite3_cpl_line_solid      (struct object *o);
 void sprite3_cpl_line_solid_clip (struct object *o);
+void sprite3_line_hflip          (struct object *o);
+void sprite3_line_hflip_clip     (struct object *o);
+void sprite3_cpl_line_hflip      (struct object *o);
+void sprite3_cpl_line_hflip_clip (struct object *o);
+void sprite3_cpl_line_hflip_solid(struct object *o);
+void sprite3_cpl_line_hflip_solid_clip(struct object *o);
+void sprite3_line_zoom2          (struct object *o);
+void sprite3_line_zoom3          (struct object *o);
+void sprite3_line_zoom4          (struct object *o);
+void sprite3_cpl_line_zoom2      (struct object *o);
+void sprite3_cpl_line_zoom3      (struct object *o);
+void sprite3_cpl_line_zoom4      (struct object *o);
+void sprite3_line_blend1         (struct object *o);
+void sprite3_line_blend2         (struct object *o);
+void sprite3_line_blend3         (struct object *o);
+void sprite3_line_blend4         (struct object *o);
+void sprite3_cpl_line_blend1     (struct object *o);
+void sprite3_cpl_line_blend2     (struct object *o);
+void sprite3_cpl_line_blend3     (struct object *o);
+void sprite3_cpl_line_blend4     (struct object *o);
 void skip_line                   (struct object *o);
 
 #define DATACODE_u16 0
@@ -39,6 +61,7 @@ void skip_line                   (struct object *o);
 #define MARGIN 64
 
 typedef uint16_t couple_t;
+#define PIXEL_BITS (8*sizeof(pixel_t))
 
 void sprite3_load(struct object *o, const void *data)
 {
@@ -85,22 +108,53 @@ static inline int sprite3_is_solid(struct object *o) {
 }
 #endif 
 
-static inline int sprite3_is2X(struct object *o) {
-    return o->d & 1;
+void sprite3_set_flip(object *o, int flip)
+{
+    o->d = (o->d & ~(SPRITE3_HFLIP|SPRITE3_VFLIP)) | (flip & (SPRITE3_HFLIP|SPRITE3_VFLIP));
+}
+
+static inline int sprite3_is_hflip(struct object *o) {
+    return o->d & SPRITE3_HFLIP;
+}
+
+// index of a line of the object (from the top of the displayed frame) in the sprite
+static inline unsigned sprite3_src_line(const struct object *o, const struct SpriteFileHeader *h, int line)
+{
+    if (o->d & SPRITE3_VFLIP)
+        line = h->height-1-line;
+    return (int)o->fr*h->height + line;
+}
+
+static inline int sprite3_zoom(const struct object *o) {
+    return (o->d>>4 & 3) + 1;
 }
+
+void sprite3_set_zoom(object *o, int zoom)
+{
+    const struct SpriteFileHeader *h = (const struct SpriteFileHeader *)o->a;
+    if (zoom<1) zoom=1;
+    if (zoom>4) zoom=4;
+    o->w = h->width*zoom;
+    o->h = h->height*zoom;
+    o->d = (o->d & ~0x30) | (zoom-1)<<4;
+}
+
 void sprite3_toggle2X(object *o)
 {
-    if (sprite3_is2X(o)) { 
-        o->w /= 2;
-        o->h /= 2;
-        o->d &= ~1;
-    } else {
-        if (o->b) {// for now only with cpls
-            o->w *= 2;
-            o->h *= 2;
-            o->d |= 1;
-        }
+    sprite3_set_zoom(o, sprite3_zoom(o)==1 ? 2 : 1);
+}
+
+static inline int sprite3_blend(const struct object *o) {
+    return o->d>>6 & 3;
+}
+
+void sprite3_set_blend(object *o, int mode)
+{
+    if (mode && !blend_luts[mode&3]) {
+        message("Error : blend table %d not set\n", mode);
+        bitbox_die(8,9);
     }
+    o->d = (o->d & ~0xc0) | (mode&3)<<6;
 }
 
 // read length from src, pointing at a blit header.
@@ -129,11 +183,27 @@ static inline int object_offscreen_x(struct object *o) {
     return o->x + (int)o->w < 0 || o->x > VGA_H_PIXELS;
 }
 
+static void (* const zoom_lines[2][3])(struct object *o) = {
+    {sprite3_line_zoom2,     sprite3_line_zoom3,     sprite3_line_zoom4},
+    {sprite3_cpl_line_zoom2, sprite3_cpl_line_zoom3, sprite3_cpl_line_zoom4},
+};
+
+static void (* const blend_lines[2][4])(struct object *o) = {
+    {sprite3_line_blend1,     sprite3_line_blend2,     sprite3_line_blend3,     sprite3_line_blend4},
+    {sprite3_cpl_line_blend1, sprite3_cpl_line_blend2, sprite3_cpl_line_blend3, sprite3_cpl_line_blend4},
+};
+
 void sprite3_frame_raw(struct object *o, int start_line)
 {
     // select if clip or noclip (choice made each frame)
     if (object_offscreen_x(o)|| o->d & 2 ) { // non visible X : skip rendering this frame 
         o->line = skip_line;
+    } else if (sprite3_blend(o)) { // zooms, clips, flips
+        o->line = blend_lines[0][sprite3_zoom(o)-1];
+    } else if (sprite3_zoom(o)>1) { // clips, flips
+        o->line = zoom_lines[0][sprite3_zoom(o)-2];
+    } else if (sprite3_is_hflip(o)) {
+        o->line = object_clipped(o) ? sprite3_line_hflip_clip : sprite3_line_hflip;
     } else {
         o->line = object_clipped(o) ? sprite3_line_clip : sprite3_line_noclip;
     }
@@ -145,15 +215,21 @@ void sprite3_frame_cpl(struct object *o, int start_line)
     // select if clip or noclip (choice made each frame)
     if (o->x + (int)o->w < 0 || o->x > VGA_H_PIXELS || o->d & 2 ) { // non visible X : skip rendering this frame 
         o->line = skip_line;
-    } else if (sprite3_is2X(o)) {  // 2X rendering - only for couples for now
-        o->line = sprite3_cpl_line_noclip_2X; // fixme clipping
+    } else if (sprite3_blend(o)) { // zooms, clips, flips, solid
+        o->line = blend_lines[1][sprite3_zoom(o)-1];
+    } else if (sprite3_zoom(o)>1) { // clips, flips, solid
+        o->line = zoom_lines[1][sprite3_zoom(o)-2];
     }     
 #ifndef BLITTER_NO_SOLID_SPRITES
-    else if (sprite3_is_solid(o) ) {
+    else if (sprite3_is_solid(o) && sprite3_is_hflip(o)) {
+        o->line =  object_clipped(o) ? sprite3_cpl_line_hflip_solid_clip : sprite3_cpl_line_hflip_solid;
+    } else if (sprite3_is_solid(o) ) {
         o->line =  object_clipped(o) ? sprite3_cpl_line_solid_clip : sprite3_cpl_line_solid;
     } 
 #endif
-    else {
+    else if (sprite3_is_hflip(o)) {
+        o->line = object_clipped(o) ? sprite3_cpl_line_hflip_clip : sprite3_cpl_line_hflip;
+    } else {
         o->line = object_clipped(o) ? sprite3_cpl_line_clip : sprite3_cpl_line_noclip;
     }
 }
@@ -163,7 +239,7 @@ void skip_line(struct object *o) {}
 void sprite3_line_noclip (struct object *o)
 {
     struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
-    const uint16_t line = (int)o->fr*h->height+vga_line-o->y;
+    const uint16_t line = sprite3_src_line(o, h, vga_line-o->y);
     uint8_t * restrict src = (uint8_t*) o->data + h->data[line];
     pixel_t * restrict dst = &draw_buffer[o->x];
 
@@ -203,7 +279,7 @@ void sprite3_line_noclip (struct object *o)
 void sprite3_line_clip (struct object *o)
 {
     struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
-    const uint16_t line = (int)o->fr*h->height+vga_line-o->y;
+    const uint16_t line = sprite3_src_line(o, h, vga_line-o->y);
     uint8_t * restrict src = (uint8_t*) o->data + h->data[line];
     pixel_t * restrict dst = (pixel_t *)&draw_buffer[o->x];
 
@@ -251,13 +327,13 @@ static inline __attribute__((always_inline)) void sprite3_cpl_line (object *o, b
 {
     // Skip to line
     struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
-    const unsigned int line = (int)o->fr*h->height+vga_line-o->y;
+    const unsigned int line = sprite3_src_line(o, h, vga_line-o->y);
     uint8_t * restrict src=(uint8_t*) o->data + h->data[line];
     pixel_t * restrict dst=draw_buffer+o->x; // u16 for vga8
     couple_t * restrict couple_palette = (couple_t *)o->b;
 
     uint8_t header;
-    couple_t solidcolor = (o->d>>16) * 0x10001;//only if 16bpp !
+    const couple_t solidcolor = (couple_t)((o->d>>16) * (1 | 1<<PIXEL_BITS));
 
     // clip left : skip runs fixme finish partial run ?
     if (clip) {
@@ -304,7 +380,7 @@ static inline __attribute__((always_inline)) void sprite3_cpl_line (object *o, b
                 if (nb%2) {
                     const couple_t last = solid ? solidcolor : couple_palette[*src];
                     src++;
-                    *dst++ = last >> 16;
+                    *dst++ = (pixel_t)last; // first pixel of the couple, in low bits
                 }
                 break;
 
@@ -314,7 +390,7 @@ static inline __attribute__((always_inline)) void sprite3_cpl_line (object *o, b
                     dst +=2;
                 }
                 if (nb%2) {
-                    *dst++ = solid ? solidcolor : couple_palette[*src] >> 16;
+                    *dst++ = (pixel_t)(solid ? solidcolor : couple_palette[*src]);
                 }
                 src+=1;
                 break;
@@ -345,80 +421,212 @@ void sprite3_cpl_line_solid  (object *o) { sprite3_cpl_line(o,false, true); }
 void sprite3_cpl_line_solid_clip (object *o) { sprite3_cpl_line(o,false, true); }
 #endif 
 
-static inline void blit2Xcpl(pixel_t *dst, couple_t color)
+// --- horizontally flipped : same blits, drawn right to left from the last pixel of the object.
+// dst points at the next pixel to draw, run pixel i goes to dst[-i].
+
+// couple with its two pixels swapped
+static inline couple_t flip_couple(couple_t c)
 {
-    *(couple_t*)dst = (color&0xff)*0x101;
-    *(couple_t*)(dst+2) = (color >>8)*0x101;
+    return (couple_t)(c >> PIXEL_BITS | c << PIXEL_BITS);
 }
-static inline void blit2Xsingle(pixel_t *dst, couple_t color)
+
+static inline bool in_line(const pixel_t *p)
 {
-    *(couple_t*)dst = (color&0xff)*0x101;
+    return p >= draw_buffer-MARGIN && p < draw_buffer+VGA_H_PIXELS+MARGIN;
 }
 
-// This one has doubled size
-void sprite3_cpl_line_noclip_2X (object *o) {
-
-    // Skip to line
+static inline __attribute__((always_inline)) void sprite3_line_hflip_any (object *o, bool clip)
+{
     struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
-    const uint16_t line = o->fr*h->height+(vga_line-o->y)/2;
-    uint8_t *  restrict src=(uint8_t*) o->data + h->data[line];
-
-    pixel_t *  restrict dst=draw_buffer+o->x; // u16 for vga8
-    couple_t * restrict couple_palette = (couple_t *)o->b;
+    const uint16_t line = sprite3_src_line(o, h, vga_line-o->y);
+    uint8_t * restrict src = (uint8_t*) o->data + h->data[line];
+    pixel_t * restrict dst = &draw_buffer[o->x+o->w-1];
 
     uint8_t header;
+
     do {
-        header=*src;
+        header = *src;
+
+        const int nb = read_len(&src);
+        const pixel_t *pixels;
 
-        int nb = read_len(&src);
-        couple_t c;
         switch (header >> 6) {
-            case BLIT_SKIP :
-                dst += nb*2;
-                break;
             case BLIT_COPY:
-                for (int i=0;i<nb/2;i++) {
-                    c=couple_palette[*src++];
-                    blit2Xcpl(dst,c);
-                    dst += 4; // couple
-                }
-                if (nb%2) {
-                    blit2Xsingle(dst,couple_palette[*src++]);
-                    dst += 2;
+            case BLIT_BACK:
+                if (header>>6 == BLIT_COPY) {
+                    pixels = (pixel_t*)src;
+                    src += nb*sizeof(pixel_t);
+                } else {
+                    pixels = (pixel_t*)(src - *(uint16_t*)src); // back reference as u16
+                    src += 2;
                 }
+                for (int i=0;i<nb;i++)
+                    if (!clip || in_line(dst-i))
+                        dst[-i] = pixels[i];
                 break;
-
             case BLIT_FILL :
-                c=couple_palette[*src++];
-                for (int i=0;i<nb/2;i++) {
-                    blit2Xcpl(dst,c);
-                    dst += 4; // couple
-                }
-
-                if (nb%2) {
-                    blit2Xsingle(dst,c);
-                    dst+=2;
-                }
+                for (int i=0;i<nb;i++)
+                    if (!clip || in_line(dst-i))
+                        dst[-i] = *(pixel_t*)src;
+                src+=sizeof(pixel_t);
                 break;
+        }
+        dst -= nb;
+    } while (!eol(header) && (!clip || dst >= draw_buffer-MARGIN));
+}
 
+void sprite3_line_hflip      (object *o) { sprite3_line_hflip_any(o, false); }
+void sprite3_line_hflip_clip (object *o) { sprite3_line_hflip_any(o, true); }
+
+// nb pixels of couples from idx (step 0 : same couple repeated), right to left from dst
+static inline __attribute__((always_inline)) void cpl_run_hflip(pixel_t *dst, const uint8_t *idx, int step, int nb,
+        const couple_t *couple_palette, bool clip, bool solid, couple_t solidcolor)
+{
+    for (int i=0;i<nb/2;i++, idx+=step) {
+        const couple_t c = solid ? solidcolor : couple_palette[*idx];
+        if (!clip) {
+            *(couple_t*)(dst-1) = flip_couple(c);
+        } else {
+            if (in_line(dst))   dst[0]  = c;
+            if (in_line(dst-1)) dst[-1] = c >> PIXEL_BITS;
+        }
+        dst -= 2;
+    }
+    if (nb%2 && (!clip || in_line(dst)))
+        *dst = solid ? solidcolor : couple_palette[*idx]; // first pixel of the couple
+}
+
+static inline __attribute__((always_inline)) void sprite3_cpl_line_hflip_any (object *o, bool clip, bool solid)
+{
+    struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
+    const unsigned int line = sprite3_src_line(o, h, vga_line-o->y);
+    uint8_t * restrict src=(uint8_t*) o->data + h->data[line];
+    pixel_t * restrict dst=draw_buffer+o->x+o->w-1;
+    const couple_t * restrict couple_palette = (couple_t *)o->b;
+    const couple_t solidcolor = (couple_t)((o->d>>16) * (1 | 1<<PIXEL_BITS));
+
+    uint8_t header;
+
+    do {
+        header=*src;
+        const int nb = read_len(&src);
+
+        switch (header >> 6) {
+            case BLIT_COPY:
+                cpl_run_hflip(dst, src, 1, nb, couple_palette, clip, solid, solidcolor);
+                src += (nb+1)/2;
+                break;
+            case BLIT_FILL :
+                cpl_run_hflip(dst, src, 0, nb, couple_palette, clip, solid, solidcolor);
+                src += 1;
+                break;
             case BLIT_BACK :
-                {
-                    const uint16_t delta = *(uint16_t*)(src);
-                    src+=2;
+                cpl_run_hflip(dst, src - *(uint16_t*)src, 1, nb, couple_palette, clip, solid, solidcolor);
+                src += 2;
+                break;
+        }
+        dst -= nb;
+    } while (!eol(header) && (!clip || dst >= draw_buffer-MARGIN));
+}
 
-                    for (int i=0;i<nb/2;i++) {
-                        couple_t c = couple_palette[(src-delta)[i]];
-                        blit2Xcpl(dst,c);
-                        dst+=4;
-                    }
-                    if (nb%2) {
-                        couple_t c = couple_palette[(src-delta)[nb/2]];
-                        blit2Xsingle(dst,c);
-                        dst+=2;
-                    }
-                }
+void sprite3_cpl_line_hflip      (object *o) { sprite3_cpl_line_hflip_any(o, false, false); }
+void sprite3_cpl_line_hflip_clip (object *o) { sprite3_cpl_line_hflip_any(o, true,  false); }
+
+#ifndef BLITTER_NO_SOLID_SPRITES
+void sprite3_cpl_line_hflip_solid      (object *o) { sprite3_cpl_line_hflip_any(o, false, true); }
+void sprite3_cpl_line_hflip_solid_clip (object *o) { sprite3_cpl_line_hflip_any(o, true,  true); }
+#endif
+
+// --- zoomed and blended : each pixel drawn zoom times, in both directions (flip) and clipped if needed.
+// dst points at the next pixel to draw, dir is -1 if flipped. If blended, pixels are lut[src<<8 | dst]
+
+static inline __attribute__((always_inline)) void put_zoom(pixel_t *dst, pixel_t p, int zoom, int dir, bool clip, const uint8_t *lut)
+{
+    for (int k=0;k<zoom;k++) // unrolled : zoom is a constant
+        if (!clip || in_line(dst+k*dir))
+            dst[k*dir] = lut ? lut[p<<8 | dst[k*dir]] : p;
+}
+
+static inline __attribute__((always_inline)) void sprite3_line_zoom (object *o, const int zoom, const bool cpl, const bool blend)
+{
+    struct SpriteFileHeader *h = (struct SpriteFileHeader*)o->a;
+    const unsigned int line = sprite3_src_line(o, h, (vga_line-o->y)/zoom);
+    uint8_t * restrict src=(uint8_t*) o->data + h->data[line];
+
+    const int dir = sprite3_is_hflip(o) ? -1 : 1;
+    pixel_t * restrict dst = draw_buffer + (dir>0 ? o->x : o->x+o->w-1);
+    const bool clip = object_clipped(o);
+    const int step = zoom*dir;
+
+    const couple_t * restrict couple_palette = (couple_t *)o->b;
+#ifndef BLITTER_NO_SOLID_SPRITES
+    const bool solid = cpl && sprite3_is_solid(o);
+#else
+    const bool solid = false;
+#endif
+    const pixel_t solidcolor = o->d>>16;
+    const uint8_t *lut = blend ? blend_luts[sprite3_blend(o)] : 0;
+
+    uint8_t header;
+
+    do {
+        header=*src;
+        const int nb = read_len(&src);
+        const uint8_t *pixels; // run source, advances if copy or back reference
+        int advance;
+
+        switch (header >> 6) {
+            case BLIT_SKIP :
+                dst += nb*step;
+                continue;
+            case BLIT_COPY:
+                pixels = src;
+                advance = 1;
+                src += cpl ? (nb+1)/2 : nb*(int)sizeof(pixel_t);
+                break;
+            case BLIT_FILL :
+                pixels = src;
+                advance = 0;
+                src += cpl ? 1 : sizeof(pixel_t);
                 break;
+            default : // BLIT_BACK, u16 back reference
+                pixels = src - *(uint16_t*)src;
+                advance = 1;
+                src += 2;
+                break;
+        }
 
+        if (cpl) {
+            for (int i=0;i<nb;i+=2, pixels+=advance) {
+                const couple_t c = couple_palette[*pixels];
+                put_zoom(dst, solid ? solidcolor : c, zoom, dir, clip, lut);
+                dst += step;
+                if (i+1<nb) { // second pixel, except for the last couple of an odd run
+                    put_zoom(dst, solid ? solidcolor : c >> PIXEL_BITS, zoom, dir, clip, lut);
+                    dst += step;
+                }
+            }
+        } else {
+            for (int i=0;i<nb;i++, pixels+=advance*sizeof(pixel_t)) {
+                put_zoom(dst, *(pixel_t*)pixels, zoom, dir, clip, lut);
+                dst += step;
+            }
         }
-    } while (!eol(header));
+    } while (!eol(header) && (!clip || (dir>0 ? dst < draw_buffer+VGA_H_PIXELS+MARGIN : dst >= draw_buffer-MARGIN)));
 }
+
+void sprite3_line_zoom2     (object *o) { sprite3_line_zoom(o, 2, false, false); }
+void sprite3_line_zoom3     (object *o) { sprite3_line_zoom(o, 3, false, false); }
+void sprite3_line_zoom4     (object *o) { sprite3_line_zoom(o, 4, false, false); }
+void sprite3_cpl_line_zoom2 (object *o) { sprite3_line_zoom(o, 2, true,  false); }
+void sprite3_cpl_line_zoom3 (object *o) { sprite3_line_zoom(o, 3, true,  false); }
+void sprite3_cpl_line_zoom4 (object *o) { sprite3_line_zoom(o, 4, true,  false); }
+
+void sprite3_line_blend1     (object *o) { sprite3_line_zoom(o, 1, false, true); }
+void sprite3_line_blend2     (object *o) { sprite3_line_zoom(o, 2, false, true); }
+void sprite3_line_blend3     (object *o) { sprite3_line_zoom(o, 3, false, true); }
+void sprite3_line_blend4     (object *o) { sprite3_line_zoom(o, 4, false, true); }
+void sprite3_cpl_line_blend1 (object *o) { sprite3_line_zoom(o, 1, true,  true); }
+void sprite3_cpl_line_blend2 (object *o) { sprite3_line_zoom(o, 2, true,  true); }
+void sprite3_cpl_line_blend3 (object *o) { sprite3_line_zoom(o, 3, true,  true); }
+void sprite3_cpl_line_blend4 (object *o) { sprite3_line_zoom(o, 4, true,  true); }
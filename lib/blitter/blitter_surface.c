@@ -3,19 +3,34 @@ width must be a multiple of 16 !
 
  layout :
  	data : 4x4 interleaved couples palette (aa,ab,ac,ad,ba,...) , then 2bpp pixels
- 	a,b,c,d : unused for now : zoom h,v ?
+ 	a,b : unused for now
+ 	c : zoom, 0 or 1 to 4 : w,h are zoomed sizes, drawing functions use buffer sizes.
+ 	d : raster table or 0 (see raster_init), sets are palettes of 16 couples
  */
 
+#include <stdbool.h>
 #include "blitter.h"
 
 typedef uint16_t couple_t;
+#define PIXEL_BITS (8*sizeof(pixel_t))
+
 static void surface_line (struct object *o);
+static void surface_line_zoom2 (struct object *o);
+static void surface_line_zoom3 (struct object *o);
+static void surface_line_zoom4 (struct object *o);
+
+static inline int surface_zoom(const struct object *o) { return o->c ? o->c : 1; }
+// buffer sizes
+static inline int surface_w(const struct object *o) { return o->w/surface_zoom(o); }
+static inline int surface_h(const struct object *o) { return o->h/surface_zoom(o); }
 
 void surface_init (struct object *o, int _w, int _h, void *_data)
 {
 	o->w=_w; o->h=_h; o->data = _data;
 	o->line = surface_line;
 	o->frame=0;
+	o->c=1;
+	o->d=0;
 
 	surface_clear(o);
 }
@@ -29,15 +44,43 @@ void surface_setpalette (struct object *o, const pixel_t *pal)
 		}
 }
 
+void surface_set_zoom (struct object *o, int zoom)
+{
+	static void (* const lines[])(struct object *o) = {surface_line, surface_line_zoom2, surface_line_zoom3, surface_line_zoom4};
+	if (zoom<1) zoom=1;
+	if (zoom>4) zoom=4;
+
+	o->w = surface_w(o)*zoom;
+	o->h = surface_h(o)*zoom;
+	o->c = zoom;
+	o->line = lines[zoom-1];
+}
+
+// applies the raster table line if any. returns 0 if nothing to draw
+static inline int surface_raster(struct object *o, int *x, int *line, const couple_t **palette)
+{
+	const struct RasterLine *raster = raster_line(o);
+	if (raster) {
+		*x += raster->x;
+		*line += raster->y;
+		if (*line<0 || *line>=o->h) return 0;
+		if (raster->set) *palette = raster->set;
+	}
+	return 1;
+}
+
 // no H zoom, not clipped yet
 static void surface_line (struct object *o)
 {
-	couple_t *palette = (couple_t *) o->data;
+	const couple_t *palette = (couple_t *) o->data;
+	int x = o->x, line = vga_line-o->y;
+	if (!surface_raster(o, &x, &line, &palette))
+		return;
 
 	// would use restrict if C
-	uint8_t  * src = (uint8_t*) o->data + 16*sizeof(couple_t) + ((vga_line-o->y)*o->w) / 4;
-	couple_t * start = (couple_t*) draw_buffer + o->x/2 ;
-	couple_t * end   = (couple_t*) draw_buffer + (o->x+o->w)/2;
+	uint8_t  * src = (uint8_t*) o->data + 16*sizeof(couple_t) + (line*o->w) / 4;
+	couple_t * start = (couple_t*) draw_buffer + x/2 ;
+	couple_t * end   = (couple_t*) draw_buffer + (x+o->w)/2;
 
 	uint8_t oldsrc = *src+1; // not src so first time they WILL updated.
 
@@ -56,15 +99,45 @@ static void surface_line (struct object *o)
 	}
 }
 
+// each pixel drawn zoom x zoom, clipped to the screen
+static inline __attribute__((always_inline)) void surface_line_zoom (struct object *o, const int zoom)
+{
+	const couple_t *palette = (couple_t *) o->data;
+	int x = o->x, line = vga_line-o->y;
+	if (!surface_raster(o, &x, &line, &palette))
+		return;
+
+	const int w = o->w/zoom; // buffer width
+	const uint8_t *src = (uint8_t*) o->data + 16*sizeof(couple_t) + (line/zoom)*w/4;
+	const bool clip = x<0 || x+o->w > VGA_H_PIXELS;
+
+	int i = clip && x<0 ? -x/(4*zoom) : 0; // first byte seen
+	pixel_t *dst = draw_buffer + x + i*4*zoom;
+	for (;i<w/4;i++) {
+		const couple_t c[2] = {palette[src[i] & 0xf], palette[src[i] >> 4]};
+		for (int j=0;j<4;j++) {
+			const pixel_t p = j&1 ? c[j/2] >> PIXEL_BITS : c[j/2];
+			for (int k=0;k<zoom;k++,dst++) // unrolled
+				if (!clip || (dst>=draw_buffer && dst<draw_buffer+VGA_H_PIXELS))
+					*dst = p;
+		}
+	}
+}
+
+static void surface_line_zoom2 (struct object *o) { surface_line_zoom(o,2); }
+static void surface_line_zoom3 (struct object *o) { surface_line_zoom(o,3); }
+static void surface_line_zoom4 (struct object *o) { surface_line_zoom(o,4); }
+
 // color between 0 and 3, also fills x2,y2
 void surface_fillrect (struct object *o, int x1, int y1, int x2, int y2, uint8_t color)
 {
-	if (x1<0 || y1<0 || x1>=x2 || y1>=y2 || x2>=o->w || y2>=o->h) {
-		message("wrong arguments : %d,%d %d,%d on surface fill %d,%d\n",x1,y1,x2,y2,o->w,o->h);
+	const int w = surface_w(o);
+	if (x1<0 || y1<0 || x1>=x2 || y1>=y2 || x2>=w || y2>=surface_h(o)) {
+		message("wrong arguments : %d,%d %d,%d on surface fill %d,%d\n",x1,y1,x2,y2,w,surface_h(o));
 		bitbox_die(7,7);
 	}
 	const uint32_t wc = (color & 3)*0x55555555; // repeat 16 times -> no line not multiple of 16 !
-	uint32_t *p = (uint32_t *)o->data + 4*sizeof(couple_t) + o->w/16*y1; // start of line, in words
+	uint32_t *p = (uint32_t *)o->data + 4*sizeof(couple_t) + w/16*y1; // start of line, in words
 
 	for (int y=y1; y<=y2;y++) {
 
@@ -79,12 +152,12 @@ void surface_fillrect (struct object *o, int x1, int y1, int x2, int y2, uint8_t
 		const int nbits2 = (x2%16) * 2;
 		p[x2/16] = (p[x2/16] & (0xffffffffUL << nbits2)) | (wc >> (32-nbits2));
 
-		p += o->w/16; // next line
+		p += w/16; // next line
 	}
 }
 
 void surface_clear(struct object *o) { 
-	surface_fillrect(o,0,0,o->w-1,o->h-1,0);
+	surface_fillrect(o,0,0,surface_w(o)-1,surface_h(o)-1,0);
 }
 
 int surface_char (struct object *o, const char c, int x, int y, const void *fontdata)
@@ -97,7 +170,7 @@ int surface_char (struct object *o, const char c, int x, int y, const void *font
 		const uint32_t *cp = (uint32_t *)&font->data[(ch*font->height + j)*font->bytes_per_line]; // source word address
 		uint32_t src_pixels = *cp; //read them
 		src_pixels &= 0xffffffff >> (8*(4-font->bytes_per_line)); // mask source : only read bpl pixels
-		uint32_t *dst = (uint32_t *)&p[(o->w/4)*(y+j)+x/4]; // existing word, byte aligned
+		uint32_t *dst = (uint32_t *)&p[(surface_w(o)/4)*(y+j)+x/4]; // existing word, byte aligned
 		uint32_t pw = *dst; // read existing pixels. at most 32bits so 16pixels wide
 		//pw &= 0xffffffff << (cw*2); // mask it - or not if transparent render ?
 		pw |= src_pixels << ((x%4)*2); // read 32 bits, shift them left (ie pixels to right) to the right place
@@ -113,7 +186,7 @@ void surface_text (struct object *o, const char *text, int x, int y,const void *
 	const struct Font* font = fontdata;
 	int cx = x; // current X
 	for (const char *c=text ; *c ; c++) {
-		if (y+font->height > o->h)
+		if (y+font->height > surface_h(o))
 			break;
 
 		if (*c =='\n') {
@@ -124,7 +197,7 @@ void surface_text (struct object *o, const char *text, int x, int y,const void *
 		} else if (*c==' ') {
 			cx += 2;
 		} else {
-			if (cx>o->w-4) {
+			if (cx>surface_w(o)-4) {
 				y+=font->height+1;
 				cx=x;
 			}
@@ -0,0 +1,161 @@
+/* text blitter object : glyphs of a Font (mk_font.py) drawn from a string at each line.
+
+ layout :
+	data : string shown
+	a : struct TextStyle *
+	b : string set by text_set, shown from next frame, or 0
+	c : text line being drawn | color set << 16
+	d : start of this line in the string
+
+ Lines are drawn in order : the text line and colors are kept from one line to the next,
+ and reset at vsync.
+ */
+
+#include "blitter.h"
+
+typedef uint16_t couple_t;
+#define PIXEL_BITS (8*sizeof(pixel_t))
+
+#define min(a,b) (a<b?a:b)
+
+static inline int is_color(uint8_t c) { return c>=1 && c<=TEXT_COLORS; }
+static inline int is_glyph(uint8_t c) { return c>=' ' && c<' '+128; } // in the font
+
+// width of the widest line, number of lines
+static void text_size (const struct Font *font, const char *text, int *w, int *lines)
+{
+	int x=0;
+	*w=0;
+	*lines=1;
+	for (const char *c=text; *c; c++) {
+		const uint8_t ch = *c;
+		if (ch=='\n') {
+			*lines += 1;
+			x=0;
+		} else if (ch=='\t') {
+			x = (x+32)/32*32;
+		} else if (ch==' ') {
+			x += 2;
+		} else if (is_glyph(ch)) {
+			x += font->char_width[ch-' ']+1;
+		}
+		if (x>*w) *w=x;
+	}
+}
+
+static void text_frame (struct object *o, int first_line)
+{
+	if (o->b) {
+		const struct TextStyle *s = (const struct TextStyle *)o->a;
+		int w, lines;
+		o->data = (void *)o->b;
+		o->b = 0;
+		text_size(s->font, o->data, &w, &lines);
+		o->h = lines*(s->font->height+1)-1;
+	}
+	o->c = 0;
+	o->d = (uintptr_t)o->data;
+}
+
+static void text_line (struct object *o)
+{
+	const struct TextStyle *s = (const struct TextStyle *)o->a;
+	const struct Font *font = s->font;
+	const int line = vga_line-o->y;
+	const int text_line = line/(font->height+1);
+	const int row = line%(font->height+1);
+
+	// go to the text line, keeping colors of lines before
+	const char *c = (const char *)o->d;
+	uint32_t state = o->c;
+	for (; (int)(state & 0xffff) < text_line && *c; c++) {
+		if (*c=='\n')
+			state++;
+		else if (is_color(*c))
+			state = (state & 0xffff) | (*c-1)<<16;
+	}
+	o->c = state;
+	o->d = (uintptr_t)c;
+	if ((int)(state & 0xffff) < text_line || row==font->height) // after the text, space between lines
+		return;
+
+	const couple_t *couples = s->couples[state>>16];
+	const int left  = o->x<0 ? 0 : o->x;
+	const int right = min(o->x+o->w, VGA_H_PIXELS);
+
+	for (int x=o->x; *c && *c!='\n' && x<right; c++) {
+		const uint8_t ch = *c;
+		if (is_color(ch)) {
+			couples = s->couples[ch-1];
+			continue;
+		} else if (ch=='\t') {
+			x = o->x + (x-o->x+32)/32*32;
+			continue;
+		} else if (ch==' ') {
+			x += 2;
+			continue;
+		} else if (!is_glyph(ch)) {
+			continue;
+		}
+
+		const int g = ch-' ';
+		const int cw = font->char_width[g];
+		if (x+cw > left) {
+			const uint8_t *src = &font->data[(g*font->height + row)*font->bytes_per_line];
+			uint32_t bits = 0;
+			for (int i=0;i<font->bytes_per_line;i++)
+				bits |= src[i] << 8*i;
+
+			pixel_t *dst = &draw_buffer[x];
+			if (x>=left && x+cw<=right) { // whole glyph, 2 pixels at a time
+				for (;bits;bits>>=4, dst+=2) {
+					const unsigned n = bits & 0xf;
+					if (!n) continue;
+					const couple_t cp = couples[n];
+					if (n&3)  dst[0] = cp;
+					if (n>>2) dst[1] = cp >> PIXEL_BITS;
+				}
+			} else { // clipped
+				for (int i=0;i<cw;i++, bits>>=2)
+					if ((bits & 3) && x+i>=left && x+i<right)
+						dst[i] = couples[bits & 3];
+			}
+		}
+		x += cw+1;
+	}
+}
+
+void text_style_init (struct TextStyle *s, const struct Font *font, const pixel_t colors[][4], int nb_colors)
+{
+	if (nb_colors>TEXT_COLORS) {
+		message("text style : %d color sets, TEXT_COLORS is %d\n", nb_colors, TEXT_COLORS);
+		bitbox_die(7,8);
+	}
+	s->font = font;
+	for (int i=0;i<TEXT_COLORS;i++) {
+		const pixel_t *col = colors[i<nb_colors ? i : 0];
+		for (int n=0;n<16;n++) // first pixel in low bits
+			s->couples[i][n] = col[n>>2] << PIXEL_BITS | col[n&3];
+	}
+}
+
+void text_init (struct object *o, const struct TextStyle *style, const char *text, int w)
+{
+	o->a = (uintptr_t)style;
+	o->b = (uintptr_t)text;
+	o->frame = text_frame;
+	o->line = text_line;
+	o->fr = 0;
+	text_frame(o,0); // size
+
+	if (!w) {
+		int lines;
+		text_size(style->font, text, &w, &lines);
+	}
+	o->w = w;
+}
+
+void text_set (struct object *o, const char *text)
+{
+	o->b = (uintptr_t)text;
+}
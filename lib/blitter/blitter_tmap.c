@@ -8,6 +8,8 @@
         *data : start of tilemap
         a : tileset
         b : header
+        c : zoom, 1 to 4 (see tilemap_set_zoom)
+        d : raster table or 0 (see raster_init)
 
     - width and height are displayed sizes, can be bigger/smaller than tilemap, in which case it will loop
 
@@ -56,6 +58,18 @@ const int tilesizes[] = {16,32,8};
     );
 */
 
+// applies the raster table line if any
+static inline void tilemap_raster(object *o, const unsigned int tilesize, int *x, int *line, uint8_t **tiledata)
+{
+    const struct RasterLine *raster = raster_line(o);
+    if (raster) {
+        *x += raster->x;
+        *line += raster->y;
+        if (raster->set) // same offset as tilemap_init
+            *tiledata = (uint8_t *)((const struct TilesetFile *)raster->set)->data - tilesize*tilesize;
+    }
+}
+
 __attribute__((always_inline)) static inline void tilemap_u8_line8(object *o, const unsigned int tilesize) 
 {
     // use current frame, line, buffer
@@ -64,9 +78,14 @@ __attribute__((always_inline)) static inline void tilemap_u8_line8(object *o, co
 
     //o->x &= ~3; // force addresses mod4
 
+    int x = o->x, line = vga_line-o->y;
+    uint8_t *tiledata = (uint8_t *)o->a; // nope : read 4 indices at once.
+    tilemap_raster(o, tilesize, &x, &line, &tiledata);
+
     // --- line related
     // line inside tilemap (pixel), looped.
-    int sprline = (vga_line-o->y) % (tilemap_h*tilesize);
+    const int map_lines = tilemap_h*tilesize;
+    int sprline = (line % map_lines + map_lines) % map_lines;
     // offset from start of tile (in lines)
     int offset = sprline%tilesize;
     // pointer to the beginning of the tilemap line
@@ -75,26 +94,25 @@ __attribute__((always_inline)) static inline void tilemap_u8_line8(object *o, co
     // --- column related -> in frame ?
     // horizontal tile offset in tilemap, draw position
     int tile_x, ofs;
-    if (o->x >= 0 ) {
+    if (x >= 0 ) {
         tile_x = 0;
-        ofs = o->x;
+        ofs = x;
     } else {
-        tile_x = (-o->x/tilesize) % tilemap_w;
-        ofs = o->x%(int)tilesize;
+        tile_x = (-x/tilesize) % tilemap_w;
+        ofs = x%(int)tilesize;
     }
     
     uint8_t * restrict dst = (uint8_t*) &draw_buffer[ofs];
     // pixel addr of the last pixel
-    const uint8_t *dst_max = (uint8_t*) &draw_buffer[min(o->x+o->w, VGA_H_PIXELS)];
+    const uint8_t *dst_max = (uint8_t*) &draw_buffer[min(x+o->w, VGA_H_PIXELS)];
 
-    uint8_t *tiledata = (uint8_t *)o->a; // nope : read 4 indices at once.
     uint8_t *restrict src;  // __builtin_assume_aligned
 
     // blit to end of line (and maybe a little more)
     // we needed to loop over
 
     while (dst<dst_max) {
-        if (tile_x>=tilemap_w)
+        if (tile_x>=(int)tilemap_w)
             tile_x-=tilemap_w;
 
         // blit one tile, 2pix=32bits at a time, 8 times = 16pixels, 16 times=32pixels
@@ -113,6 +131,53 @@ __attribute__((always_inline)) static inline void tilemap_u8_line8(object *o, co
 
 
 
+// each pixel drawn zoom x zoom, clipped to the screen
+__attribute__((always_inline)) static inline void tilemap_u8_line8_zoom(object *o, const unsigned int tilesize, const int zoom)
+{
+    const unsigned int tilemap_w = o->b>>20;
+    const unsigned int tilemap_h = (o->b >>8) & 0xfff;
+
+    int x = o->x, line = vga_line-o->y;
+    uint8_t *tiledata = (uint8_t *)o->a;
+    tilemap_raster(o, tilesize, &x, &line, &tiledata);
+
+    // line inside tilemap (pixel), looped.
+    const int map_lines = tilemap_h*tilesize*zoom;
+    const int sprline = (line % map_lines + map_lines) % map_lines / zoom;
+    const int offset = sprline%tilesize;
+    const uint8_t *idxptr = (uint8_t *)o->data+(sprline/tilesize) * tilemap_w;
+
+    // first tile drawn and its position (maybe left of the screen)
+    const int tile_w = tilesize*zoom;
+    int tile_x, px;
+    if (x >= 0) {
+        tile_x = 0;
+        px = x;
+    } else {
+        tile_x = (-x/tile_w) % tilemap_w;
+        px = x%tile_w;
+    }
+    const int end = min(x+o->w, VGA_H_PIXELS);
+
+    for (;px<end;px+=tile_w, tile_x++) {
+        if (tile_x>=(int)tilemap_w)
+            tile_x-=tilemap_w;
+        if (!idxptr[tile_x])
+            continue;
+
+        const uint8_t *src = &tiledata[(idxptr[tile_x]*tilesize + offset)*tilesize];
+        if (px>=0 && px+tile_w<=end) {
+            uint8_t * restrict dst = (uint8_t*) &draw_buffer[px];
+            for (int i=0;i<(int)tilesize;i++)
+                for (int k=0;k<zoom;k++) // unrolled
+                    *dst++ = src[i];
+        } else { // first or last tile, partly out
+            for (int p=px<0 ? 0 : px; p<px+tile_w && p<end; p++)
+                draw_buffer[p] = src[(p-px)/zoom];
+        }
+    }
+}
+
 // specialize - generic case
 void tilemap_u8_line8_any(object *o) {
     tilemap_u8_line8(o, tilesizes[((o->b)>>4)&3]);
@@ -123,6 +188,26 @@ void tilemap_u8_line8_8(object *o) {
     tilemap_u8_line8(o, 8);
 }
 
+void tilemap_u8_line8_zoom2(object *o) { tilemap_u8_line8_zoom(o, tilesizes[((o->b)>>4)&3], 2); }
+void tilemap_u8_line8_zoom3(object *o) { tilemap_u8_line8_zoom(o, tilesizes[((o->b)>>4)&3], 3); }
+void tilemap_u8_line8_zoom4(object *o) { tilemap_u8_line8_zoom(o, tilesizes[((o->b)>>4)&3], 4); }
+
+void tilemap_set_zoom (struct object *o, int zoom)
+{
+    static void (* const lines[])(struct object *o) = {tilemap_u8_line8_zoom2, tilemap_u8_line8_zoom3, tilemap_u8_line8_zoom4};
+    if (zoom<1) zoom=1;
+    if (zoom>4) zoom=4;
+
+    const int old = o->c ? o->c : 1;
+    o->w = o->w/old*zoom;
+    o->h = o->h/old*zoom;
+    o->c = zoom;
+    if (zoom>1)
+        o->line = lines[zoom-2];
+    else
+        o->line = tilesizes[((o->b)>>4)&3] == 8 ? tilemap_u8_line8_8 : tilemap_u8_line8_any;
+}
+
 void tilemap_init (struct object *o, const struct TilesetFile *tileset, int map_w, int map_h, const void *tilemap) {
      o->data = (uint32_t *)tilemap;
 
@@ -146,6 +231,8 @@ void tilemap_init (struct object *o, const struct TilesetFile *tileset, int map_
     o->fr = 0;
 
     o->frame=0;
+    o->c=1; // no zoom
+    o->d=0; // no raster table
 
     o->a = ((uintptr_t)(tileset->data))-tileset->tilesize*tileset->tilesize; // to start at index 1 and not 0, offset now in bytes.
 
@@ -1,281 +1,273 @@
-#! /usr/bin/python2
-
-# http://ieeexplore.ieee.org/stamp/stamp.jsp?arnumber=00152671
-# http://en.wikipedia.org/wiki/Block_Truncation_Coding
-# interpolation use ? transp 4bits hi/lo/mid/trans
-
-# 2bpp coding in 4x4 blocks, 15bit data (32bits / block), palettized 
-
-
-# palettize, cut in 4x4 blocks, sample <> moyenne luminance, get 2 colors
-# decompression : use load GE + SEL puis depalettize ? ou inverse
-
-
-# other possibility : 4bpp, 32 bits color = 4x 8bpp index?
-
-'''TODO : 
-transparency as (skip:8,blit:7,eol:1)
-sound !
-
-multifiles + temporal dither + align all at 512b 
-'''
-
-
-import sys, argparse
-from glob import glob
-from PIL import Image 
-# using the PIL library, maybe you'll need to install it. python should come with it.
+#!/usr/bin/env python3
+"""
+Encodes images and image sequences as btc4 (block truncation coding, 4x4 blocks) files.
+
+http://en.wikipedia.org/wiki/Block_Truncation_Coding
+
+Each 4x4 block is coded as one u32 : two 8 bit indices in a 256 colors palette (u16 RGB555)
+and 16 bits selecting the first (light) or second (dark) color for each pixel :
+    hi index << 24 | lo index << 16 | bits (bit y*4+x set : hi color)
+
+Still images (a png file) give a .btc file, as read by btc4_init :
+    u32 width, u32 height
+    u16 palette[256]
+    u32 blocks[width/4 * height/4]
+
+Image sequences (a directory of png frames, or several files with --video) give a .btv video,
+as read by btc4_video_init, see struct BTC4Video in blitter.h. All frames share one palette.
+Each frame only stores blocks changed since the previous frame : a mask of one bit per block,
+then the changed blocks. Blocks close enough to what is already displayed (--threshold) are
+kept, so noise and still backgrounds cost nothing.
+    u32 magic 'BTCV'
+    u16 width, height, nb_frames
+    u8  fps, key : full frame every key frames (0 : first one only)
+    u32 align : frames start at multiples of align (512 to stream from SD)
+    u16 palette[256]
+    u32 frame_offset[nb_frames+1] : from the start of the file, last one is the end of file
+    (padding)
+    frames : u32 mask[(nb_blocks+31)/32], u32 blocks[nb changed blocks]
+
+Frames are encoded in parallel with numpy.
+"""
+
+import sys
+import os
+import argparse
 import array
-from os.path import isdir, isfile
+import struct
+from glob import glob
+from concurrent.futures import ProcessPoolExecutor
 
-from collections  import Counter
+import numpy as np
+from PIL import Image
 
 BLOCKSIZE = 4
-
-if len(sys.argv)==1 : 
-    sys.argv += glob('in/*.png')
-
-
-def d(c,i) : 
-    a=((1,4),(3,2))
-    # c is 0-255 , outputs to 0-31 
-    x=i%BLOCKSIZE ; y=i//BLOCKSIZE    
-    return int(c/255.*31.+a[y%2][x%2]/5.)
-
-def lumi(block) : return [0.299 * r + 0.587 * g + 0.114 * b for r,g,b in block ] # Y,U,V
-
-def avg(l) : return sum(l)/float(len(l))
-def stddev(l,avg) : return sum(((x-avg)*(x-avg)) for x in l)/float(len(l))
-
-def quantize_colors(cols) : 
-    colors=[cols]   
-    if len(colors[0])<=255 : 
-        print "just keeping %d colors"%len(colors[0])
-        palette = list(colors[0])
-        invpal = dict((c,n) for n,c in enumerate(palette))
-    else : 
-        while len(colors)<256 : 
-            # find id of largest set  
-            cid = max(range(len(colors)),key=lambda i:len(colors[i]))
-            colorset =colors[cid] 
-            
-            # choix de l'axe : max d'ecart type 
-            avgs = [avg([c[i] for c in colors[cid]]) for i in range(3)]
-            stdv = [stddev([c[i] for c in colors[cid]],avgs[i]) for i in range(3)]
-            # get index of max
-            axis = max(range(len(stdv)), key=lambda x:stdv[x])
-
-            # couper a la moyenne : enlever & remettre 2 decoupes        
-            del colors[cid]
-            colors.append(set(c for c in colorset if c[axis] > avgs[axis]))
-            colors.append(set(c for c in colorset if c[axis] <= avgs[axis]))
-
-        # now make an invert mapping (asserts not too big !) from mean
-        palette=[]
-        invpal = {}
-        for cl in colors :
-            acl=tuple(int(avg([c[i] for c in cl])) for i in range(3))
-            if acl not in palette : 
-                palette.append(acl)
-
-            for c in cl : 
-                invpal[c]=palette.index(acl) # takes first if already in palette
-    
-    palette += [(0,0,0)]*(256-len(palette)) # pad to 256 values    
-
-    assert all( all(x<256 for x in c) for c in palette),[c for c in palette if any(x>=256 for x in c)]
-
-    invpal[None]=0
-    return palette,invpal
-
-
-
-def encode_plain(src, dither):
-    '''in : source image + dither bool, 
-       out : [encoded_block1, encoded_block2] 
-             where encoded_block = (col1 col2, u16 pixels)
-    '''
-
-    dither_array = ((1,4),(3,2))
-    encoded_blocks = [] 
-    for y in range(src.size[1]//BLOCKSIZE) : 
-        for x in range(src.size[0]//BLOCKSIZE) : 
-            imgblock = src.crop((x*BLOCKSIZE,y*BLOCKSIZE,(x+1)*BLOCKSIZE,(y+1)*BLOCKSIZE))
-            if dither :
-                block = tuple( 
-                    tuple(
-                        d(c,i) 
-                        for c in x) 
-                    for (i,x) in enumerate(imgblock.getdata())) # keep image in RAM as RGB tuples. 
-            else : 
-                block = tuple( tuple(c*31/255 for c in x) for x in imgblock.getdata()) # keep image in RAM as RGB tuples. 
-                
-
-            yuvblock = lumi(block)
-            avg_y = sum(yuvblock)/float(BLOCKSIZE*BLOCKSIZE) 
-            hipix = [b for b,yb in zip(block,yuvblock) if yb>=avg_y]
-            lopix = [b for b,yb in zip(block,yuvblock) if yb<avg_y]
-            # take average of hi pixels 
-            avghi = tuple(int(round(sum(b[i] for b in hipix)/float(len(hipix)))) for i in range(3)) if hipix else None
-            if avghi!=None : assert all(x<256 for x in avghi),(avghi,hipix,list(enumerate(imgblock.getdata())))
-
-
-            avglo = tuple(int(round(sum(b[i] for b in lopix)/float(len(lopix)))) for i in range(3)) if lopix else None
-            if avglo!=None : assert all(x<256 for x in avglo),(avglo,lopix)
-
-            # decoded = tuple(avghi if y>=avg_y else avglo for y in yuvblock)
-            encoded = sum(1<<n for n,(b,yu) in enumerate(zip(block,yuvblock)) if yu>=avg_y)
-            encoded_blocks.append((avghi,avglo,encoded))
-    return encoded_blocks
-
-def encode_numpy(src, dither):
-    '''in : source image + dither bool, 
-       out : [encoded_block1, encoded_block2] 
-             where encoded_block = (col1 col2, u16 pixels)
-    '''
-    
-    dither_array = ((1,4),(3,2))
-    encoded_blocks = [] 
-    for y in range(src.size[1]//BLOCKSIZE) : 
-        for x in range(src.size[0]//BLOCKSIZE) : 
-            imgblock = src.crop((x*BLOCKSIZE,y*BLOCKSIZE,(x+1)*BLOCKSIZE,(y+1)*BLOCKSIZE))
-            if dither :
-                block = tuple( 
-                    tuple(
-                        d(c,i) 
-                        for c in x) 
-                    for (i,x) in enumerate(imgblock.getdata())) # keep image in RAM as RGB tuples. 
-            else : 
-                block = tuple( tuple(c*31/255 for c in x) for x in imgblock.getdata()) # keep image in RAM as RGB tuples. 
-                
-
-            yuvblock = lumi(block)
-            avg_y = sum(yuvblock)/float(BLOCKSIZE*BLOCKSIZE) 
-            hipix = [b for b,yb in zip(block,yuvblock) if yb>=avg_y]
-            lopix = [b for b,yb in zip(block,yuvblock) if yb<avg_y]
-            # take average of hi pixels 
-            avghi = tuple(int(round(sum(b[i] for b in hipix)/float(len(hipix)))) for i in range(3)) if hipix else None
-            if avghi!=None : assert all(x<256 for x in avghi),(avghi,hipix,list(enumerate(imgblock.getdata())))
-
-
-            avglo = tuple(int(round(sum(b[i] for b in lopix)/float(len(lopix)))) for i in range(3)) if lopix else None
-            if avglo!=None : assert all(x<256 for x in avglo),(avglo,lopix)
-
-            # decoded = tuple(avghi if y>=avg_y else avglo for y in yuvblock)
-            encoded = sum(1<<n for n,(b,yu) in enumerate(zip(block,yuvblock)) if yu>=avg_y)
-            encoded_blocks.append((avghi,avglo,encoded))
-    return encoded_blocks
-
-
-def decode_image(size, encoded_blocks,encoded_palette,filename) : 
-    # decode palette
-    palette = [(((x>>10)&0x1f)*8,((x>>5)&0x1f)*8,(x&0x1f)*8) for x in encoded_palette] # low Q *8 !
-    dst = Image.new('RGB',size) # XXX A ?
-    stride = (size[0]+BLOCKSIZE-1)//BLOCKSIZE
-    for n,block in enumerate(encoded_blocks) : 
-        bx = n%stride
-        by = n//stride
-        c1 = palette[block>>24]
-        c2 = palette[(block>>16)&0xff]
-
-        for i in range(BLOCKSIZE*BLOCKSIZE) :
-            x = bx*BLOCKSIZE + i %BLOCKSIZE
-            y = by*BLOCKSIZE + i//BLOCKSIZE
-            try : 
-                dst.putpixel((x,y),c1 if block&(1<<i) else c2)
-            except IndexError,e : 
-                print size,x,y,i
-                raise
-    dst.save(filename)
-  
-
-def encode_file(name, options) :
-    print " *** ",name
-    if isdir(name) : # not always ...
-        filenames = sorted(glob(name+'/????.png'))
-        print "reading directory",name,':',', '.join(filenames)
-        imgs = [Image.open(fn).convert('RGBA') for fn in filenames]
-        if not imgs : raise IOError, 'No frame images Found in subdirectory'
-        if not all(img.size==imgs[0].size for img in imgs) :
-            print "Warning : frames not all the same sizes  : ",[i.size for i in imgs]
-
-        w = max(img.size[0] for img in imgs)
-        h = sum(img.size[1] for img in imgs)
-        
-        frame_h = imgs[0].size[1]
-
-        src = Image.new('RGBA',(w,h))
-        y = 0
-        for i in imgs:
-            src.paste(i, (0,y))
-            y += i.size[1]
-
-    elif isfile(name) : 
-        filenames = [name]
-        src = Image.open(name).convert('RGBA') # XXX transp
-        frame_h=src.size[1]
-
-    src = Image.open(name).convert('RGB') # XXX ALPHA
-    dst = src.copy()
-
-
-    # resize image if needed 
-    for dim in 0,1 : 
-        if src.size[dim]%BLOCKSIZE!=0 : 
-            print 'file %s : %s size %d not a multiple of %d, will be cropped '%\
-                (name,'xy'[dim],src.size[dim],BLOCKSIZE)            
-    src=src.crop((0,0,src.size[0]//BLOCKSIZE*BLOCKSIZE,src.size[1]//BLOCKSIZE*BLOCKSIZE))
-
-    # extract colors
-    encoded_blocks = encode_plain(src, options.dither)
-    cols=set()
-    for c1,c2,_ in encoded_blocks : 
-        cols.add(c1)
-        cols.add(c2)
-    if None in cols : cols.remove(None)
-
-    palette, invpal = quantize_colors(cols)
-    assert len(palette)==256,len(palette)
-
-    encoded_header = array.array('I',src.size)
-    encoded_pal = array.array('H',(( (r<<10) | (g << 5 ) | b ) for r,g,b in palette))  # encode palette
-    
-    encoded_u32 = array.array('I',((invpal[c1]<<24) | (invpal[c2]<<16) | encoded for c1,c2,encoded in encoded_blocks))
-    assert encoded_pal.itemsize==2
-    assert encoded_u32.itemsize==4
-
-    if options.test :
-        decode_image(src.size, encoded_u32,encoded_pal,name[:-4]+'out.png')
-
-    if not(options.no_out) : 
-        of=name[:-4]+'.btc'
-        print "writing",of
-        outfile = open(of,'wb')
-        encoded_header.tofile(outfile)
-        encoded_pal.tofile(outfile)
-        encoded_u32.tofile(outfile)
-        if (options.pad) : 
-            outfile.write('*'*(-outfile.tell()%512))
-        outfile.close()
-
-
-    #stats
-    encoded_size = len(encoded_blocks)*4+len(palette)*2
-    rawsize=src.size[0]*src.size[1]*2
-    print 'raw:', rawsize,'size',encoded_size,'reduc: %.1f'%(float(rawsize)/encoded_size)
-
-
-
-parser = argparse.ArgumentParser(description='Process some graphical files and renders them as btc files')
-parser.add_argument('filename', metavar='F', type=str, nargs='+',
-                   help='a graphical file')
-parser.add_argument('-d','--dither',action='store_true',help='dither data')
-parser.add_argument('-t','--test', action='store_true', help='produce test image')
-parser.add_argument('-p','--pad', action='store_true', help='pad to 512B limit')
-parser.add_argument('-n','--no-out', action='store_true', help='do not produce a btc file')
-
-opts= parser.parse_args()
-
-print opts
-for name in opts.filename : # for each input file
-    encode_file(name, opts)
+BTV_MAGIC = b"BTCV"
+BTV_HEADER = 16
+DITHER = np.array(((1, 4), (3, 2))) / 5.0  # ordered dither, in 5 bit color steps
+LUMA = np.array((0.299, 0.587, 0.114))
+
+
+def load(filename):
+    "RGB image as an array, cropped to whole blocks"
+    img = np.asarray(Image.open(filename).convert("RGB"))
+    h, w = (x // BLOCKSIZE * BLOCKSIZE for x in img.shape[:2])
+    if (h, w) != img.shape[:2]:
+        print("%s : %dx%d not a multiple of %d, cropped" % (filename, img.shape[1], img.shape[0], BLOCKSIZE), file=sys.stderr)
+    return img[:h, :w]
+
+
+def to_blocks(img, dither):
+    "image to its blocks of 16 pixels as 5 bit RGB floats, shape (by, bx, 16, 3)"
+    h, w = img.shape[:2]
+    c = img.astype(np.float32) * (31.0 / 255)
+    if dither:
+        c += DITHER[np.arange(h)[:, None] % 2, np.arange(w)[None, :] % 2][..., None]
+    c = np.floor(c)
+    return c.reshape(h // 4, 4, w // 4, 4, 3).transpose(0, 2, 1, 3, 4).reshape(h // 4, w // 4, 16, 3)
+
+
+def encode_blocks(blocks):
+    "light and dark 5 bit colors (by, bx, 3) and 16 bit masks (by, bx) of blocks"
+    y = blocks @ LUMA
+    hi = y >= y.mean(axis=-1, keepdims=True)
+    nhi = hi.sum(axis=-1)[..., None]
+    nlo = BLOCKSIZE * BLOCKSIZE - nhi
+    hi_col = (blocks * hi[..., None]).sum(axis=2) / np.maximum(nhi, 1)
+    lo_col = (blocks * ~hi[..., None]).sum(axis=2) / np.maximum(nlo, 1)
+    lo_col = np.where(nlo > 0, lo_col, hi_col)  # flat block
+    bits = (hi * (1 << np.arange(16))).sum(axis=-1)
+    return np.rint(hi_col).astype(np.int32), np.rint(lo_col).astype(np.int32), bits.astype(np.uint32)
+
+
+def rgb15(cols):
+    return cols[..., 0] << 10 | cols[..., 1] << 5 | cols[..., 2]
+
+
+def analyze(filename, dither):
+    "colors used by an image, as 15 bit keys and counts"
+    hi, lo, _ = encode_blocks(to_blocks(load(filename), dither))
+    return np.unique(np.concatenate((rgb15(hi).ravel(), rgb15(lo).ravel())), return_counts=True)
+
+
+def quantize_colors(keys, counts, nb=256):
+    """median cut of 15 bit colors, weighted by use.
+    Returns palette as (256, 3) 5 bit colors and a lookup of palette index for all 15 bit colors"""
+    cols = np.stack((keys >> 10 & 31, keys >> 5 & 31, keys & 31), axis=-1).astype(np.float64)
+    boxes = [np.arange(len(keys))]
+    while len(boxes) < nb:
+        splittable = [i for i, b in enumerate(boxes) if len(b) > 1]
+        if not splittable:
+            break
+        box = boxes.pop(max(splittable, key=lambda i: counts[boxes[i]].sum()))
+        c, w = cols[box], counts[box][:, None]
+        mean = (c * w).sum(axis=0) / w.sum()
+        axis = ((c - mean) ** 2 * w).sum(axis=0).argmax()
+        low = c[:, axis] <= mean[axis]
+        if low.all():  # all on the mean but one side
+            low = c[:, axis] < c[:, axis].max()
+        boxes += [box[low], box[~low]]
+
+    palette = np.zeros((nb, 3), dtype=np.int32)
+    lookup = np.zeros(1 << 15, dtype=np.uint32)
+    for i, box in enumerate(boxes):
+        w = counts[box][:, None]
+        palette[i] = np.rint((cols[box] * w).sum(axis=0) / w.sum())
+        lookup[keys[box]] = i
+    print("%d colors to %d" % (len(keys), len(boxes)), file=sys.stderr)
+    return palette, lookup
+
+
+def decode_blocks(words, palette):
+    "blocks (by, bx) u32 to their pixels as (by, bx, 16, 3) 5 bit colors"
+    bits = (words[..., None] >> np.arange(16).astype(np.uint32)) & 1
+    return np.where(bits[..., None], palette[words >> 24][..., None, :], palette[words >> 16 & 255][..., None, :])
+
+
+def blocks_to_image(pixels):
+    by, bx = pixels.shape[:2]
+    img = pixels.reshape(by, bx, 4, 4, 3).transpose(0, 2, 1, 3, 4).reshape(by * 4, bx * 4, 3)
+    return Image.fromarray((img * 255 // 31).astype(np.uint8))
+
+
+class Frames:
+    "encodes frames with a shared palette, to keep the pool workers argument small"
+
+    def __init__(self, palette, lookup, dither):
+        self.palette, self.lookup, self.dither = palette, lookup, dither
+
+    def __call__(self, filename):
+        blocks = to_blocks(load(filename), self.dither).astype(np.uint8)
+        hi, lo, bits = encode_blocks(blocks)
+        words = self.lookup[rgb15(hi)] << 24 | self.lookup[rgb15(lo)] << 16 | bits
+        return blocks, words
+
+
+def encode(filenames, args):
+    "palette and (source blocks, words) of each frame, in order"
+    with ProcessPoolExecutor(args.jobs) as pool:
+        used = {}
+        for keys, counts in pool.map(analyze, filenames, [args.dither] * len(filenames)):
+            for k, n in zip(keys.tolist(), counts.tolist()):
+                used[k] = used.get(k, 0) + n
+        keys = np.array(sorted(used), dtype=np.int64)
+        palette, lookup = quantize_colors(keys, np.array([used[k] for k in keys.tolist()]))
+        yield palette
+        encode_frame = Frames(palette, lookup, args.dither)
+        step = 4 * (args.jobs or 1)  # bounds memory of frames waiting to be written
+        for i in range(0, len(filenames), step):
+            yield from pool.map(encode_frame, filenames[i : i + step])
+
+
+def write_palette(of, palette):
+    array.array("H", rgb15(palette).astype(np.uint16).tolist()).tofile(of)
+
+
+def encode_still(filename, args):
+    palette, (_, words) = encode([filename], args)
+    h, w = (x * BLOCKSIZE for x in words.shape)
+
+    if args.test:
+        blocks_to_image(decode_blocks(words, palette)).save(filename[:-4] + "out.png")
+
+    if not args.no_out:
+        out = args.output or filename[:-4] + ".btc"
+        print("writing", out, file=sys.stderr)
+        with open(out, "wb") as of:
+            of.write(struct.pack("<II", w, h))
+            write_palette(of, palette)
+            of.write(words.astype("<u4").tobytes())
+            if args.pad:
+                of.write(b"*" * (-of.tell() % 512))
+
+    size = words.size * 4 + 512
+    print("raw:", w * h * 2, "size", size, "reduc: %.1f" % (w * h * 2 / size), file=sys.stderr)
+
+
+def encode_video(filenames, out, args):
+    frames = encode(filenames, args)
+    palette = next(frames)
+    shown = None  # words currently on screen
+    data = []
+    nb_changed = 0
+    for n, (blocks, words) in enumerate(frames):
+        if shown is None or (args.key and n % args.key == 0):
+            changed = np.ones(words.shape, dtype=bool)
+        else:
+            # keep a block if it is not much worse than the new one
+            err_new = ((decode_blocks(words, palette) - blocks) ** 2).sum(axis=(2, 3)) / 16
+            err_old = ((decode_blocks(shown, palette) - blocks) ** 2).sum(axis=(2, 3)) / 16
+            changed = (words != shown) & (err_old > err_new + args.threshold)
+        shown = np.where(changed, words, shown) if shown is not None else words
+        nb_changed += changed.sum()
+
+        flat = changed.ravel()
+        mask = np.packbits(np.pad(flat, (0, -len(flat) % 32)), bitorder="little")
+        data.append(mask.tobytes() + shown.ravel()[flat].astype("<u4").tobytes())
+
+        if args.test:
+            blocks_to_image(decode_blocks(shown, palette)).save("%s_%04d.png" % (out[:-4], n))
+
+    h, w = (x * BLOCKSIZE for x in shown.shape)
+    align = args.align
+    offset = BTV_HEADER + 512 + 4 * (len(data) + 1)
+    offsets = []
+    for d in data:
+        offset += -offset % align
+        offsets.append(offset)
+        offset += len(d)
+    offsets.append(offset)
+
+    if not args.no_out:
+        print("writing", out, file=sys.stderr)
+        with open(out, "wb") as of:
+            of.write(BTV_MAGIC + struct.pack("<HHHBBI", w, h, len(data), args.fps, args.key, align))
+            write_palette(of, palette)
+            array.array("I", offsets).tofile(of)
+            for o, d in zip(offsets, data):
+                of.write(b"\0" * (o - of.tell()))
+                of.write(d)
+
+    nb_blocks = shown.size * len(data)
+    print(
+        "%d frames %dx%d, %d/%d blocks changed (%.1f%%), %d bytes, %.0f bytes per frame, %.1f kB/s"
+        % (len(data), w, h, nb_changed, nb_blocks, 100.0 * nb_changed / nb_blocks, offset,
+           offset / len(data), offset * args.fps / len(data) / 1024),
+        file=sys.stderr,
+    )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("filename", nargs="+", help="png files, or directories of png frames")
+    parser.add_argument("-o", "--output", help="output file (default : input name .btc / .btv)")
+    parser.add_argument("-d", "--dither", action="store_true", help="dither data")
+    parser.add_argument("-t", "--test", action="store_true", help="produce test images of the decoded result")
+    parser.add_argument("-p", "--pad", action="store_true", help="pad still images to 512B")
+    parser.add_argument("-n", "--no-out", action="store_true", help="do not produce a btc file")
+    parser.add_argument("-v", "--video", action="store_true", help="all files are the frames of one video")
+    parser.add_argument("--fps", type=int, default=30, help="video frames per second (default 30)")
+    parser.add_argument("--threshold", type=float, default=1.0,
+                        help="video : keep a block unless the new one is better by this error (per pixel, in 5 bit steps squared, default 1)")
+    parser.add_argument("--key", type=int, default=0, help="video : full frame every N frames (default 0 : first one only)")
+    parser.add_argument("--align", type=int, default=4, help="video : align frames to this in the file, 512 for SD streaming (default 4)")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="parallel frame encodings")
+    args = parser.parse_args()
+
+    if args.align % 4:
+        parser.error("align must be a multiple of 4")
+    if not 0 <= args.key < 256:
+        parser.error("key must be 0-255")
+
+    if args.video:
+        encode_video(args.filename, args.output or args.filename[0].rsplit(".", 1)[0] + ".btv", args)
+    else:
+        for name in args.filename:
+            print(" *** ", name, file=sys.stderr)
+            if os.path.isdir(name):
+                frames = sorted(glob(os.path.join(name, "*.png")))
+                if not frames:
+                    parser.error("no png frames found in " + name)
+                encode_video(frames, args.output or name.rstrip("/") + ".btv", args)
+            else:
+                encode_still(name, args)
@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+"""
+Converts a whole asset directory with the blitter scripts, in parallel and cached.
+
+Each file of the asset directory matching a rule is converted by the rule command, run in
+a private temporary directory : all files it creates there (and its standard output if
+the rule says so) are the outputs, copied to the output directory (same sub directories).
+
+Outputs are cached by a hash of the command, the converter scripts, the input file and the
+files it references (tilesets and images of .tmx/.tsx files) : an unchanged asset is not
+converted again, even after a clean or on another branch. Outputs whose content did not
+change keep their date, so that make does not rebuild what depends on them.
+
+Rules
+=====
+
+Rules are read from assets.rules in the asset directory if it exists, else the defaults below.
+One rule per line, the first matching rule is used :
+
+    pattern : command [> stdout_file]
+
+pattern is matched against the path relative to the asset directory (fnmatch : *, ?, [...])
+In command and stdout_file, {in} is the input file (absolute), {name} its name without
+extension. Commands starting with a script of this directory run it with this python.
+
+Default rules :
+"""
+
+import sys
+import os
+import re
+import argparse
+import fnmatch
+import hashlib
+import shlex
+import shutil
+import subprocess
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+SCRIPTS_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# png files are converted by their directory : tilesets and images of tiled files are not sprites
+DEFAULT_RULES = """\
+*.tmx            : mk_tmap.py {in} > {name}.h
+*.tsx            : mk_tset.py {in} -o {name}.tset
+*sprites/*.png   : mk_spr.py {in} -o {name}.spr
+*fonts/*.png     : mk_font.py {in} {name}.fnt
+*pictures/*.png  : btc4.py {in} -o {name}.btc
+"""
+
+__doc__ += "\n".join("    " + l for l in DEFAULT_RULES.splitlines())
+
+
+def parse_rules(text):
+    rules = []
+    for line in text.splitlines():
+        line = line.split("#", 1)[0].strip()
+        if not line:
+            continue
+        pattern, command = (x.strip() for x in line.split(":", 1))
+        lex = shlex.shlex(command, posix=True, punctuation_chars=True)
+        lex.whitespace_split = True
+        args = list(lex)
+        stdout = None
+        if len(args) > 2 and args[-2] == ">":
+            args, stdout = args[:-2], args[-1]
+        rules.append((pattern, args, stdout))
+    return rules
+
+
+def file_hash(path):
+    h = hashlib.sha1()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(1 << 16), b""):
+            h.update(block)
+    return h.hexdigest()
+
+
+def dependencies(path, seen=None):
+    "files referenced by tiled files (tilesets, images), recursively"
+    seen = set() if seen is None else seen
+    if not path.endswith((".tmx", ".tsx")):
+        return seen
+    text = open(path, encoding="utf8", errors="replace").read()
+    for src in re.findall(r'source="([^"]+)"', text):
+        dep = os.path.normpath(os.path.join(os.path.dirname(path), src))
+        if dep not in seen and os.path.exists(dep):
+            seen.add(dep)
+            dependencies(dep, seen)
+    return seen
+
+
+def scripts_hash():
+    "converters and their helpers : changing them invalidates the cache"
+    h = hashlib.sha1()
+    for name in sorted(os.listdir(SCRIPTS_DIR)):
+        if name.endswith(".py"):
+            h.update(name.encode() + file_hash(os.path.join(SCRIPTS_DIR, name)).encode())
+    return h.hexdigest()
+
+
+def expand(template, path):
+    name = os.path.splitext(os.path.basename(path))[0]
+    return template.replace("{in}", os.path.abspath(path)).replace("{name}", name)
+
+
+def write_if_changed(filename, data):
+    if os.path.exists(filename) and open(filename, "rb").read() == data:
+        return False
+    open(filename, "wb").write(data)
+    return True
+
+
+class Job:
+    def __init__(self, path, rel, rule, outdir, cache, salt):
+        self.path, self.rel = path, rel
+        self.pattern, self.command, self.stdout = rule
+        self.outdir = os.path.join(outdir, os.path.dirname(rel))
+        self.log = ""
+
+        h = hashlib.sha1(salt.encode())
+        h.update(repr((self.command, self.stdout)).encode())
+        for dep in [path] + sorted(dependencies(path)):
+            h.update(file_hash(dep).encode())
+        self.key = h.hexdigest()
+        self.cache_dir = os.path.join(cache, self.key[:2], self.key)
+
+    def convert(self):
+        "run the command in a temporary directory, store its outputs in the cache"
+        args = [expand(a, self.path) for a in self.command]
+        script = os.path.join(SCRIPTS_DIR, args[0])
+        if args[0].endswith(".py") and os.path.exists(script):
+            args = [sys.executable, script] + args[1:]
+
+        with tempfile.TemporaryDirectory() as work:
+            res = subprocess.run(args, cwd=work, stdout=subprocess.PIPE, stderr=subprocess.STDOUT if not self.stdout else subprocess.PIPE)
+            out = res.stdout if self.stdout else b""
+            self.log = (res.stderr if self.stdout else res.stdout).decode(errors="replace")
+            if res.returncode:
+                raise RuntimeError("%s failed (%d) :\n%s" % (" ".join(args), res.returncode, self.log))
+            if self.stdout:
+                open(os.path.join(work, expand(self.stdout, self.path)), "wb").write(out)
+
+            # move to cache atomically, another build can be filling it too
+            tmp = self.cache_dir + ".tmp%d" % os.getpid()
+            shutil.rmtree(tmp, ignore_errors=True)
+            shutil.copytree(work, tmp)
+            try:
+                os.replace(tmp, self.cache_dir)
+            except OSError:
+                shutil.rmtree(tmp, ignore_errors=True)  # already there
+
+    def run(self):
+        "returns (cached, output files)"
+        cached = os.path.isdir(self.cache_dir)
+        if not cached:
+            self.convert()
+
+        os.makedirs(self.outdir, exist_ok=True)
+        outputs = []
+        for name in sorted(os.listdir(self.cache_dir)):
+            dest = os.path.join(self.outdir, name)
+            write_if_changed(dest, open(os.path.join(self.cache_dir, name), "rb").read())
+            outputs.append(dest)
+        return cached, outputs
+
+
+def find_jobs(assets, rules, outdir, cache, salt):
+    jobs = []
+    outdir_abs, cache_abs = os.path.abspath(outdir), os.path.abspath(cache)
+    for root, dirs, files in os.walk(assets):
+        dirs[:] = sorted(d for d in dirs if os.path.abspath(os.path.join(root, d)) not in (outdir_abs, cache_abs))
+        for f in sorted(files):
+            path = os.path.join(root, f)
+            rel = os.path.relpath(path, assets)
+            rule = next((r for r in rules if fnmatch.fnmatch(rel, r[0])), None)
+            if rule:
+                jobs.append(Job(path, rel, rule, outdir, cache, salt))
+    return jobs
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("assets", help="asset directory")
+    parser.add_argument("-o", "--output", default="build/assets", help="output directory (default build/assets)")
+    parser.add_argument("-r", "--rules", help="rules file (default : assets/assets.rules, or default rules)")
+    parser.add_argument("-c", "--cache", help="cache directory (default : $BITBOX_ASSET_CACHE or ~/.cache/bitbox_assets)")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="parallel conversions (default : all cores)")
+    parser.add_argument("-v", "--verbose", action="store_true", help="show converters output")
+    args = parser.parse_args()
+
+    rules_file = args.rules or os.path.join(args.assets, "assets.rules")
+    rules = parse_rules(open(rules_file).read() if os.path.exists(rules_file) else DEFAULT_RULES)
+    cache = args.cache or os.environ.get("BITBOX_ASSET_CACHE") or os.path.expanduser("~/.cache/bitbox_assets")
+
+    jobs = find_jobs(args.assets, rules, args.output, cache, scripts_hash())
+    nb_cached = nb_failed = 0
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        for job, future in [(j, pool.submit(j.run)) for j in jobs]:
+            try:
+                cached, outputs = future.result()
+            except Exception as e:
+                print("error : %s : %s" % (job.rel, e), file=sys.stderr)
+                nb_failed += 1
+                continue
+            nb_cached += cached
+            print(" %s %s -> %s" % ("cached" if cached else "  made", job.rel, " ".join(os.path.basename(o) for o in outputs)), file=sys.stderr)
+            if args.verbose and job.log:
+                print(job.log, file=sys.stderr)
+
+    print("%d assets, %d from cache, %d converted, %d failed" % (len(jobs), nb_cached, len(jobs) - nb_cached - nb_failed, nb_failed), file=sys.stderr)
+    sys.exit(1 if nb_failed else 0)
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Makes the blend lookup tables of an 8bpp palette, used by translucent rects and sprites
+(see Blending in blitter.h).
+
+For each mode, a table gives for a source color (drawn) and a destination color (already on
+the line) the palette index nearest to their blend :
+    const uint8_t blend_lut_<mode>[65536], indexed [src<<8 | dst]
+
+Modes :
+    mix    : (src+dst)/2
+    add    : src+dst, saturated
+    darken : src*dst (multiply)
+
+Each table is 64kB : only make the modes you use. Writes a .c file and its .h
+
+    mk_blend.py -p MICRO -m mix,darken -o blend_luts.c
+"""
+
+import argparse
+import os
+
+import numpy as np
+from PIL import Image
+
+from utils import gen_micro_pal
+
+MODES = {
+    'mix':    lambda s, d: (s+d)//2,
+    'add':    lambda s, d: np.minimum(s+d, 255),
+    'darken': lambda s, d: s*d//255,
+}
+
+
+def palette_rgb(palette):
+    "256x3 int array of the palette colors, from a png palette or MICRO"
+    img = gen_micro_pal() if palette == 'MICRO' else Image.open(palette)
+    pal = img.getpalette()
+    if pal is None:
+        raise ValueError("%s has no palette" % palette)
+    pal = (pal + [0]*768)[:768]
+    return np.array(pal, dtype=np.int32).reshape(256, 3)
+
+
+def nearest(colors, pal, chunk=4096):
+    "palette index nearest to each color, by squared RGB distance"
+    out = np.empty(len(colors), dtype=np.uint8)
+    for i in range(0, len(colors), chunk):
+        c = colors[i:i+chunk, None, :]
+        out[i:i+chunk] = ((c-pal[None, :, :])**2).sum(axis=2).argmin(axis=1)
+    return out
+
+
+def blend_lut(pal, mode):
+    src = np.repeat(pal, 256, axis=0)  # src<<8 | dst
+    dst = np.tile(pal, (256, 1))
+    return nearest(MODES[mode](src, dst), pal)
+
+
+def write_c(f, name, lut):
+    f.write("const uint8_t %s[65536] = {\n" % name)
+    for i in range(0, len(lut), 32):
+        f.write("    " + ",".join(str(x) for x in lut[i:i+32]) + ",\n")
+    f.write("};\n\n")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--palette", required=True, help="png file with the game palette, or MICRO")
+    parser.add_argument("-m", "--modes", default="mix,add,darken", help="comma separated modes (default : mix,add,darken)")
+    parser.add_argument("-o", "--output", default="blend_luts.c", help="output .c file, .h made next to it (default blend_luts.c)")
+    args = parser.parse_args()
+
+    modes = args.modes.split(',')
+    for m in modes:
+        if m not in MODES:
+            parser.error("unknown mode %s, choose from %s" % (m, ','.join(MODES)))
+
+    pal = palette_rgb(args.palette)
+    header = os.path.splitext(args.output)[0] + '.h'
+
+    with open(args.output, 'w') as f:
+        f.write("// blend tables for %s, made by mk_blend.py\n#include <stdint.h>\n\n" % args.palette)
+        for m in modes:
+            write_c(f, "blend_lut_"+m, blend_lut(pal, m))
+
+    with open(header, 'w') as f:
+        f.write("// blend tables for %s, made by mk_blend.py\n#pragma once\n#include <stdint.h>\n\n" % args.palette)
+        for m in modes:
+            f.write("extern const uint8_t blend_lut_%s[65536];\n" % m)
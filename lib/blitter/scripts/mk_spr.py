@@ -77,6 +77,44 @@ from utils import *
 DEBUG = True
 VERBOSE_SPR = False  # explicits blits for sprite encoding
 
+CODE_SKIP = 0
+CODE_FILL = 1
+CODE_DATA = 2
+CODE_REF = 3
+
+# Decode cost model used by --optimal, in cycles on the Cortex-M4, estimated from
+# sprite3_line_noclip (u16 / u8) and sprite3_cpl_line (cpl) :
+# per blit (header, read_len, switch, eol test), per length extension byte, then
+# (fixed, per pixel) costs of each blit code.
+CYCLES_BLIT = 14
+CYCLES_LEN_EXT = 5
+CYCLES_CODE = {
+    # memcpy call for copy / back reference, plain store loop for fill
+    DATA_u16: {CODE_SKIP: (1, 0), CODE_FILL: (4, 2), CODE_DATA: (20, 1), CODE_REF: (24, 1)},
+    DATA_u8: {CODE_SKIP: (1, 0), CODE_FILL: (4, 2), CODE_DATA: (20, 0.5), CODE_REF: (24, 0.5)},
+    # couple palette lookup per 2 pixels, fill looks the couple up each time
+    DATA_cpl: {CODE_SKIP: (1, 0), CODE_FILL: (6, 1.5), CODE_DATA: (6, 2.5), CODE_REF: (10, 2.5)},
+}
+
+
+def blit_header(code, n, eol):
+    "blit header bytes : code, eol, length with extension bytes"
+    s = bytes([code << 6 | ((1 << 5) if eol else 0) | min(n, 31)])
+    n -= 31
+    while n >= 255:
+        s += bytes([255])
+        n -= 255
+    if n >= 0:
+        s += bytes([n])
+    return s
+
+
+def blit_cycles(datacode, code, n):
+    "estimated decode cycles of a blit of n pixels"
+    fixed, per_px = CYCLES_CODE[datacode][code]
+    ext = 0 if n < 31 else 1 + (n - 31) // 255
+    return CYCLES_BLIT + CYCLES_LEN_EXT * ext + fixed + per_px * n
+
 
 class Encoder:
     def __init__(self, frames, hitbox):
@@ -92,13 +130,16 @@ class Encoder:
                 lines += cut_image(fr, self.frm_w, args.vtile)
             frames = lines
 
-        # dedup frames
+        # dedup frames, by content
         self.idframes = []  # frame -> unique frame reference
         self.unique_frames = []  # list of unique frames
-        for i, img in enumerate(frames):
-            if img not in self.unique_frames:
+        frame_ids = {}  # (size, pixels) -> unique frame reference
+        for img in frames:
+            key = (img.size, img.tobytes())
+            if key not in frame_ids:
+                frame_ids[key] = len(self.unique_frames)
                 self.unique_frames.append(img)
-            self.idframes.append(self.unique_frames.index(img))
+            self.idframes.append(frame_ids[key])
         self.src = stack_images_vertically(self.unique_frames)
 
         self.hitbox = hitbox
@@ -188,11 +229,6 @@ class Encoder:
         newblits = []
         prev_eol = True
 
-        CODE_SKIP = 0
-        CODE_FILL = 1
-        CODE_DATA = 2
-        CODE_REF = 3
-
         # one number per code
         nb = [0, 0, 0, 0]
         sz = [0, 0, 0, 0]
@@ -200,6 +236,7 @@ class Encoder:
 
         s = b""
         self.frame_index = [0]
+        self.emitted = []  # code, pixels, bytes of each blit
         y = 0
         for n, bl, eol in self.blits:
             if type(bl) == int:
@@ -220,15 +257,7 @@ class Encoder:
                         data = None  # exact value will be determined after since it depends on size of header
 
             px[code] += n
-
-            # blit header
-            s_header = bytes([code << 6 | ((1 << 5) if eol else 0) | min(n, 31)])
-            n -= 31
-            while n >= 255:
-                s_header += bytes([255])
-                n -= 255
-            if n >= 0:
-                s_header += bytes([n])
+            s_header = blit_header(code, n, eol)
 
             # adjust backref now that we know header size
             if code == CODE_REF:
@@ -238,6 +267,7 @@ class Encoder:
             s += s_header + data
             nb[code] += 1
             sz[code] += len(s_header) + len(data)
+            self.emitted.append((code, n, len(s_header) + len(data)))
 
             if eol:
                 y += 1
@@ -257,6 +287,87 @@ class Encoder:
                 f"  {bname} : {bnb:4} blits, {bsz:4} bytes, {bpx:4} pixels, {(bsz*8/bpx) if bpx else 0:.3f} bpp."
             )
 
+    def parse_run(self, elems, npx, s):
+        """optimal parse of a run of opaque elements into fill / data / back reference blits.
+        Dynamic programming over element positions, minimizing estimated decode cycles
+        (bytes weighted by args.byte_cost). Back references are searched in s, the data
+        already emitted. Returns [(code, pixels, element slice)]"""
+        ppe = 2 if self.datacode == DATA_cpl else 1
+        esize = 2 if self.datacode == DATA_u16 else 1
+        data = array.array("H" if esize == 2 else "B", elems).tobytes()
+        m = len(elems)
+
+        def pixels(i, j):  # last couple of an odd run is half used
+            return (j - i) * ppe - (1 if j == m and ppe * m != npx else 0)
+
+        def cost(code, i, j, nbytes):
+            n = pixels(i, j)
+            hlen = 1 if n < 31 else 2 + (n - 31) // 255
+            return blit_cycles(self.datacode, code, n) + args.byte_cost * (hlen + nbytes)
+
+        best = [0] + [float("inf")] * m
+        choice = [None] * (m + 1)
+
+        def relax(i, j, code, nbytes):
+            c = best[i] + cost(code, i, j, nbytes)
+            if c < best[j]:
+                best[j], choice[j] = c, (code, i)
+
+        for i in range(m):
+            j = i + 1
+            while j <= m and elems[j - 1] == elems[i]:
+                relax(i, j, CODE_FILL, esize)
+                j += 1
+            for j in range(i + 1, m + 1):
+                relax(i, j, CODE_DATA, (j - i) * esize)
+            # back references : a longer match exists only if the shorter does
+            for j in range(i + 1, m + 1):
+                pos = s.rfind(data[i * esize : j * esize])
+                if pos < 0 or len(s) - pos > 60000:  # keeps room for this line before 64k
+                    break
+                relax(i, j, CODE_REF, 2)
+
+        blits = []
+        j = m
+        while j:
+            code, i = choice[j]
+            blits.append((code, pixels(i, j), i, j))
+            j = i
+        return [(code, n, data[i * esize : j * esize]) for code, n, i, j in reversed(blits)]
+
+    def generate_bin_optimal(self):
+        "as generate_bin, with runs of opaque pixels split by parse_run"
+        esize = 2 if self.datacode == DATA_u16 else 1
+        s = b""
+        self.frame_index = [0]
+        self.emitted = []
+        for n, bl, eol in self.blits:
+            parsed = [(CODE_SKIP, n, b"")] if bl == None else self.parse_run(bl, n, s)
+            for k, (code, npx, elems) in enumerate(parsed):
+                last = eol and k == len(parsed) - 1
+                header = blit_header(code, npx, last)
+                if code == CODE_FILL:
+                    data = elems[:esize]
+                elif code == CODE_REF:
+                    idx = len(s) + len(header) - s.rindex(elems)
+                    assert idx < 65536
+                    data = bytes([idx & 0xFF, idx >> 8])
+                else:
+                    data = elems
+                s += header + data
+                self.emitted.append((code, npx, len(header) + len(data)))
+            if eol:
+                self.frame_index.append(len(s))
+        self.bindata = s
+
+    def report(self, title):
+        lines = len(self.frame_index) - 1
+        cycles = sum(blit_cycles(self.datacode, code, n) for code, n, _ in self.emitted)
+        print(
+            f" ** {title:8} : {len(self.emitted):5} blits, {len(self.bindata):6} bytes, "
+            f"{cycles:8.0f} est. cycles, {cycles/max(lines,1):6.1f} per line"
+        )
+
     def write_header(self, of):
         w, h = self.src.size
         of.write(
@@ -276,12 +387,19 @@ class Encoder:
     def prepare(self):
         self.cutlines()  # n, None / [rgba...] blits , eol
         self.encode()  # n, none / [rgba u16/8/cpl refs], eol, creates self.palette
+        encoded = self.blits
         self.packbits()  # n, None, color, [rgba] , eol
 
         self.strblits()  # n, None, color, string, eol
 
         self.generate_bin()  # self.index, self.bindata (including palette if code = cpl)
 
+        if args.optimal:
+            self.report("greedy")
+            self.blits = encoded
+            self.generate_bin_optimal()
+            self.report("optimal")
+
 
 class Encoder_u16(Encoder):
     datacode = DATA_u16
@@ -482,6 +600,17 @@ if __name__ == "__main__":
     )
     parser.add_argument("--min_match", help="minimum match", type=int, default=4)
     parser.add_argument("--min_fill", help="minimum fill", type=int, default=4)
+    parser.add_argument(
+        "--optimal",
+        help="optimal parse of lines, minimizing estimated decode cycles : trades size for cycles, often larger than greedy (min_match, min_fill unused)",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--byte_cost",
+        help="with --optimal, cycles one byte of data is worth : lower is faster, higher smaller (default 4, about the size of greedy)",
+        type=float,
+        default=4.0,
+    )
     parser.add_argument(
         "--vtile",
         help="vertical lines to cut the image into (0 for frames) - dedup, fast skip",
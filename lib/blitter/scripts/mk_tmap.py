@@ -66,7 +66,7 @@ def out_objects(tmap, basefile, properties, of=None):
         - [('layername1',index_first_object), ('layername2',idx), ...]
         - [(ts,type),(ts,type),...] uniques - to spr files references
     """
-    unique_oids = []
+    unique_oids = {}  # oid -> index in unique_ts
     unique_ts = []  # ts characteristics corresponding to unique_oids
     unique_obj_h = []  # vertical height of tiles in this tileset in // with oids
     objgroups = []
@@ -83,7 +83,7 @@ def out_objects(tmap, basefile, properties, of=None):
 
             oid = int(obj.get("gid"))
             if oid not in unique_oids:
-                unique_oids.append(oid)
+                unique_oids[oid] = len(unique_ts)
                 ts, rid = tid2ts(tmap, oid, basefile)
                 tile = ts.find('tile[@id="%d"]' % rid)
                 unique_ts.append(
@@ -91,7 +91,7 @@ def out_objects(tmap, basefile, properties, of=None):
                 )
                 unique_obj_h.append(int(ts.get("tileheight")))
 
-            uid = unique_oids.index(oid)
+            uid = unique_oids[oid]
             nm = obj.get("name")
 
             x = int(float(obj.get("x")))
@@ -23,14 +23,14 @@ from PIL import Image
 TILESIZES = (8, 16)
 
 
-def export_tset(name, tilesize, img, palette_type, maxtile):
+def export_tset(outfile, tilesize, img, palette_type, maxtile):
     "tsx export to tileset tset file"
 
     src = Image.open(img).convert("RGBA")
     w, h = src.size
 
     nbtiles = min(maxtile, (w // tilesize) * (h // tilesize))
-    print(" - writing", name + ".tset", nbtiles, "tiles", file=sys.stderr)
+    print(" - writing", outfile, nbtiles, "tiles", file=sys.stderr)
 
     if palette_type == "MICRO":
         palette = gen_micro_pal()
@@ -43,7 +43,7 @@ def export_tset(name, tilesize, img, palette_type, maxtile):
 
     pixdata = array.array("HBB"[datacode], data)
 
-    with open(name + ".tset", "wb") as of:
+    with open(outfile, "wb") as of:
         # header
         of.write(struct.pack("BBH", tilesize, datacode, nbtiles))
 
@@ -75,6 +75,7 @@ if __name__ == "__main__":
         choices=(8, 16),
         type=int,
     )
+    parser.add_argument("-o", "--output", help="output file (default : input file with .tset extension)")
     parser.add_argument(
         "-m",
         "--max_tiles",
@@ -113,4 +114,4 @@ if __name__ == "__main__":
     assert tilesize in TILESIZES, "tiles sizes must be 8 or 16 "
     if args.max_tiles:
         maxtile = min(maxtile, args.max_tiles)
-    export_tset(file_name, tilesize, img, args.palette, maxtile)
+    export_tset(args.output or file_name + ".tset", tilesize, img, args.palette, maxtile)
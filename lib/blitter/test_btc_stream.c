@@ -0,0 +1,194 @@
+/* host test of btc4 videos streamed from files
+
+build & run on the host with :
+	gcc -O2 -std=gnu99 -DEMULATOR -DBOARD_BITBOX -DVGA_MODE=320 -DUSE_SDCARD -I../.. -I../../kernel -I../../kernel/fatfs \
+		test_btc_stream.c blitter_btc.c blitter_btc_stream.c ../sampler/sampler.c ../resources/tinyriff.c \
+		../../kernel/fatfs/ff_emu.c ../../kernel/fatfs/disk_stats.c -lm -o test_btc_stream && ./test_btc_stream
+
+A small video of moving boxes over noise is encoded by scripts/btc4.py (run from this
+directory, needs numpy and PIL), with and without key frames. It is played through
+btc4_stream_open / btc4_stream_update on the host file shims (ff_emu.c), a vsync and an
+update per frame, with several sector budgets. Each shown picture must be the one
+btc4_video_apply gives for its frame from the whole file, frames must be late (and dropped
+if the video has key frames) when the budget is too low, and playback must resume on key
+frames after drops.
+*/
+
+#define _POSIX_C_SOURCE 200809L // mkdtemp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "blitter_btc_stream.h"
+
+#define W 96
+#define H 64
+#define NB_FRAMES 36
+#define NB_BLOCKS (W/4*(H/4))
+
+// kernel side
+uint32_t vga_line;
+volatile uint32_t vga_frame;
+#ifdef VGA_SKIPLINE
+volatile int vga_odd;
+#endif
+static pixel_t line_buffer[VGA_H_PIXELS+128];
+pixel_t *draw_buffer = line_buffer+64;
+
+void message (const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+static int errors;
+#define check(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); errors++; } } while (0)
+
+static char dir[] = "/tmp/btcXXXXXX";
+static uint32_t reference[NB_FRAMES][NB_BLOCKS]; // blocks of each frame, from the whole file
+
+static unsigned rnd(void)
+{
+	static uint32_t s = 12345;
+	s = s*1103515245 + 12345;
+	return s>>16;
+}
+
+// frames as ppm files, read by btc4.py with PIL
+static void write_frames(void)
+{
+	static uint8_t rgb[H][W][3];
+	for (int n=0; n<NB_FRAMES; n++) {
+		for (int y=0; y<H; y++)
+			for (int x=0; x<W; x++) {
+				const int box = (unsigned)(x - n*3) % W < 24 && (unsigned)(y - n*2) % H < 20;
+				rgb[y][x][0] = box ? 240 : x*2;
+				rgb[y][x][1] = box ? 40 : y*3;
+				rgb[y][x][2] = box ? 80 : rnd()%256; // noise, changed blocks all over
+			}
+
+		char name[64];
+		snprintf(name, sizeof(name), "%s/f%03d.ppm", dir, n);
+		FILE *f = fopen(name, "wb");
+		fprintf(f, "P6\n%d %d\n255\n", W, H);
+		fwrite(rgb, 1, sizeof(rgb), f);
+		fclose(f);
+	}
+}
+
+// encodes the frames, returns 0 if ok
+static int encode(const char *btv, int key)
+{
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "python3 scripts/btc4.py --video --fps 30 --align 512 --key %d -o %s %s/f*.ppm >/dev/null 2>&1",
+		key, btv, dir);
+	return system(cmd);
+}
+
+// reference pictures, applying all frames of the file in order
+static int decode_reference(const char *btv)
+{
+	FILE *f = fopen(btv, "rb");
+	if (!f)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	rewind(f);
+	uint32_t *file = malloc(size);
+	const int ok = fread(file, 1, size, f) == (size_t)size;
+	fclose(f);
+
+	const struct BTC4Video *v = (const struct BTC4Video *)file;
+	if (!ok || v->magic != BTC4_VIDEO_MAGIC || v->w != W || v->h != H || v->nb_frames != NB_FRAMES) {
+		free(file);
+		return -1;
+	}
+
+	uint32_t blocks[NB_BLOCKS] = {0};
+	for (int n=0; n<NB_FRAMES; n++) {
+		btc4_video_apply(blocks, NB_BLOCKS, (const uint32_t *)((const uint8_t *)v + v->frame_offset[n]));
+		memcpy(reference[n], blocks, sizeof(blocks));
+	}
+	free(file);
+	return 0;
+}
+
+static struct btc4_stream s;
+
+// plays the video with max_sectors per frame, checks pictures. Returns the number of resumes after drops
+static int play(const char *btv, int key, int max_sectors)
+{
+	static uint32_t buf[BTC4_STREAM_BUFSZ(W,H)/4];
+	object o;
+
+	vga_frame = 1000; // not at start of the game
+	if (btc4_stream_open(&s, &o, btv, 0, buf, sizeof(buf))) {
+		check(0, "key %d, %d sectors : open failed", key, max_sectors);
+		return 0;
+	}
+
+	int fr = o.fr, bad = 0, jumps = 0;
+	check(!memcmp(buf+128, reference[0], sizeof(reference[0])), "key %d, %d sectors : first frame differs", key, max_sectors);
+	for (int i=0; i<10*NB_FRAMES && btc4_stream_update(&s, max_sectors); i++) {
+		vga_frame++;
+		o.frame(&o, 0); // vsync, before game_frame
+		if (o.fr == fr)
+			continue;
+		bad += memcmp(buf+128, reference[o.fr], sizeof(reference[0])) != 0;
+		if (o.fr != fr+1) {
+			jumps++;
+			check(key && o.fr % key == 0, "key %d, %d sectors : went from frame %d to %d, not a key frame", key, max_sectors, fr, o.fr);
+		}
+		fr = o.fr;
+	}
+
+	check(!bad, "key %d, %d sectors : %d pictures differ", key, max_sectors, bad);
+	check(fr == NB_FRAMES-1, "key %d, %d sectors : stopped at frame %d", key, max_sectors, fr);
+	check(s.shown + s.dropped == NB_FRAMES, "key %d, %d sectors : %u shown + %u dropped", key, max_sectors, s.shown, s.dropped);
+	printf("key %2d, %2d sectors per frame : %2u shown, %3u late, %2u dropped, %d resumes\n",
+		key, max_sectors, s.shown, s.late, s.dropped, jumps);
+	btc4_stream_close(&s);
+	return jumps;
+}
+
+int main(void)
+{
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return 1;
+	}
+	write_frames();
+
+	FATFS fs;
+	f_mount(&fs, "", 1);
+
+	for (int key=0; key<=6; key+=6) {
+		char btv[64];
+		snprintf(btv, sizeof(btv), "%s/key%d.btv", dir, key);
+		if (encode(btv, key) || decode_reference(btv)) {
+			printf("cannot encode %s with scripts/btc4.py\n", btv);
+			return 1;
+		}
+
+		// enough to show all frames on time (a full frame is 4 sectors, 2 vsyncs per frame)
+		play(btv, key, 16);
+		check(!s.late && !s.dropped, "key %d : late or dropped at full budget", key);
+
+		// 1 sector : much too slow, frames are dropped up to key frames if any
+		const int resumes = play(btv, key, 1);
+		check(s.late, "key %d : not late at 1 sector", key);
+		check(key ? s.dropped && resumes : !s.dropped, "key %d : %u frames dropped, %d resumes at 1 sector", key, s.dropped, resumes);
+	}
+
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "rm -r %s", dir);
+	if (system(cmd))
+		printf("cannot remove %s\n", dir);
+
+	printf("%d errors\n", errors);
+	return errors ? 1 : 0;
+}
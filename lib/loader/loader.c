@@ -0,0 +1,171 @@
+// loader.c : incremental file loader, see loader.h
+
+#include <string.h>
+
+#include "bitbox.h"
+#include "fatfs/ff.h"
+#include "loader.h"
+
+#define SECTOR 512
+
+struct LoadJob {
+	const char *path;
+	uint32_t offset;
+	uint32_t length;  // 0 : to end of file, until the file is opened
+	uint8_t *dest;
+	loader_callback done;
+	uint32_t pos;     // bytes already read
+	uint8_t dropped;  // by loader_cancel, never loaded
+};
+
+// jobs are identified by their number since start, queue[id%LOADER_QUEUE]
+static struct LoadJob queue[LOADER_QUEUE];
+static int head, tail;  // first pending job, next free id
+static int batch_start; // first job queued since the queue was last empty
+static int started;     // first job is opened and positioned
+
+static FIL file;
+static char file_path[80];    // path of the opened file, empty if none
+static DWORD linkmap[LOADER_LINKMAP];
+
+int loader_add(const char *path, uint32_t offset, uint32_t length, void *dest, loader_callback done)
+{
+	if (tail-head >= LOADER_QUEUE)
+		return -1;
+	if (head==tail)
+		batch_start = tail;
+
+	struct LoadJob *j = &queue[tail%LOADER_QUEUE];
+	j->path = path;
+	j->offset = offset;
+	j->length = length;
+	j->dest = dest;
+	j->done = done;
+	j->pos = 0;
+	j->dropped = 0;
+	return tail++;
+}
+
+static void close_file(void)
+{
+	if (file_path[0]) {
+		f_close(&file);
+		file_path[0] = 0;
+	}
+}
+
+static FRESULT open_file(const char *path)
+{
+	if (file_path[0] && !strcmp(file_path, path))
+		return FR_OK;
+	close_file();
+
+	FRESULT res = f_open(&file, path, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK) {
+		message("loader: error %d opening %s\n", res, path);
+		return res;
+	}
+	strncpy(file_path, path, sizeof(file_path)-1);
+
+	// big file : map its clusters once so that seeks don't walk the FAT.
+	// Too fragmented files just go without.
+	if (f_size(&file) > LOADER_FASTSEEK_SIZE) {
+		file.cltbl = linkmap;
+		linkmap[0] = LOADER_LINKMAP;
+		if (f_lseek(&file, CREATE_LINKMAP) != FR_OK)
+			file.cltbl = 0;
+	}
+	return FR_OK;
+}
+
+static void finish(struct LoadJob *j, int res)
+{
+	head++;
+	started = 0;
+	if (head==tail)
+		close_file();
+	if (j->done)
+		j->done(j->dest, j->pos, res);
+}
+
+int loader_pump(int max_sectors)
+{
+	int budget = max_sectors*SECTOR;
+
+	while (head!=tail && budget>0) {
+		struct LoadJob *j = &queue[head%LOADER_QUEUE];
+
+		if (!started) {
+			FRESULT res = open_file(j->path);
+			if (res == FR_OK) {
+				if (!j->length)
+					j->length = j->offset < f_size(&file) ? f_size(&file)-j->offset : 0;
+				res = f_lseek(&file, j->offset);
+			}
+			if (res != FR_OK) {
+				finish(j, res);
+				continue;
+			}
+			started = 1;
+			budget -= SECTOR; // directory and FAT accesses, roughly
+		}
+
+		// read up to a sector boundary, so that whole sectors go directly to dest
+		const uint32_t start = f_tell(&file);
+		uint32_t n = j->length - j->pos;
+		const uint32_t end = start - start%SECTOR + budget;
+		if (n > end-start)
+			n = end-start;
+
+		UINT br;
+		FRESULT res = f_read(&file, j->dest+j->pos, n, &br);
+		j->pos += br;
+		budget -= (start+br+SECTOR-1)/SECTOR*SECTOR - start/SECTOR*SECTOR;
+
+		if (res != FR_OK || br < n || j->pos == j->length)
+			finish(j, res);
+	}
+	return tail-head;
+}
+
+int loader_pending(void)
+{
+	return tail-head;
+}
+
+int loader_progress(void)
+{
+	if (head==tail)
+		return 256;
+
+	int p = (head-batch_start)*256;
+	const struct LoadJob *j = &queue[head%LOADER_QUEUE];
+	if (started && j->length)
+		p += (uint64_t)j->pos*256/j->length;
+	return p/(tail-batch_start);
+}
+
+// slots of the last LOADER_QUEUE jobs still hold them : older ones are reported finished
+static int dropped(int id)
+{
+	return id >= tail-LOADER_QUEUE && queue[id%LOADER_QUEUE].dropped;
+}
+
+int loader_done(int id)
+{
+	return id < head && !dropped(id);
+}
+
+int loader_cancelled(int id)
+{
+	return id < head && dropped(id);
+}
+
+void loader_cancel(void)
+{
+	for (int id=head; id<tail; id++)
+		queue[id%LOADER_QUEUE].dropped = 1;
+	head = tail;
+	started = 0;
+	close_file();
+}
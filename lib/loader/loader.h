@@ -0,0 +1,69 @@
+/* loader : incremental file loading from the SD card, a few sectors per frame.
+
+   Instead of a blocking f_read of whole files, queue load jobs (file, offset, length,
+   destination) and pump the loader each frame with a budget of sectors : the game
+   keeps running (animations, music, ...) while assets arrive. A callback is called
+   when each job is finished.
+
+   Big files get a fatfs cluster link map (_USE_FASTSEEK) so that seeking into them does
+   not follow the FAT chain cluster by cluster.
+
+   Call loader_pump from game_frame, not from graph_vsync : on device vsync is called
+   from the VGA interrupt, in which SD transfers cannot complete.
+
+   Needs USE_SDCARD (fatfs mounted, see f_mount).
+
+   Example :
+
+	static void level_loaded(void *dest, uint32_t len, int res) { ... }
+
+	loader_add("level1.map", 0, 0, map_data, 0);
+	loader_add("level1.spr", 0, 0, sprites, level_loaded);
+	...
+	void game_frame() {
+		loader_pump(16); // 8kB per frame
+		if (loader_pending()) show_progress(loader_progress());
+		...
+	}
+ */
+#pragma once
+#include <stdint.h>
+
+#ifndef LOADER_QUEUE
+#define LOADER_QUEUE 16         // max number of jobs in queue
+#endif
+
+#ifndef LOADER_FASTSEEK_SIZE
+#define LOADER_FASTSEEK_SIZE (64*1024) // create a cluster link map above this file size
+#endif
+
+#ifndef LOADER_LINKMAP
+#define LOADER_LINKMAP 64       // link map size in DWORDs : (LOADER_LINKMAP-1)/2 fragments max
+#endif
+
+// called at end of job with destination, bytes read and fatfs result (FR_OK=0)
+typedef void (*loader_callback)(void *dest, uint32_t len, int res);
+
+// queue a job : load length bytes (0 : up to the end of file) from offset into dest.
+// path is not copied and must stay valid until the job is done.
+// Returns a job id, or -1 if the queue is full.
+int loader_add(const char *path, uint32_t offset, uint32_t length, void *dest, loader_callback done);
+
+// read at most max_sectors sectors for pending jobs. Returns the number of jobs still pending.
+int loader_pump(int max_sectors);
+
+// number of jobs not finished yet
+int loader_pending(void);
+
+// progress of jobs queued since the queue was last empty, 0 to 256
+int loader_progress(void);
+
+// true if job id is finished (loaded, or failed : see its callback). False for dropped jobs.
+int loader_done(int id);
+
+// true if job id was dropped by loader_cancel : its destination was not filled.
+// Jobs are remembered until LOADER_QUEUE newer ones are queued.
+int loader_cancelled(int id);
+
+// drop all pending jobs, without calling their callbacks
+void loader_cancel(void);
@@ -0,0 +1,396 @@
+/* host benchmark of the tinylz4 block decoders
+
+build & run on the host with :
+	gcc -O2 -std=c99 -I../.. bench_lz4.c -o bench_lz4 && ./bench_lz4 [files ...]
+
+Files given on the command line (by example .spr, .tmap, .btc4, .mod assets) are compressed
+with a small built-in LZ4 block compressor, checked against all decoders and timed.
+Without arguments, a synthetic corpus mimicking those asset types is used.
+
+The reference decoder is the previous byte by byte implementation.
+The safe decoder is also fed truncated and corrupted blocks, it must fail cleanly.
+
+The data is also packed in LZ4 frames as the lz4 tool writes them (64k independent blocks,
+with and without content size, block and content checksums, stored blocks) and decoded
+back with struct lz4_stream in small input and output slices, to the whole output and to
+a 64k ring buffer.
+*/
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TINYLZ4_IMPLEMENTATION
+#include "tinylz4.h"
+
+// previous byte by byte decoder, as reference
+static void lz4_block_decompress_ref (const uint8_t * restrict src, uint32_t src_len, uint8_t * restrict dst)
+{
+	const uint8_t *end = src + src_len;
+	do {
+		uint8_t tok = *src++;
+		unsigned len = lz4_extlen(tok>>4,&src,end,0);
+		for (int i=len;i>0;--i)
+			*dst++ = *src++;
+		if (src>=end) break;
+		uint8_t *match = dst - src[0] - (src[1]<<8);
+		src+=2;
+		len=lz4_extlen(tok & 0xf,&src,end,0) + 4;
+		for (int i=len;i>0;--i)
+			*dst++ = *match++;
+	} while (src < end);
+}
+
+// -- minimal greedy LZ4 block compressor
+
+#define HASH_BITS 14
+
+static uint8_t *put_len(uint8_t *out, unsigned len)
+{
+	for (len-=15; len>=255; len-=255)
+		*out++ = 255;
+	*out++ = len;
+	return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *lit, unsigned nlit, unsigned ofs, unsigned mlen)
+{
+	uint8_t *tok = out++;
+	*tok = (nlit<15 ? nlit : 15) << 4;
+	if (nlit>=15) out = put_len(out, nlit);
+	memcpy(out, lit, nlit);
+	out += nlit;
+	if (!mlen)
+		return out;
+
+	*out++ = ofs;
+	*out++ = ofs>>8;
+	mlen -= 4;
+	*tok |= mlen<15 ? mlen : 15;
+	if (mlen>=15) out = put_len(out, mlen);
+	return out;
+}
+
+// returns compressed size, out must hold size + size/255 + 16
+static unsigned lz4_compress(const uint8_t *in, unsigned size, uint8_t *out)
+{
+	static uint32_t table[1<<HASH_BITS];
+	memset(table, 0xff, sizeof(table));
+
+	uint8_t *o = out;
+	unsigned anchor = 0, i = 0;
+
+	// last match must start 12 bytes before the end, last 5 bytes are literals
+	while (size >= 13 && i < size-12) {
+		uint32_t seq = lz4_read32(in+i);
+		uint32_t h = (seq * 2654435761u) >> (32-HASH_BITS);
+		uint32_t cand = table[h];
+		table[h] = i;
+
+		if (cand != 0xffffffff && i-cand <= 65535 && lz4_read32(in+cand) == seq) {
+			unsigned len = 4;
+			while (i+len < size-5 && in[cand+len] == in[i+len])
+				len++;
+			o = put_sequence(o, in+anchor, i-anchor, i-cand, len);
+			i += len;
+			anchor = i;
+		} else {
+			i++;
+		}
+	}
+	o = put_sequence(o, in+anchor, size-anchor, 0, 0);
+	return o-out;
+}
+
+// -- LZ4 frames, as written by lz4 -B4 -BI [--content-size] [-BX]
+
+#define FRAME_BLOCK (64*1024)
+
+enum { FRAME_CSIZE=1, FRAME_CHECKS=2, FRAME_STORED=4 };
+
+static uint8_t *put32(uint8_t *out, uint32_t x)
+{
+	for (int i=0; i<4; i++)
+		*out++ = x>>(8*i);
+	return out;
+}
+
+// xxHash32, for the checksums of the frame : not checked by lz4_stream, but lz4 -d does
+static uint32_t rotl(uint32_t x, int r) { return x<<r | x>>(32-r); }
+
+static uint32_t xxh32(const uint8_t *p, unsigned len)
+{
+	static const uint32_t P1=2654435761u, P2=2246822519u, P3=3266489917u, P4=668265263u, P5=374761393u;
+	const uint8_t *end = p+len;
+	uint32_t h;
+
+	if (len >= 16) {
+		uint32_t v[4] = { P1+P2, P2, 0, -P1 };
+		for (; p+16<=end; p+=16)
+			for (int i=0; i<4; i++)
+				v[i] = rotl(v[i] + lz4_read32(p+4*i)*P2, 13) * P1;
+		h = rotl(v[0],1) + rotl(v[1],7) + rotl(v[2],12) + rotl(v[3],18);
+	} else {
+		h = P5;
+	}
+	h += len;
+	for (; p+4<=end; p+=4)
+		h = rotl(h + lz4_read32(p)*P3, 17) * P4;
+	for (; p<end; p++)
+		h = rotl(h + *p*P5, 11) * P1;
+	h = (h ^ h>>15) * P2;
+	h = (h ^ h>>13) * P3;
+	return h ^ h>>16;
+}
+
+// returns frame size, out must hold size + size/255 + 64 + 8 per block.
+static unsigned lz4_frame(const uint8_t *in, unsigned size, uint8_t *out, int opts)
+{
+	uint8_t *o = put32(out, MAGIC_LZ4);
+	*o++ = 1<<6 | 1<<5 | (opts & FRAME_CHECKS ? 1<<4 | 1<<2 : 0) | (opts & FRAME_CSIZE ? 1<<3 : 0);
+	*o++ = 4<<4; // 64k blocks
+	if (opts & FRAME_CSIZE) {
+		o = put32(o, size);
+		o = put32(o, 0);
+	}
+	*o = xxh32(out+4, o-out-4)>>8; // header checksum
+	o++;
+
+	for (unsigned pos=0, n=0; pos<size; pos+=n) {
+		n = size-pos < FRAME_BLOCK ? size-pos : FRAME_BLOCK;
+		unsigned csize = lz4_compress(in+pos, n, o+4);
+		if (csize >= n || (opts & FRAME_STORED && pos/FRAME_BLOCK%2)) {
+			memcpy(o+4, in+pos, n);
+			csize = n;
+			o = put32(o, n | 1u<<31);
+		} else {
+			o = put32(o, csize);
+		}
+		o += csize;
+		if (opts & FRAME_CHECKS)
+			o = put32(o, xxh32(o-csize, csize));
+	}
+	o = put32(o, 0); // end mark
+	if (opts & FRAME_CHECKS)
+		o = put32(o, xxh32(in, size));
+	return o-out;
+}
+
+// -- synthetic corpus
+
+static unsigned rnd(void)
+{
+	static uint32_t s = 12345;
+	s = s*1103515245 + 12345;
+	return s>>16;
+}
+
+// 8bpp sprite frames : transparent borders and runs of a few colors
+static unsigned gen_spr(uint8_t *p, unsigned size)
+{
+	for (unsigned i=0; i<size; ) {
+		unsigned n = 1 + rnd()%24;
+		uint8_t c = (rnd()%3==0) ? 0 : 16+rnd()%8*8;
+		for (; n-- && i<size; i++)
+			p[i] = c;
+	}
+	return size;
+}
+
+// 16 bit tile indices, repeating rows with variations
+static unsigned gen_tmap(uint8_t *p, unsigned size)
+{
+	uint16_t *t = (uint16_t *)p;
+	for (unsigned i=0; i<size/2; i++)
+		t[i] = (i%256 > 200) ? rnd()%64 : (i>=256 && (i/256)%4) ? t[i-256] : i%7 + 1;
+	return size;
+}
+
+// btc4 blocks : pairs of colors and 16 bit masks, poorly compressible
+static unsigned gen_btc4(uint8_t *p, unsigned size)
+{
+	for (unsigned i=0; i+4<=size; i+=4) {
+		if (i>=64 && rnd()%4==0)
+			memcpy(p+i, p+i-64, 4); // same block as a line of blocks above
+		else {
+			p[i] = rnd()%16; p[i+1] = rnd()%16;
+			p[i+2] = rnd(); p[i+3] = rnd();
+		}
+	}
+	return size;
+}
+
+// module : pattern data then 8 bit samples
+static unsigned gen_mod(uint8_t *p, unsigned size)
+{
+	unsigned i=0;
+	for (; i<size/4; i++)
+		p[i] = (i%16<4) ? rnd()%32 : 0;
+	for (int phase=0; i<size; i++, phase++)
+		p[i] = (phase%64<32 ? phase%32*4 : 127-phase%32*4) + rnd()%3;
+	return size;
+}
+
+// -- bench
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int failures;
+
+// decodes a frame in random slices of input and output budget, in a buffer of data size or
+// a 64k ring read as the data arrives. returns the decoded size or -1.
+static int stream_decode(const uint8_t *frame, unsigned fsize, uint8_t *out, unsigned size, int ring)
+{
+	static uint8_t window[FRAME_BLOCK];
+	struct lz4_stream s;
+	unsigned pos = 0, done = 0; // input used, output read from the ring
+	int res;
+
+	lz4_stream_init(&s, ring ? window : out, ring ? sizeof(window) : size, ring);
+	do {
+		uint32_t used, in_len = 1 + rnd()%97;
+		if (in_len > fsize-pos)
+			in_len = fsize-pos;
+		res = lz4_stream_decode(&s, frame+pos, in_len, &used, 1 + rnd()%600);
+		pos += used;
+		if (ring) {
+			for (; done<s.total && done<size; done++)
+				out[done] = window[done % sizeof(window)];
+			if (s.total > size)
+				return -1;
+		}
+		if (res == LZ4_STREAM_MORE && !used && pos == fsize)
+			return -1; // truncated
+	} while (res == LZ4_STREAM_MORE);
+
+	return res == LZ4_STREAM_DONE && pos == fsize ? (int)s.total : -1;
+}
+
+static void stream_check(const char *name, const uint8_t *data, unsigned size)
+{
+	uint8_t *frame = malloc(size + size/255 + 64 + 8*(size/FRAME_BLOCK+1));
+	uint8_t *out = malloc(size);
+
+	for (int opts=0; opts<8; opts++) {
+		unsigned fsize = lz4_frame(data, size, frame, opts);
+		for (int ring=0; ring<2; ring++) {
+			memset(out, 0, size);
+			if (stream_decode(frame, fsize, out, size, ring) != (int)size || memcmp(out, data, size)) {
+				printf("%s : stream decoder mismatch, frame options %d%s\n", name, opts, ring ? ", ring" : "");
+				failures++;
+			}
+		}
+	}
+
+	// truncated frame is not done, corrupted frames must stay in bounds
+	unsigned fsize = lz4_frame(data, size, frame, FRAME_CSIZE);
+	if (stream_decode(frame, fsize-1, out, size, 0) != -1) {
+		printf("%s : stream decoder accepted a truncated frame\n", name);
+		failures++;
+	}
+	for (int i=0; i<50; i++) {
+		uint8_t *bad = malloc(fsize);
+		memcpy(bad, frame, fsize);
+		bad[rnd()%fsize] = rnd();
+		stream_decode(bad, fsize, out, size, i%2); // must not crash (try with -fsanitize=address)
+		free(bad);
+	}
+
+	free(frame);
+	free(out);
+}
+
+static void bench(const char *name, const uint8_t *data, unsigned size)
+{
+	uint8_t *comp = malloc(size + size/255 + 16);
+	uint8_t *out = malloc(size); // exact size, to catch overruns with -fsanitize=address
+	unsigned csize = lz4_compress(data, size, comp);
+
+	// check
+	memset(out, 0, size);
+	lz4_block_decompress_ref(comp, csize, out);
+	if (memcmp(out, data, size)) { printf("%s : reference decoder mismatch\n", name); failures++; }
+	memset(out, 0, size);
+	lz4_block_decompress(comp, csize, out);
+	if (memcmp(out, data, size)) { printf("%s : decoder mismatch\n", name); failures++; }
+	memset(out, 0, size);
+	if (lz4_block_decompress_safe(comp, csize, out, size) != (int)size || memcmp(out, data, size)) {
+		printf("%s : safe decoder mismatch\n", name);
+		failures++;
+	}
+
+	// malformed input must be rejected or stay in bounds
+	if (lz4_block_decompress_safe(comp, csize, out, size-1) != -1) {
+		printf("%s : safe decoder accepted a small destination\n", name);
+		failures++;
+	}
+	for (int i=0; i<200; i++) {
+		uint8_t *bad = malloc(csize);
+		memcpy(bad, comp, csize);
+		bad[rnd()%csize] = rnd();
+		unsigned len = rnd()%2 ? csize : rnd()%csize;
+		uint8_t *o = malloc(size);
+		lz4_block_decompress_safe(bad, len, o, size); // must not crash (try with -fsanitize=address)
+		free(o);
+		free(bad);
+	}
+
+	// time
+	int rounds = 1 + (64<<20) / size;
+	double t_ref, t_fast, t_safe, t;
+
+	t = now();
+	for (int r=0; r<rounds; r++) lz4_block_decompress_ref(comp, csize, out);
+	t_ref = now()-t;
+	t = now();
+	for (int r=0; r<rounds; r++) lz4_block_decompress(comp, csize, out);
+	t_fast = now()-t;
+	t = now();
+	for (int r=0; r<rounds; r++) lz4_block_decompress_safe(comp, csize, out, size);
+	t_safe = now()-t;
+
+	const double mb = (double)size*rounds/(1<<20);
+	printf("%-16.16s %8u %8u %5.1f%% %9.0f %9.0f %9.0f   x%.2f\n", name, size, csize, 100.*csize/size,
+		mb/t_ref, mb/t_fast, mb/t_safe, t_ref/t_fast);
+
+	free(comp);
+	free(out);
+
+	stream_check(name, data, size);
+}
+
+int main(int argc, char **argv)
+{
+	printf("%-16s %8s %8s %6s %9s %9s %9s\n", "file", "size", "lz4", "ratio", "ref MB/s", "fast MB/s", "safe MB/s");
+
+	if (argc>1) {
+		for (int i=1; i<argc; i++) {
+			FILE *f = fopen(argv[i], "rb");
+			if (!f) { perror(argv[i]); continue; }
+			fseek(f, 0, SEEK_END);
+			long size = ftell(f);
+			rewind(f);
+			uint8_t *data = malloc(size);
+			if (fread(data, 1, size, f) == (size_t)size && size > 0)
+				bench(argv[i], data, size);
+			fclose(f);
+			free(data);
+		}
+	} else {
+		static uint8_t data[256*1024];
+		bench("synthetic.spr", data, gen_spr(data, sizeof(data)));
+		bench("synthetic.tmap", data, gen_tmap(data, 64*1024));
+		bench("synthetic.btc4", data, gen_btc4(data, sizeof(data)));
+		bench("synthetic.mod", data, gen_mod(data, 128*1024));
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+'''
+Packs a file into independently LZ4 compressed blocks with an index (.lz4b),
+for random access at runtime with tinylz4blocks.h
+
+Format, little endian :
+    'LZ4B' u32 block_size u32 total_size u32 nb_blocks
+    u32 offsets[nb_blocks+1]   compressed block i is data[offsets[i]:offsets[i+1]]
+    data                       offsets are relative to the start of data
+A block whose compressed size equals its decoded size is stored raw.
+
+Also usable as a module : compress(data) returns a LZ4 block (without frame),
+using the lz4 python package if available, or a simple built-in compressor.
+'''
+
+import sys
+import struct
+import argparse
+
+MINMATCH = 4
+MAXOFS = 65535
+HASH_LOG = 16
+
+
+def _put_len(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _sequence(out, lit, ofs, mlen):
+    nlit = len(lit)
+    tok = min(nlit, 15) << 4
+    if mlen:
+        tok |= min(mlen - MINMATCH, 15)
+    out.append(tok)
+    if nlit >= 15:
+        _put_len(out, nlit - 15)
+    out += lit
+    if mlen:
+        out += struct.pack('<H', ofs)
+        if mlen - MINMATCH >= 15:
+            _put_len(out, mlen - MINMATCH - 15)
+
+
+def compress_builtin(data):
+    "greedy LZ4 block compressor, slow but valid output"
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = i = 0
+    # last match must start 12 bytes before the end, last 5 bytes are literals
+    while i < n - 12:
+        key = data[i:i + 4]
+        cand = table.get(key, -1)
+        table[key] = i
+        if cand >= 0 and i - cand <= MAXOFS:
+            m = 4
+            while i + m < n - 5 and data[cand + m] == data[i + m]:
+                m += 1
+            _sequence(out, data[anchor:i], i - cand, m)
+            i += m
+            anchor = i
+        else:
+            i += 1
+    _sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+try:
+    import lz4.block
+
+    def compress(data):
+        return lz4.block.compress(data, mode='high_compression', store_size=False)
+except ImportError:
+    compress = compress_builtin
+
+
+def pack(data, block_size):
+    "returns .lz4b container bytes"
+    blocks = []
+    for pos in range(0, len(data), block_size):
+        raw = data[pos:pos + block_size]
+        comp = compress(raw)
+        blocks.append(comp if len(comp) < len(raw) else raw)
+
+    offsets = [0]
+    for b in blocks:
+        offsets.append(offsets[-1] + len(b))
+
+    header = b'LZ4B' + struct.pack('<III', block_size, len(data), len(blocks))
+    return header + struct.pack('<%dI' % len(offsets), *offsets) + b''.join(blocks)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('file', help='file to pack')
+    parser.add_argument('-o', '--output', help='output file (default : file.lz4b)')
+    parser.add_argument('-b', '--block-size', type=int, default=4096,
+                        help='decoded block size (default 4096). Should be a multiple of your access unit (tilemap line, video frame ...)')
+    args = parser.parse_args()
+
+    data = open(args.file, 'rb').read()
+    packed = pack(data, args.block_size)
+    open(args.output or args.file + '.lz4b', 'wb').write(packed)
+    print('%s : %d bytes -> %d bytes (%d%%), %d blocks of %d' % (
+        args.file, len(data), len(packed), len(packed) * 100 // max(len(data), 1),
+        (len(data) + args.block_size - 1) // args.block_size, args.block_size), file=sys.stderr)
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+'''
+Packs asset files into one indexed resource pack (.pak), read at runtime with tinypack.h
+
+Unlike embed.py, nothing is compiled : the pack is linked as one binary blob
+(see --incbin), loaded from the SD card or mmap'ed by the emulator.
+Changing an asset only rewrites the pack.
+
+Format, little endian, entries aligned to --align bytes from the start of the pack :
+    'RPAK' u32 nb_slots u32 nb_entries u32 align
+    slots[nb_slots]   : u32 hash, u32 offset, u32 size, u32 stored_size | codec<<24
+                        hash table of FNV-1a hashes of names, linear probing, hash 0 is empty
+    data
+codec 0 is raw, 1 is a LZ4 block (size is the decoded size).
+'''
+
+import sys
+import os
+import struct
+import argparse
+
+MAGIC = b'RPAK'
+CODEC_RAW = 0
+CODEC_LZ4 = 1
+SLOT = struct.Struct('<IIII')
+
+
+def name_hash(name):
+    "FNV-1a of the name, never 0 (same as pack_hash)"
+    h = 2166136261
+    for c in name.encode('utf8'):
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h or 1
+
+
+def pack(entries, align=4, lz4=False):
+    '''entries : list of (name, data). Returns pack bytes and a list of
+    (name, offset, size, stored, codec) for reports'''
+    if lz4:
+        from lz4blocks import compress
+
+    nb_slots = 8
+    while nb_slots < 2 * len(entries):
+        nb_slots *= 2
+
+    slots = [None] * nb_slots
+    hashes = {}
+    for name, _ in entries:
+        h = name_hash(name)
+        if h in hashes:
+            raise ValueError('%s and %s : same name hash, rename one of them' % (hashes[h], name))
+        hashes[h] = name
+
+    def aligned(n):
+        return (n + align - 1) // align * align
+
+    out = bytearray(aligned(16 + nb_slots * SLOT.size))
+    listing = []
+    for name, data in entries:
+        stored, codec = data, CODEC_RAW
+        if lz4 and data:
+            comp = compress(data)
+            if len(comp) < len(data):
+                stored, codec = comp, CODEC_LZ4
+        if len(stored) >= 1 << 24:
+            raise ValueError('%s : too big for a pack entry' % name)
+
+        offset = len(out)
+        out += stored
+        out += bytes(aligned(len(out)) - len(out))
+
+        h = name_hash(name)
+        i = h & (nb_slots - 1)
+        while slots[i]:
+            i = (i + 1) & (nb_slots - 1)
+        slots[i] = (h, offset, len(data), len(stored) | codec << 24)
+        listing.append((name, offset, len(data), len(stored), codec))
+
+    out[0:16] = MAGIC + struct.pack('<III', nb_slots, len(entries), align)
+    for i, s in enumerate(slots):
+        SLOT.pack_into(out, 16 + i * SLOT.size, *(s or (0, 0, 0, 0)))
+    return bytes(out), listing
+
+
+INCBIN = '''/* file autogenerated by %(script)s, do not edit.
+   links %(path)s as a read-only blob, use with :
+	extern const uint8_t %(symbol)s[];
+	pack_open(&pack, %(symbol)s);
+*/
+#ifdef __APPLE__
+__asm__(".const_data\\n.globl _%(symbol)s\\n.p2align 4\\n_%(symbol)s:\\n.incbin \\"%(path)s\\"\\n");
+#else
+__asm__(".section .rodata\\n.global %(symbol)s\\n.balign 16\\n%(symbol)s:\\n.incbin \\"%(path)s\\"\\n.previous\\n");
+#endif
+'''
+
+
+def write_if_changed(filename, data):
+    "keeps the file date when the content is the same, so make doesn't relink"
+    if os.path.exists(filename) and open(filename, 'rb').read() == data:
+        return False
+    open(filename, 'wb').write(data)
+    return True
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('files', nargs='+', metavar='file', help='files to pack. optionally set file:name to use another entry name (default : file basename)')
+    parser.add_argument('-o', '--output', required=True, help='pack file to write')
+    parser.add_argument('-a', '--align', type=int, default=4, help='entries alignment (default 4). Use 512 to read entries from SD by whole sectors')
+    parser.add_argument('-z', '--lz4', action='store_true', help='LZ4 compress entries, when it makes them smaller')
+    parser.add_argument('--incbin', metavar='FILE.c', help='also write a C file linking the pack as a blob')
+    parser.add_argument('--symbol', default='pack_data', help='symbol of the linked blob (default pack_data)')
+    parser.add_argument('-v', '--verbose', action='store_true', help='list entries')
+    args = parser.parse_args()
+
+    entries = []
+    for f in args.files:
+        path, name = f.split(':', 1) if ':' in f else (f, os.path.basename(f))
+        entries.append((name, open(path, 'rb').read()))
+
+    sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+    data, listing = pack(entries, args.align, args.lz4)
+    changed = write_if_changed(args.output, data)
+
+    if args.incbin:
+        write_if_changed(args.incbin, (INCBIN % dict(script=os.path.basename(sys.argv[0]),
+            path=args.output, symbol=args.symbol)).encode())
+
+    if args.verbose:
+        for name, offset, size, stored, codec in listing:
+            print('%08x %8d %8d %s %s' % (offset, size, stored, 'lz4' if codec else '   ', name), file=sys.stderr)
+    print('%s : %d entries, %d bytes%s' % (args.output, len(entries), len(data), '' if changed else ' (unchanged)'), file=sys.stderr)
@@ -1,43 +1,287 @@
-#include <stdint.h>
-#include <stdio.h>
-
-#define die(a,b) return;
-#define message printf
-
-void t_print_stack(); // debug
-
-#define IMPLEMENTATION_TINYMALLOC
-#include "tinymalloc.h"
-
-int main(void)
-{
-
-	char a[32],b[200],c[3000]; // mem is made of 3 chunks
-
-	t_malloc(100); // die 
-
-	t_print_stack();
-
-	t_addchunk(&a,sizeof(a));
-	t_print_stack();
-	t_addchunk(&b,sizeof(b));
-	t_print_stack();
-	t_addchunk(&c,sizeof(c));
-	t_print_stack();
-
-	void *p1=t_malloc(50);
-	t_print_stack();
-	void *p2=t_malloc(1000);
-	t_print_stack();
-	void *p3=t_malloc(150);
-	t_print_stack();
-
-	t_free(p2);p2=0;
-	p2=t_malloc(2000);
-	t_free(p3);p3=0;
-	t_print_stack();
-	p2=t_malloc(2000);
-	t_free(p2);p2=0;
-	t_free(p1);p2=0;
-	t_print_stack();
-}
+/* test and stress benchmark of tinymalloc, on the host
+
+build & run with :
+	gcc -O2 -std=gnu99 -DEMULATOR -DBOARD_BITBOX -I../../kernel test_malloc.c -o test_malloc && ./test_malloc
+
+The stress test replays levels being loaded and unloaded in a device sized heap : a few
+persistent allocations, level assets of various sizes, game objects allocated and freed
+while playing, then the level freed in random order (some assets shared with the next level).
+Block contents and the heap structure are checked all along.
+*/
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TINYMALLOC_IMPLEMENTATION
+#include "tinymalloc.h"
+
+void message(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+static int errors;
+#define check(cond, ...) do { if (!(cond)) { printf(__VA_ARGS__); printf("\n"); errors++; } } while (0)
+
+// walks all blocks and free lists, checks flags, links and statistics
+static void check_heap(void)
+{
+	unsigned int used=0, nb_used=0, nb_free=0;
+
+	for (int i=0; i<nb_chunks; i++) {
+		int prev_free = 0;
+		Block *prev = 0;
+		for (Block *b = chunks[i]; ; b = t_next_phys(b)) {
+			check(!((uintptr_t)b & (T_ALIGN-1)), "block %p misaligned", b);
+			check(!!(b->size & T_PREV_FREE) == prev_free, "block %p bad prev free flag", b);
+			if (prev_free)
+				check(b->prev_phys == prev, "block %p bad prev_phys", b);
+			if (!T_SIZE(b))
+				break;
+			if (b->size & T_FREE) {
+				check(!prev_free, "block %p : two free neighbours", b);
+				nb_free++;
+			} else {
+				used += T_HEADER + T_SIZE(b);
+				nb_used++;
+			}
+			prev_free = b->size & T_FREE;
+			prev = b;
+		}
+	}
+
+	unsigned int in_lists = 0;
+	for (int fl=0; fl<T_FL_COUNT; fl++) {
+		check(!!(fl_bitmap & 1u<<fl) == !!sl_bitmap[fl], "fl bitmap %d", fl);
+		for (int sl=0; sl<1<<T_SL_LOG; sl++) {
+			check(!!(sl_bitmap[fl] & 1u<<sl) == !!free_lists[fl][sl], "sl bitmap %d %d", fl, sl);
+			for (Block *b = free_lists[fl][sl]; b; b = b->next_free) {
+				int f, s;
+				t_mapping(T_SIZE(b), &f, &s);
+				check(f==fl && s==sl && (b->size & T_FREE), "block %p in wrong list", b);
+				in_lists++;
+			}
+		}
+	}
+
+	check(in_lists == nb_free, "%u free blocks, %u in lists", nb_free, in_lists);
+	check(used == stats.used && nb_used == stats.nb_blocks, "stats used %u/%u, counted %u/%u",
+		stats.used, stats.nb_blocks, used, nb_used);
+}
+
+// simple scenario : small chunks, printing the heap
+static void test_basic(void)
+{
+	static uint64_t a[4], b[25], c[375]; // mem is made of 3 chunks
+
+	void *p0 = t_malloc(100); // no memory yet
+	check(!p0, "malloc without memory");
+
+	t_addchunk(a, sizeof(a));
+	t_addchunk(b, sizeof(b));
+	t_addchunk(c, sizeof(c));
+	t_print_stack();
+
+	void *p1=t_malloc(50);
+	void *p2=t_malloc(1000);
+	void *p3=t_malloc(150);
+	t_print_stack();
+	check_heap();
+
+	t_free(p2);
+	p2=t_malloc(2000); // p3 is in the way
+	check(!p2, "malloc 2000 across a used block");
+	t_free(p3);
+	p2=t_malloc(2000);
+	check(p2, "malloc 2000 after merging");
+	t_print_stack();
+	check_heap();
+
+	t_free(p2);
+	t_free(p1);
+	t_free(p1); // reported, ignored
+	t_print_stack();
+	check_heap();
+	check(stats.used == 0, "everything freed but %u used", stats.used);
+}
+
+// -- stress
+
+#define HEAP_SIZE (128*1024)
+#define MAX_ALLOCS 2048
+
+struct Alloc {
+	uint8_t *p;
+	unsigned int size;
+	uint8_t tag;
+	uint8_t kind;
+};
+
+enum { PERSISTENT, ASSET, SHARED, OBJECT };
+
+static struct Alloc allocs[MAX_ALLOCS];
+static int nb_allocs;
+static unsigned long nb_ops;
+static int checking;  // fill and check blocks, check heap. Off to time the allocator only
+
+static unsigned rnd(void)
+{
+	static uint32_t s = 12345;
+	s = s*1103515245 + 12345;
+	return s>>16;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int do_alloc(unsigned int size, int kind)
+{
+	if (nb_allocs == MAX_ALLOCS)
+		return 0;
+	uint8_t *p = t_malloc(size);
+	nb_ops++;
+	if (!p)
+		return 0;
+
+	struct Alloc *a = &allocs[nb_allocs++];
+	*a = (struct Alloc){.p=p, .size=size, .tag=rnd(), .kind=kind};
+	if (checking) {
+		check(!((uintptr_t)p & (T_ALIGN-1)), "unaligned %p", p);
+		memset(p, a->tag, size);
+	}
+	return 1;
+}
+
+static void do_free(int i)
+{
+	struct Alloc *a = &allocs[i];
+	for (unsigned int j=0; checking && j<a->size; j++)
+		if (a->p[j] != a->tag) {
+			check(0, "block %p (%u bytes) overwritten at %u", a->p, a->size, j);
+			break;
+		}
+	t_free(a->p);
+	nb_ops++;
+	allocs[i] = allocs[--nb_allocs];
+}
+
+static void free_kind(int kind, int keep_percent)
+{
+	for (int i=nb_allocs-1; i>=0; i--)
+		if (allocs[i].kind == kind && (int)(rnd()%100) >= keep_percent)
+			do_free(i);
+}
+
+static unsigned asset_size(void)
+{
+	switch (rnd()%8) {
+		case 0 : return 8192 + rnd()%8192;  // tilemap, tileset
+		case 1 :
+		case 2 : return 2048 + rnd()%14336; // sample
+		default : return 256 + rnd()%3840;  // sprite
+	}
+}
+
+static void test_stress(void)
+{
+	static uint64_t heap[HEAP_SIZE/8];
+	t_addchunk(heap, sizeof(heap));
+	nb_ops = 0;
+
+	for (int i=0; i<8; i++)
+		do_alloc(16 + rnd()%512, PERSISTENT); // font, player, ...
+
+	if (checking)
+		printf("\nlevel  assets  fails    used    peak largest frag%%\n");
+	struct t_stats st;
+	int asset_fails = 0, nb_objects = 0;
+
+	for (int level=0; level<64; level++) {
+		// load : assets until ~70% of the heap is used
+		int nb_assets = 0, fails = 0;
+		while (stats.used < HEAP_SIZE*7/10 && fails < 4) {
+			if (do_alloc(asset_size(), rnd()%4 ? ASSET : SHARED))
+				nb_assets++;
+			else
+				fails++;
+		}
+		asset_fails += fails;
+
+		// play : game objects come and go, up to a few hundreds
+		for (int frame=0; frame<600; frame++) {
+			for (int n=rnd()%4; n && nb_objects<300; n--)
+				nb_objects += do_alloc(16 + rnd()%240, OBJECT);
+			for (int n=rnd()%4, tries=16; n && nb_objects && tries; tries--) {
+				int i = rnd()%nb_allocs;
+				if (allocs[i].kind == OBJECT) {
+					do_free(i);
+					nb_objects--;
+					n--;
+				}
+			}
+		}
+		if (checking)
+			check_heap();
+
+		// unload : level objects and assets, half of shared assets stay for next level
+		free_kind(OBJECT, 0);
+		nb_objects = 0;
+		free_kind(ASSET, 0);
+		free_kind(SHARED, 50);
+		if (checking)
+			check_heap();
+
+		t_stats(&st);
+		if (checking && (level%8==0 || level==63))
+			printf("%5d %7d %6d %7u %7u %7u %4d\n", level, nb_assets, fails, st.used, st.peak, st.largest, st.fragmentation);
+	}
+
+	free_kind(SHARED, 0);
+	free_kind(PERSISTENT, 0);
+	check_heap();
+	t_stats(&st);
+	check(st.used == 0 && st.largest + T_HEADER == st.total, "heap not back to one block");
+	if (checking)
+		printf("%lu malloc/free, %d failed asset loads\n", nb_ops, asset_fails);
+}
+
+static void reset_heap(void)
+{
+	memset(free_lists, 0, sizeof(free_lists));
+	memset(sl_bitmap, 0, sizeof(sl_bitmap));
+	fl_bitmap = 0;
+	nb_chunks = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+int main(void)
+{
+	test_basic();
+
+	reset_heap();
+	checking = 1;
+	test_stress();
+
+	// same again, timed
+	reset_heap();
+	checking = 0;
+	const double t = now();
+	test_stress();
+	printf("%.0f ns per malloc/free\n", (now()-t)*1e9/nb_ops);
+
+	printf(errors ? "%d ERRORS\n" : "OK\n", errors);
+	return errors ? 1 : 0;
+}
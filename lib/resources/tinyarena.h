@@ -0,0 +1,193 @@
+/* tiny arena : bump pointer allocators for data with obvious lifetimes
+
+   An arena is a region of memory allocated from by moving a pointer : no header, no free.
+   Memory is given back all at once with arena_reset, or back to a mark taken before
+   with arena_release. Level data goes in a level arena reset at each level transition,
+   instead of freeing each block.
+
+   A frame arena is reset automatically on its first allocation of each new video frame
+   (vga_frame), for temporary buffers (sort buffers, ...) : memory allocated from it is only
+   valid until the end of the frame. If game_frame can run late, past several video frames,
+   call arena_new_frame at its start instead and reset it explicitly.
+
+   Memory comes from a static region (CCM is fine, but not for buffers read from SD by DMA)
+   or is carved from tinymalloc chunks.
+
+   Overflows are reported with message() and make arena_alloc return 0,
+   or die if ARENA_DIE_ON_OVERFLOW is defined to 1.
+
+   NOTE: This is a single file library. Include it and define TINYARENA_IMPLEMENTATION
+   before including it in exactly one file (tinymalloc.h must be implemented somewhere).
+
+   Example :
+
+	static uint8_t scratch_mem[8*1024] CCM_MEMORY; // bitbox.h : .ccm section on device
+	struct arena level, scratch;
+
+	arena_init_heap(&level, "level", 64*1024);
+	arena_init_frame(&scratch, "scratch", scratch_mem, sizeof(scratch_mem));
+
+	void load_level(int n) {
+		arena_reset(&level);
+		tilemap = arena_alloc(&level, w*h*2);
+		...
+	}
+	void game_frame() {
+		uint16_t *order = arena_alloc(&scratch, nb_objects*2); // gone next frame
+		...
+	}
+ */
+#pragma once
+#include <stdint.h>
+
+#ifndef ARENA_DIE_ON_OVERFLOW
+#define ARENA_DIE_ON_OVERFLOW 0
+#endif
+
+#define ARENA_ALIGN 8
+
+struct arena {
+	const char *name;   // for diagnostics
+	uint8_t *base;
+	uint32_t size;
+	uint32_t pos;       // next free byte
+	uint32_t peak;      // high water mark of pos
+	uint32_t overflows; // failed allocations
+	uint32_t frame;     // frame arenas : frame of the last reset
+	uint8_t per_frame;  // reset at first allocation of each frame
+	uint8_t from_heap;  // base was allocated with t_malloc
+};
+
+typedef uint32_t arena_mark;
+
+// arena on a static region. size is rounded down to ARENA_ALIGN
+void arena_init (struct arena *a, const char *name, void *mem, uint32_t size);
+
+// frame arena on a static region
+void arena_init_frame (struct arena *a, const char *name, void *mem, uint32_t size);
+
+// arena carved from tinymalloc. Returns 0, or -1 (and an empty arena) if out of memory
+int arena_init_heap (struct arena *a, const char *name, uint32_t size);
+
+// gives heap memory back to tinymalloc. The arena is empty afterwards
+void arena_destroy (struct arena *a);
+
+// size bytes, ARENA_ALIGN aligned. 0 on overflow
+void *arena_alloc (struct arena *a, uint32_t size) __attribute__( (warn_unused_result) );
+
+// same, zeroed
+void *arena_calloc (struct arena *a, uint32_t size) __attribute__( (warn_unused_result) );
+
+static inline arena_mark arena_get_mark (const struct arena *a) { return a->pos; }
+
+// frees everything allocated since mark was taken
+void arena_release (struct arena *a, arena_mark mark);
+
+// frees everything
+static inline void arena_reset (struct arena *a) { a->pos = 0; }
+
+// start a new frame for a frame arena, see above
+void arena_new_frame (struct arena *a);
+
+static inline uint32_t arena_available (const struct arena *a) { return a->size - a->pos; }
+
+// prints name, use, peak and overflows
+void arena_print (const struct arena *a);
+
+// ----- IMPLEMENTATION -----------------------------------------------------------------------------------
+
+#ifdef TINYARENA_IMPLEMENTATION
+#include <string.h>
+#include <bitbox.h>
+#include "lib/resources/tinymalloc.h"
+
+void arena_init (struct arena *a, const char *name, void *mem, uint32_t size)
+{
+	// align start, then size
+	const uint32_t skip = -(uintptr_t)mem & (ARENA_ALIGN-1);
+	size = size > skip ? (size-skip) & ~(ARENA_ALIGN-1) : 0;
+
+	*a = (struct arena) {
+		.name = name,
+		.base = (uint8_t *)mem + skip,
+		.size = size,
+	};
+}
+
+void arena_init_frame (struct arena *a, const char *name, void *mem, uint32_t size)
+{
+	arena_init(a, name, mem, size);
+	a->per_frame = 1;
+	a->frame = vga_frame;
+}
+
+int arena_init_heap (struct arena *a, const char *name, uint32_t size)
+{
+	void *mem = t_malloc(size);
+	if (!mem) {
+		message("arena %s: cannot allocate %u bytes\n", name, size);
+		arena_init(a, name, 0, 0);
+		return -1;
+	}
+	arena_init(a, name, mem, size);
+	a->from_heap = 1;
+	return 0;
+}
+
+void arena_destroy (struct arena *a)
+{
+	if (a->from_heap)
+		t_free(a->base);
+	arena_init(a, a->name, 0, 0);
+}
+
+void *arena_alloc (struct arena *a, uint32_t size)
+{
+	if (a->per_frame && a->frame != vga_frame)
+		arena_new_frame(a);
+
+	const uint32_t asked = (size + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+	if (asked < size || asked > a->size - a->pos) {
+		a->overflows++;
+		message("arena %s: overflow, %u bytes asked, %u/%u used\n", a->name, size, a->pos, a->size);
+		if (ARENA_DIE_ON_OVERFLOW)
+			bitbox_die(3,4);
+		return 0;
+	}
+
+	void *p = a->base + a->pos;
+	a->pos += asked;
+	if (a->pos > a->peak)
+		a->peak = a->pos;
+	return p;
+}
+
+void *arena_calloc (struct arena *a, uint32_t size)
+{
+	void *p = arena_alloc(a, size);
+	if (p)
+		memset(p, 0, size);
+	return p;
+}
+
+void arena_release (struct arena *a, arena_mark mark)
+{
+	if (mark > a->pos) {
+		message("arena %s: release to %u, past current position %u\n", a->name, mark, a->pos);
+		return;
+	}
+	a->pos = mark;
+}
+
+void arena_new_frame (struct arena *a)
+{
+	a->pos = 0;
+	a->frame = vga_frame;
+}
+
+void arena_print (const struct arena *a)
+{
+	message("arena %s: %u/%u used, peak %u, %u overflows\n", a->name, a->pos, a->size, a->peak, a->overflows);
+}
+
+#endif // TINYARENA_IMPLEMENTATION
@@ -2,20 +2,69 @@
 
 define LZ4_IMPLEMENTATION exactly once in a .c file.
 
-define LZ4_STREAM to allow stream files decompression 
+define LZ4_STREAM to allow stream files decompression in one call (lz4_stream_decompress)
     NOTE : this needs tinymalloc to be implemented.
 
 compress your files with: lz4 -f -9 --content-size --no-frame-crc --no-sparse <src> <dst>
 
+To decompress a frame in slices (a bit each frame, from data arriving from the SD card, ...)
+use a struct lz4_stream : it handles multi-block frames, stops when the given input is used
+or after a budget of output bytes, and writes to a caller buffer, either the whole
+output or a ring buffer (window) read by the caller as data arrives.
+
+lz4_block_decompress trusts its input (data linked in flash by example).
+For data read from the SD card, which can be corrupted, use lz4_block_decompress_safe :
+it never reads outside src nor writes outside dst, and returns -1 on malformed data.
+
+see bench_lz4.c for a host benchmark of the decoders.
 */
 
+#pragma once
 #include <stdint.h>
+#include <string.h>
 
 void lz4_block_decompress  (const uint8_t * restrict src, uint32_t src_size, uint8_t * restrict dst);
 
+// returns decompressed size or -1 if src is malformed or dst too small.
+int  lz4_block_decompress_safe (const uint8_t * restrict src, uint32_t src_size, uint8_t * restrict dst, uint32_t dst_size);
+
+#define MAGIC_LZ4 0x184D2204
+
+// -- resumable frame decoder
+
+#define LZ4_STREAM_MORE   0 // needs more input or output budget
+#define LZ4_STREAM_DONE   1 // end of frame
+#define LZ4_STREAM_ERROR -1 // malformed frame, or output does not fit
+
+struct lz4_stream {
+    uint8_t *out;          // output buffer, or window if ring
+    uint32_t out_size;
+    uint32_t out_pos;      // write position in out
+    uint32_t total;        // bytes decoded so far
+    uint32_t content_size; // from frame header if present, else 0
+    uint8_t ring;          // out is a ring buffer
+
+    // decoder state
+    uint8_t state, flags, tok, nb;
+    uint32_t acc;          // multi byte fields
+    uint32_t block_left;   // input bytes left in current block
+    uint32_t len;          // literals or match bytes left
+    uint32_t ofs;          // match offset
+};
+
+// out can be the whole output (ring=0), or a ring buffer of out_size bytes (ring=1) : then
+// output byte i is at out[i % out_size], and out_size must be at least the maximum match
+// offset in the data : 64k in general, or the block size for frames of independent blocks
+// (compress with lz4 -B4 -BI, not -BD). The caller limits max_out to what it has consumed.
+void lz4_stream_init (struct lz4_stream *s, uint8_t *out, uint32_t out_size, int ring);
+
+// decode from in_len bytes of input, producing at most max_out bytes.
+// *in_used is set to the input bytes consumed, s->total is updated.
+// Returns LZ4_STREAM_MORE, LZ4_STREAM_DONE or LZ4_STREAM_ERROR.
+int lz4_stream_decode (struct lz4_stream *s, const uint8_t *in, uint32_t in_len, uint32_t *in_used, uint32_t max_out);
+
 #ifdef LZ4_STREAM
-// note that lz4 encoded files MUST use --content-size --no-frame-crc encoding options. 
-#define MAGIC_LZ4 0x184D2204 
+// note that lz4 encoded files MUST use --content-size encoding option.
 void *lz4_stream_decompress (const uint8_t * restrict src);
 #endif
 
@@ -25,13 +74,14 @@ void *lz4_stream_decompress (const uint8_t * restrict src);
 // ref. is see frame format https://cyan4973.github.io/lz4/lz4_Frame_format.md
 
 // complete len already loaded with 0-15 first value
-static unsigned lz4_extlen(unsigned len, const uint8_t * restrict *src)
+// safe version stops at end (returns a huge length, caught by the caller checks)
+static inline unsigned lz4_extlen(unsigned len, const uint8_t * restrict *src, const uint8_t *end, int safe)
 {
-    if (!len) 
-        return 0;
     if (len==0xf) { // there is more
         uint8_t b;
         do {
+            if (safe && *src>=end)
+                return 0xffffffff;
             b=**src;
             (*src)++;
             len +=b;
@@ -40,32 +90,337 @@ static unsigned lz4_extlen(unsigned len, const uint8_t * restrict *src)
     return len;
 }
 
-// lz4 block decoder
-void lz4_block_decompress (const uint8_t * restrict src, uint32_t src_len, uint8_t * restrict dst)
+// unaligned word access, compiles to single loads/stores on cortex-M4 and x86
+static inline uint32_t lz4_read32(const uint8_t *p) { uint32_t v; memcpy(&v,p,4); return v; }
+static inline void lz4_write32(uint8_t *p, uint32_t v) { memcpy(p,&v,4); }
+
+static inline void lz4_copy16(uint8_t *dst, const uint8_t *src)
+{
+    lz4_write32(dst, lz4_read32(src));
+    lz4_write32(dst+4, lz4_read32(src+4));
+    lz4_write32(dst+8, lz4_read32(src+8));
+    lz4_write32(dst+12, lz4_read32(src+12));
+}
+
+// copy len bytes forward by words. src can overlap dst if it is at least 4 bytes before.
+static inline void lz4_copy(uint8_t *dst, const uint8_t *src, unsigned len)
+{
+    for (;len>=8;len-=8, dst+=8, src+=8) {
+        lz4_write32(dst, lz4_read32(src));
+        lz4_write32(dst+4, lz4_read32(src+4));
+    }
+    if (len>=4) {
+        lz4_write32(dst, lz4_read32(src));
+        len-=4; dst+=4; src+=4;
+    }
+    while (len--)
+        *dst++ = *src++;
+}
+
+// lz4 block decoder, checks input and output bounds if safe is set
+static inline int lz4_decode(const uint8_t * restrict src, uint32_t src_len,
+    uint8_t * restrict dst, uint32_t dst_len, const int safe)
 {
     const uint8_t *end = src + src_len;
-    do { 
+    uint8_t *const dst_start = dst;
+    uint8_t *const dst_end = dst + dst_len;
+
+    while (src < end) {
         uint8_t tok = *src++; // read token
 
+        // short literals with enough data left : copy 16 bytes at once.
+        // Every source byte decodes to at least one output byte, so the bytes written past
+        // the literals are rewritten by the following sequences, and a match follows.
+        unsigned len = tok>>4;
+        if (!safe && len<15 && end-src >= 16+8) {
+            lz4_copy16(dst,src);
+            dst += len;
+            src += len;
+            goto match;
+        }
+
         // get literal len
-        unsigned int len = lz4_extlen(tok>>4,&src);
+        len = lz4_extlen(len,&src,end,safe);
 
         // copy literal data
-        for (int i=len;i>0;--i)
-            *dst++ = *src++;
+        if (safe && (len > (unsigned)(end-src) || len > (unsigned)(dst_end-dst)))
+            return -1;
+        lz4_copy(dst,src,len);
+        dst += len;
+        src += len;
+
+        // last sequence has only literals
+        if (src >= end)
+            break;
 
-        // match offset 
-        uint8_t *match_ofs = dst - src[0] - (src[1]<<8); 
+    match:
+        // match offset
+        if (safe && end-src < 2)
+            return -1;
+        unsigned ofs = src[0] | src[1]<<8;
         src+=2;
+        if (safe && (ofs==0 || ofs > (unsigned)(dst-dst_start)))
+            return -1;
+        const uint8_t *match = dst - ofs;
+
+        // get match len, adds 4
+        len = lz4_extlen(tok & 0xf,&src,end,safe);
+        if (safe && (len == 0xffffffff || len+4 > (unsigned)(dst_end-dst)))
+            return -1;
+        len += 4;
+
+        if (ofs < 4) {
+            // short period : copy the first 4 bytes one by one, the pattern then repeats
+            // every 4 (periods 1,2) or 6 (period 3) bytes, far enough for word copies.
+            dst[0]=match[0]; dst[1]=match[1]; dst[2]=match[2]; dst[3]=match[3];
+            dst += 4;
+            len -= 4;
+            match = dst - (ofs==3 ? 6 : 4);
+        }
+        if (!safe && len<=16 && end-src >= 16) { // same as literals
+            lz4_copy16(dst,match);
+            dst += len;
+            continue;
+        }
+        lz4_copy(dst,match,len);
+        dst += len;
+    }
+    return dst - dst_start;
+}
+
+void lz4_block_decompress (const uint8_t * restrict src, uint32_t src_len, uint8_t * restrict dst)
+{
+    lz4_decode(src, src_len, dst, 0, 0);
+}
+
+int lz4_block_decompress_safe (const uint8_t * restrict src, uint32_t src_len, uint8_t * restrict dst, uint32_t dst_len)
+{
+    return lz4_decode(src, src_len, dst, dst_len, 1);
+}
+
+// -- resumable frame decoder
 
-        // get match len, adds 4 
-        len=lz4_extlen(tok & 0xf,&src) + 4;
+enum {
+    LZ4S_MAGIC, LZ4S_FLG, LZ4S_BD, LZ4S_CSIZE, LZ4S_DICTID, LZ4S_HC, LZ4S_BSIZE,
+    LZ4S_RAW, LZ4S_TOKEN, LZ4S_LITLEN, LZ4S_LIT, LZ4S_OFS, LZ4S_MLEN, LZ4S_MATCH,
+    LZ4S_BCHECK, LZ4S_CCHECK, LZ4S_DONE, LZ4S_ERROR
+};
 
-        // copy match data - use faster memcpy ?
-        for (int i=len;i>0;--i)
-            *dst++ = *match_ofs++;
+#define LZ4F_BCHECK (1<<4)
+#define LZ4F_CSIZE  (1<<3)
+#define LZ4F_CCHECK (1<<2)
+#define LZ4F_DICTID (1<<0)
 
-    } while (src < end);
+void lz4_stream_init (struct lz4_stream *s, uint8_t *out, uint32_t out_size, int ring)
+{
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+    s->out_size = out_size;
+    s->ring = ring;
+    s->state = LZ4S_MAGIC;
+}
+
+// reads n bytes little endian field into s->acc (first 4 bytes only), 1 when complete
+static int lz4s_field(struct lz4_stream *s, const uint8_t **in, const uint8_t *end, int n)
+{
+    while (s->nb < n) {
+        if (*in == end)
+            return 0;
+        if (s->nb < 4)
+            s->acc |= (uint32_t)**in << (8*s->nb);
+        (*in)++;
+        s->nb++;
+    }
+    s->nb = 0;
+    return 1;
+}
+
+// contiguous room at write position, within budget. 0 if output full.
+static uint32_t lz4s_room(struct lz4_stream *s, uint32_t budget)
+{
+    if (s->ring && s->out_pos == s->out_size)
+        s->out_pos = 0;
+    uint32_t room = s->out_size - s->out_pos;
+    return room < budget ? room : budget;
+}
+
+int lz4_stream_decode (struct lz4_stream *s, const uint8_t *in, uint32_t in_len, uint32_t *in_used, uint32_t max_out)
+{
+    const uint8_t *const start = in;
+    const uint8_t *const end = in + in_len;
+    uint32_t budget = max_out;
+    uint32_t n;
+
+    for (;;) switch (s->state) {
+    case LZ4S_MAGIC :
+        if (!lz4s_field(s,&in,end,4)) goto more;
+        s->state = s->acc == MAGIC_LZ4 ? LZ4S_FLG : LZ4S_ERROR;
+        s->acc = 0;
+        break;
+
+    case LZ4S_FLG :
+        if (in == end) goto more;
+        s->flags = *in++;
+        s->state = (s->flags>>6) == 1 ? LZ4S_BD : LZ4S_ERROR; // version 01
+        break;
+
+    case LZ4S_BD :
+        if (in == end) goto more;
+        in++; // block max size : the output buffer is given by the caller anyway
+        s->state = s->flags & LZ4F_CSIZE ? LZ4S_CSIZE : s->flags & LZ4F_DICTID ? LZ4S_DICTID : LZ4S_HC;
+        break;
+
+    case LZ4S_CSIZE :
+        if (!lz4s_field(s,&in,end,8)) goto more;
+        s->content_size = s->acc;
+        s->acc = 0;
+        s->state = s->flags & LZ4F_DICTID ? LZ4S_DICTID : LZ4S_HC;
+        break;
+
+    case LZ4S_DICTID :
+        if (!lz4s_field(s,&in,end,4)) goto more;
+        s->acc = 0;
+        s->state = LZ4S_HC;
+        break;
+
+    case LZ4S_HC :
+        if (in == end) goto more;
+        in++; // header checksum, not checked
+        s->state = LZ4S_BSIZE;
+        break;
+
+    case LZ4S_BSIZE :
+        if (!lz4s_field(s,&in,end,4)) goto more;
+        s->block_left = s->acc & 0x7fffffff;
+        if (!s->acc) {
+            s->state = s->flags & LZ4F_CCHECK ? LZ4S_CCHECK : LZ4S_DONE; // end mark
+        } else if (s->acc & 1u<<31) { // high bit set : uncompressed
+            s->state = LZ4S_RAW;
+        } else {
+            s->state = LZ4S_TOKEN;
+        }
+        s->acc = 0;
+        break;
+
+    case LZ4S_RAW :
+    case LZ4S_LIT :
+        if (s->state == LZ4S_LIT && s->len > s->block_left)
+            goto error;
+        // copy min(bytes left, input available, output room)
+        n = s->state == LZ4S_RAW ? s->block_left : s->len;
+        if ((uint32_t)(end-in) < n) n = end-in;
+        if (lz4s_room(s,budget) < n) n = lz4s_room(s,budget);
+        memcpy(s->out+s->out_pos, in, n);
+        in += n;
+        s->out_pos += n;
+        s->total += n;
+        budget -= n;
+        s->block_left -= n;
+        if (s->state == LZ4S_LIT) {
+            s->len -= n;
+            if (s->len) goto full_or_more;
+            s->state = s->block_left ? LZ4S_OFS : LZ4S_BCHECK; // last sequence : literals only
+        } else {
+            if (s->block_left) goto full_or_more;
+            s->state = LZ4S_BCHECK;
+        }
+        break;
+
+    case LZ4S_TOKEN :
+        if (in == end) goto more;
+        s->tok = *in++;
+        s->block_left--;
+        s->len = s->tok>>4;
+        s->state = s->len == 15 ? LZ4S_LITLEN : LZ4S_LIT;
+        break;
+
+    case LZ4S_LITLEN :
+    case LZ4S_MLEN :
+        // extended length bytes
+        for (;;) {
+            if (in == end) goto more;
+            if (!s->block_left) goto error;
+            const uint8_t b = *in++;
+            s->block_left--;
+            s->len += b;
+            if (b != 255) break;
+        }
+        s->state = s->state == LZ4S_LITLEN ? LZ4S_LIT : LZ4S_MATCH;
+        break;
+
+    case LZ4S_OFS :
+        n = s->nb;
+        if (s->block_left < 2-n)
+            goto error;
+        if (!lz4s_field(s,&in,end,2)) {
+            s->block_left -= s->nb - n;
+            goto more;
+        }
+        s->block_left -= 2 - n;
+        s->ofs = s->acc;
+        s->acc = 0;
+        if (!s->ofs || s->ofs > s->total || (s->ring && s->ofs > s->out_size))
+            goto error;
+        s->len = (s->tok & 15) + 4;
+        s->state = (s->tok & 15) == 15 ? LZ4S_MLEN : LZ4S_MATCH;
+        break;
+
+    case LZ4S_MATCH :
+        while (s->len) {
+            n = lz4s_room(s,budget);
+            if (!n) goto full_or_more;
+            // source position, in ring or linear buffer
+            uint32_t from = s->out_pos >= s->ofs ? s->out_pos - s->ofs : s->out_pos + s->out_size - s->ofs;
+            if (n > s->len) n = s->len;
+            if (n > s->out_size - from) n = s->out_size - from;
+
+            uint8_t *d = s->out + s->out_pos;
+            const uint8_t *m = s->out + from;
+            if (s->ofs >= 4)
+                lz4_copy(d, m, n);
+            else
+                for (uint32_t i=0; i<n; i++)
+                    d[i] = m[i];
+
+            s->out_pos += n;
+            s->total += n;
+            budget -= n;
+            s->len -= n;
+        }
+        s->state = s->block_left ? LZ4S_TOKEN : LZ4S_BCHECK;
+        break;
+
+    case LZ4S_BCHECK :
+        if (s->flags & LZ4F_BCHECK && !lz4s_field(s,&in,end,4)) goto more;
+        s->acc = 0;
+        s->state = LZ4S_BSIZE;
+        break;
+
+    case LZ4S_CCHECK :
+        if (!lz4s_field(s,&in,end,4)) goto more;
+        s->acc = 0;
+        s->state = LZ4S_DONE;
+        break;
+
+    case LZ4S_DONE :
+        *in_used = in-start;
+        return LZ4_STREAM_DONE;
+
+    default :
+        goto error;
+    }
+
+full_or_more:
+    // stopped by output : an error if the (linear) output buffer is full
+    if (budget && !s->ring && s->out_pos == s->out_size)
+        goto error;
+more:
+    *in_used = in-start;
+    return LZ4_STREAM_MORE;
+error:
+    s->state = LZ4S_ERROR;
+    *in_used = in-start;
+    return LZ4_STREAM_ERROR;
 }
 
 
@@ -75,37 +430,36 @@ void lz4_block_decompress (const uint8_t * restrict src, uint32_t src_len, uint8
 
 void *lz4_stream_decompress (const uint8_t * restrict src_data)
 {
-	uint32_t decomp_size;
-
-	if (*(uint32_t*)src_data != MAGIC_LZ4 ) {
-		message("ERROR: Magic LZ4 header not found");
-		bitbox_die(1,4);
-	}
-	src_data += 4; 
-
-	uint8_t flg = *src_data++;
-	//message("flag is %x\n",flg);
-	src_data++; 
-	if ((flg & 1<<3) ) {
-		decomp_size = *(uint64_t *)src_data;
-		src_data +=8; 
-	} else {
+    struct lz4_stream s;
+    uint32_t used;
+    int res;
+
+    // read the frame header to get the content size
+    lz4_stream_init(&s, 0, 0, 0);
+    res = lz4_stream_decode(&s, src_data, 32, &used, 0);
+    if (res == LZ4_STREAM_ERROR) {
+        message("ERROR: Magic LZ4 header not found");
+        bitbox_die(1,4);
+    }
+    if (!(s.flags & LZ4F_CSIZE)) {
         message("you must specify --content_size when compressing.\n");
         bitbox_die(7,1);
         return 0; // never
     }
+    src_data += used;
 
-	src_data +=1; // hc
-    uint32_t block_size = *(uint32_t*)src_data;
-    src_data +=4;
+    s.out = (uint8_t*)t_malloc(s.content_size);
+    s.out_size = s.content_size;
+    do {
+        res = lz4_stream_decode(&s, src_data, 4096, &used, s.content_size);
+        src_data += used;
+    } while (res == LZ4_STREAM_MORE);
 
-    uint8_t *dst_data = (uint8_t*)t_malloc(decomp_size);
-    if (block_size&1<<31) // high bit set : uncompressed. copy to ram
-        memcpy(dst_data, src_data, decomp_size);
-    else
-	   lz4_block_decompress(src_data,block_size,dst_data);
-
-    return dst_data;
+    if (res != LZ4_STREAM_DONE) {
+        message("ERROR: corrupted LZ4 frame");
+        bitbox_die(1,5);
+    }
+    return s.out;
 }
 #endif // LZ4_STREAM
 
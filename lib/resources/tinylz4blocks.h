@@ -0,0 +1,178 @@
+/* tiny lz4 blocks : random access to data packed by lz4blocks.py
+
+The file is cut in blocks compressed independently, with an index : the data can stay
+compressed in flash (or be f_map'ed), only the blocks covering the bytes you access are
+decoded, in a small cache of decoded blocks (LRU) provided by the caller.
+
+define TINYLZ4BLOCKS_IMPLEMENTATION exactly once in a .c file, with TINYLZ4_IMPLEMENTATION
+(tinylz4.h) defined there too or in another file.
+define LZ4BLOCKS_SAFE to check blocks when decoding (data read from SD), bad blocks are
+then reported and returned as 0.
+
+Example :
+
+	static uint8_t cache[4*4096]; // 4 lines of the block size used by lz4blocks.py
+	struct lz4blocks map;
+	lz4blocks_open(&map, data_level1_tmap_lz4b, cache, 4);
+	...
+	uint32_t len = 64;
+	const uint16_t *line = (const uint16_t*)lz4blocks_get(&map, y*256*2, &len); // len can be less !
+*/
+
+#pragma once
+#include <stdint.h>
+
+#ifndef LZ4BLOCKS_MAX_LINES
+#define LZ4BLOCKS_MAX_LINES 8
+#endif
+
+struct lz4blocks {
+	const uint8_t *data;   // compressed blocks
+	const uint8_t *index;  // nb_blocks+1 u32 offsets (maybe unaligned)
+	uint32_t block_size;
+	uint32_t size;         // decoded size
+	uint32_t nb_blocks;
+
+	uint8_t *cache;        // cache_lines*block_size bytes
+	int cache_lines;
+	int32_t line_block[LZ4BLOCKS_MAX_LINES]; // block decoded in line, -1 if none
+	uint32_t line_used[LZ4BLOCKS_MAX_LINES];
+	uint32_t now;
+
+	uint32_t hits, misses; // statistics
+};
+
+// opens container at data, using cache (cache_lines*block size bytes). Returns 0 or -1 if invalid.
+// cache_lines is at least 1, more than LZ4BLOCKS_MAX_LINES are not used.
+int lz4blocks_open (struct lz4blocks *b, const void *data, void *cache, int cache_lines);
+
+// decoded block, stays valid until cache_lines other blocks are fetched. 0 on error.
+const uint8_t *lz4blocks_block (struct lz4blocks *b, uint32_t block);
+
+// pointer to decoded data at offset. *len is the wanted length, reduced to the bytes
+// available contiguously (up to the end of the block). 0 if out of range.
+const uint8_t *lz4blocks_get (struct lz4blocks *b, uint32_t offset, uint32_t *len);
+
+// copies len bytes from offset to dst, across blocks. Returns the bytes copied.
+uint32_t lz4blocks_read (struct lz4blocks *b, uint32_t offset, void *dst, uint32_t len);
+
+
+#ifdef TINYLZ4BLOCKS_IMPLEMENTATION // -----------------------------------------------------------------------------------------------
+
+#include <string.h>
+#include "lib/resources/tinylz4.h"
+
+#define LZ4BLOCKS_MAGIC 0x42345a4c // 'LZ4B'
+
+static uint32_t lz4blocks_u32(const uint8_t *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+int lz4blocks_open (struct lz4blocks *b, const void *data, void *cache, int cache_lines)
+{
+	const uint8_t *p = data;
+	if (cache_lines < 1) {
+		message("lz4blocks: %d cache lines\n", cache_lines);
+		return -1;
+	}
+	if (lz4blocks_u32(p) != LZ4BLOCKS_MAGIC) {
+		message("lz4blocks: bad header\n");
+		return -1;
+	}
+	b->block_size = lz4blocks_u32(p+4);
+	b->size = lz4blocks_u32(p+8);
+	b->nb_blocks = lz4blocks_u32(p+12);
+	b->index = p+16;
+	b->data = b->index + 4*(b->nb_blocks+1);
+
+	b->cache = cache;
+	b->cache_lines = cache_lines < LZ4BLOCKS_MAX_LINES ? cache_lines : LZ4BLOCKS_MAX_LINES;
+	for (int i=0;i<LZ4BLOCKS_MAX_LINES;i++)
+		b->line_block[i] = -1;
+	b->now = 0;
+	b->hits = b->misses = 0;
+	return 0;
+}
+
+const uint8_t *lz4blocks_block (struct lz4blocks *b, uint32_t block)
+{
+	if (block >= b->nb_blocks)
+		return 0;
+	b->now++;
+
+	// hit, or least recently used line (empty lines first)
+	int victim = 0;
+	uint32_t victim_age = 0;
+	for (int i=0;i<b->cache_lines;i++) {
+		if (b->line_block[i] == (int32_t)block) {
+			b->hits++;
+			b->line_used[i] = b->now;
+			return b->cache + i*b->block_size;
+		}
+		const uint32_t age = b->line_block[i] < 0 ? 0xffffffff : b->now - b->line_used[i];
+		if (age >= victim_age) {
+			victim = i;
+			victim_age = age;
+		}
+	}
+
+	b->misses++;
+	uint8_t *dst = b->cache + victim*b->block_size;
+	const uint32_t start = lz4blocks_u32(b->index+4*block);
+	const uint32_t csize = lz4blocks_u32(b->index+4*block+4) - start;
+	const uint32_t dsize = block == b->nb_blocks-1 ? b->size - block*b->block_size : b->block_size;
+
+	b->line_block[victim] = -1;
+	if (csize == dsize) { // stored raw
+		memcpy(dst, b->data+start, dsize);
+	} else {
+#ifdef LZ4BLOCKS_SAFE
+		if (lz4_block_decompress_safe(b->data+start, csize, dst, dsize) != (int)dsize) {
+			message("lz4blocks: corrupted block %d\n", block);
+			return 0;
+		}
+#else
+		lz4_block_decompress(b->data+start, csize, dst);
+#endif
+	}
+	b->line_block[victim] = block;
+	b->line_used[victim] = b->now;
+	return dst;
+}
+
+const uint8_t *lz4blocks_get (struct lz4blocks *b, uint32_t offset, uint32_t *len)
+{
+	if (offset >= b->size)
+		return 0;
+
+	const uint8_t *blk = lz4blocks_block(b, offset / b->block_size);
+	if (!blk)
+		return 0;
+
+	const uint32_t ofs = offset % b->block_size;
+	uint32_t avail = b->block_size - ofs;
+	if (avail > b->size - offset)
+		avail = b->size - offset;
+	if (*len > avail)
+		*len = avail;
+	return blk + ofs;
+}
+
+uint32_t lz4blocks_read (struct lz4blocks *b, uint32_t offset, void *dst, uint32_t len)
+{
+	uint8_t *d = dst;
+	while (len) {
+		uint32_t n = len;
+		const uint8_t *src = lz4blocks_get(b, offset, &n);
+		if (!src)
+			break;
+		memcpy(d, src, n);
+		d += n;
+		offset += n;
+		len -= n;
+	}
+	return d - (uint8_t *)dst;
+}
+
+#endif // TINYLZ4BLOCKS_IMPLEMENTATION
@@ -1,20 +1,51 @@
 /* tiny malloc library
 
-   Taken from The C programming language, by Ritchie & Kernighan, Ed2 chap 8.7
-   Adapted by Makapuf (designated inits, no sbrk)
+   TLSF (Two Level Segregated Fit) allocator, after M. Masmano et al.
+   Replaces the K&R free list allocator (The C programming language, chap 8.7) once used here.
 
-   This implementation is tiny, not that fast and does not interact with any operating system features.
-   Use by adding one or more chunks of memory to it with bfree(), then malloc / free within it.
+   Free blocks are kept in lists by size class : a first level by power of two, then 2^T_SL_LOG
+   linear sub classes. Two levels of bitmaps give the smallest non empty class big enough for a
+   request, so t_malloc and t_free are constant time (no list walk), whatever the number of
+   free blocks, and neighbour blocks are merged immediately when freed, limiting fragmentation
+   when levels are loaded and unloaded.
+
+   This implementation is tiny and does not interact with any operating system features.
+   Use by adding one or more chunks of memory to it with t_addchunk(), then malloc / free within it.
+   Each block has a 2 words header, user memory is 8 bytes aligned.
 
    Using bitbox standard message / die interface.
 
-   NOTE:  This is a single file library. Just include it once in your code and define IMPLEMENTATION_TINYMALLOC before
+   NOTE:  This is a single file library. Just include it once in your code and define TINYMALLOC_IMPLEMENTATION before
 
  */
+#ifndef TINYMALLOC_H
+#define TINYMALLOC_H
 #include "stdint.h"
 
 #define DIE_ON_NOMEM 0
 
+#ifndef T_MAX_LOG
+#define T_MAX_LOG 20  // blocks are smaller than 2^T_MAX_LOG bytes : bigger chunks are cut
+#endif
+
+#ifndef T_SL_LOG
+#define T_SL_LOG 4    // 2^T_SL_LOG sub classes per power of two
+#endif
+
+#ifndef T_MAX_CHUNKS
+#define T_MAX_CHUNKS 8 // chunks remembered for t_print_stack
+#endif
+
+struct t_stats {
+	unsigned int total;     // bytes given with t_addchunk
+	unsigned int used;      // bytes allocated, headers included
+	unsigned int peak;      // high water mark of used
+	unsigned int largest;   // largest free block, ie biggest t_malloc possible
+	unsigned int nb_blocks; // allocated blocks
+	unsigned int fails;     // failed t_malloc
+	int fragmentation;      // percent of free memory outside the largest free block
+};
+
 // allocate memory. Always returns a valid pointer (or die trying :)
 void *t_malloc(unsigned int nbytes) __attribute__( (warn_unused_result) );
 
@@ -23,140 +54,271 @@ void t_free(void *ap);                       // free a memory block
 void t_addchunk(void *ptr, unsigned int sz); // declares memory as free from static chunk of mem.
 
 int t_available();                           // get available mem (but not nec. in one chunk !)
-void t_print_stack(); 
+void t_stats(struct t_stats *st);            // usage statistics, walks the blocks of the largest free size class
+void t_print_stack();                        // prints all blocks, free or not
+#endif // TINYMALLOC_H
 
 // ----- IMPLEMENTATION -----------------------------------------------------------------------------------
 
 /*
 
-   Memory is managed by blocks :
+   Memory is managed by blocks, contiguous in each chunk and ended by an empty used block :
 
  +------------+------------+----------- ...  -------+
- | next_block | block size | user-memory            |
+ | prev_phys  | size+flags | user-memory            |
  +------------+------------+----------- ...  -------+
                             ^
  <------- header ---------> | address returned to user
+
+   prev_phys is only valid when the previous block is free (flag T_PREV_FREE).
+   Free blocks use the start of user memory to link them in their size class list.
  */
 
-#ifdef TINYMALLOC_IMPLEMENTATION
+#if defined(TINYMALLOC_IMPLEMENTATION) && !defined(TINYMALLOC_IMPLEMENTED)
+#define TINYMALLOC_IMPLEMENTED // other libraries include this header too
+#include <stddef.h>
 #include <stdint.h>
 #include <bitbox.h>
 
 #define debug(...)
 //#define debug message
 
+typedef struct t_block {
+	struct t_block *prev_phys;  // previous block in memory, if free
+	unsigned int size;          // size of user memory, low bits are flags
+	// only when free, in user memory :
+	struct t_block *next_free;  // in size class list
+	struct t_block *prev_free;
+} Block;
+
+#define T_ALIGN_LOG 3
+#define T_ALIGN (1<<T_ALIGN_LOG)
+#define T_HEADER offsetof(Block, next_free)
+#define T_MIN ((sizeof(Block)-T_HEADER+T_ALIGN-1) & ~(T_ALIGN-1))  // room for the free links
+
+#define T_FREE 1
+#define T_PREV_FREE 2
+#define T_SIZE(b) ((b)->size & ~(T_ALIGN-1))
+
+// below T_SMALL, size classes are linear, T_ALIGN apart
+#define T_FL_SHIFT (T_SL_LOG+T_ALIGN_LOG)
+#define T_SMALL (1<<T_FL_SHIFT)
+#define T_FL_COUNT (T_MAX_LOG-T_FL_SHIFT+1)
+
+static uint32_t fl_bitmap;                             // non empty first levels
+static uint32_t sl_bitmap[T_FL_COUNT];                 // non empty second levels
+static Block *free_lists[T_FL_COUNT][1<<T_SL_LOG];
+
+static Block *chunks[T_MAX_CHUNKS];
+static int nb_chunks;
+static struct t_stats stats;
+
+static inline Block *t_next_phys(Block *b)
+{
+	return (Block *)((char *)b + T_HEADER + T_SIZE(b));
+}
+
+static inline int t_fls(uint32_t x)
+{
+	return 31-__builtin_clz(x);
+}
+
+static void t_mapping(unsigned int size, int *fl, int *sl)
+{
+	if (size < T_SMALL) {
+		*fl = 0;
+		*sl = size >> T_ALIGN_LOG;
+	} else {
+		const int f = t_fls(size);
+		*sl = (size >> (f-T_SL_LOG)) ^ (1<<T_SL_LOG);
+		*fl = f - T_FL_SHIFT + 1;
+	}
+}
 
-typedef union header_u {                        // block header
-	struct {
-        union header_u *next;                   // next block if on free list
-        unsigned int size;                      // size of this block
-    } s;
-    uint32_t x;                                 // will force alignment of blocks
-} Header;
+static void t_insert(Block *b)
+{
+	int fl, sl;
+	t_mapping(T_SIZE(b), &fl, &sl);
+	Block *head = free_lists[fl][sl];
+	b->next_free = head;
+	b->prev_free = 0;
+	if (head)
+		head->prev_free = b;
+	free_lists[fl][sl] = b;
+	fl_bitmap |= 1u<<fl;
+	sl_bitmap[fl] |= 1u<<sl;
+}
 
-static Header base={.s.next=&base, .s.size=0 }; // empty list to get started
-static Header *freep=&base;                     // start of free list
+static void t_remove(Block *b)
+{
+	int fl, sl;
+	t_mapping(T_SIZE(b), &fl, &sl);
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+	if (b->prev_free) {
+		b->prev_free->next_free = b->next_free;
+	} else {
+		free_lists[fl][sl] = b->next_free;
+		if (!b->next_free) {
+			sl_bitmap[fl] &= ~(1u<<sl);
+			if (!sl_bitmap[fl])
+				fl_bitmap &= ~(1u<<fl);
+		}
+	}
+}
+
+// first free block of a class where all blocks are at least size bytes, or 0
+static Block *t_find(unsigned int size)
+{
+	int fl, sl;
+	if (size >= T_SMALL)
+		size += (1u<<(t_fls(size)-T_SL_LOG)) - 1; // round up to the next class
+	t_mapping(size, &fl, &sl);
+	if (fl >= T_FL_COUNT)
+		return 0;
+
+	uint32_t map = sl_bitmap[fl] & (~0u << sl);
+	if (!map) {
+		const uint32_t fmap = fl_bitmap & (~0u << (fl+1));
+		if (!fmap)
+			return 0;
+		fl = __builtin_ctz(fmap);
+		map = sl_bitmap[fl];
+	}
+	return free_lists[fl][__builtin_ctz(map)];
+}
 
 /* malloc: general-purpose storage allocator */
 void *t_malloc(unsigned int nbytes)
 {
-	Header *p, *prevp;
-	unsigned int nunits;
-
-
-    nunits = (nbytes+sizeof(Header)-1)/sizeof(Header) + 1; // nb of 8bytes blocks
-
-    debug( "malloc %d bytes, %d units, %d real bytes\n",nbytes, nunits, nunits*sizeof(Header) );
-
-    prevp=freep;
-
-    for (p = prevp->s.next;; prevp = p, p = p->s.next) {
-    	debug("  checking %p (sz=%d))...",p,p->s.size);
-        if (p->s.size >= nunits) {     // big enough
-            if (p->s.size == nunits) { // exactly
-            	debug("size just ok");
-            	prevp->s.next = p->s.next;
-            } else {                   // allocate tail end
-            	debug("ok more than nec.\n");
-            	p->s.size -= nunits;
-            	p += p->s.size;
-            	p->s.size = nunits;
-            }
-            freep = prevp;
-            return (void *)(p+1);
-        } else
-        debug("too small");
-        debug("\n");
-
-
-        if (p == freep) { // wrapped around free list : out of memory
-        	message("Out of memory.\n");
-            if (DIE_ON_NOMEM)
-            	bitbox_die (3,3);
-            else
-                return 0;
-    }
-    }
+	const unsigned int size = nbytes < T_MIN ? T_MIN : (nbytes+T_ALIGN-1) & ~(T_ALIGN-1);
+	Block *b = nbytes < (1u<<T_MAX_LOG) ? t_find(size) : 0;
+
+	debug("malloc %d bytes, %d real bytes -> %p\n", nbytes, size+T_HEADER, b);
+
+	if (!b) {
+		stats.fails++;
+		message("Out of memory.\n");
+		if (DIE_ON_NOMEM)
+			bitbox_die (3,3);
+		else
+			return 0;
+	}
+	t_remove(b);
+
+	Block *next = t_next_phys(b);
+	const unsigned int rest = T_SIZE(b) - size;
+	if (rest >= T_HEADER + T_MIN) { // give back the tail end
+		Block *r = (Block *)((char *)b + T_HEADER + size);
+		r->size = (rest - T_HEADER) | T_FREE;
+		b->size = size | (b->size & T_PREV_FREE);
+		next->prev_phys = r;
+		t_insert(r);
+	} else {
+		next->size &= ~T_PREV_FREE;
+	}
+	b->size &= ~T_FREE;
+
+	stats.used += T_HEADER + T_SIZE(b);
+	stats.nb_blocks++;
+	if (stats.used > stats.peak)
+		stats.peak = stats.used;
+
+	return (char *)b + T_HEADER;
 }
 
 void t_free(void *ap)
 {
-	Header *bp, *p;
-    bp = (Header *)ap - 1;              // point to block header
-    // XXX Check header is OK ? (next really in RAM, size not too big ie <64k )
-    // FIXME what if not in right order ?
-
-    for (p = freep; !(bp > p && bp < p->s.next); p = p->s.next)
-    	if ( p >= p->s.next && (bp > p || bp < p->s.next) )
-            break;                      // freed block at start or end of arena
-
-    if (bp + bp->s.size == p->s.next) { // join to upper nbr
-    	bp->s.size += p->s.next->s.size;
-    	bp->s.next = p->s.next->s.next;
-    } else {
-    	bp->s.next = p->s.next;
-    }
-
-    if (p + p->s.size == bp) { // join to lower nbr
-    	p->s.size += bp->s.size;
-    	p->s.next = bp->s.next;
-    } else {
-    	p->s.next = bp;
-    }
-
-    freep = p;
+	if (!ap)
+		return;
+
+	Block *b = (Block *)((char *)ap - T_HEADER);
+	if (b->size & T_FREE) {
+		message("t_free: %p already free\n", ap);
+		return;
+	}
+	stats.used -= T_HEADER + T_SIZE(b);
+	stats.nb_blocks--;
+	b->size |= T_FREE;
+
+	if (b->size & T_PREV_FREE) { // join to lower nbr
+		Block *prev = b->prev_phys;
+		t_remove(prev);
+		prev->size += T_HEADER + T_SIZE(b);
+		b = prev;
+	}
+
+	Block *next = t_next_phys(b);
+	if (next->size & T_FREE) {   // join to upper nbr
+		t_remove(next);
+		b->size += T_HEADER + T_SIZE(next);
+		next = t_next_phys(b);
+	}
+
+	next->size |= T_PREV_FREE;
+	next->prev_phys = b;
+	t_insert(b);
 }
 
 // Puts a block not already in free list to it (from static memory by example)
 void t_addchunk(void *p, unsigned int n)
 {
-    // now build a block at given memory
-	Header *hp = (Header *)p;
-	hp->s.size=n/sizeof(Header);
+	// align start and end
+	const uintptr_t start = ((uintptr_t)p + T_ALIGN-1) & ~(uintptr_t)(T_ALIGN-1);
+	const uintptr_t end = ((uintptr_t)p + n) & ~(uintptr_t)(T_ALIGN-1);
+
+	if (end < start + 2*T_HEADER + T_MIN) {
+		message("t_addchunk: chunk too small\n");
+		return;
+	}
+
+	unsigned int size = end - start - 2*T_HEADER;
+	if (size >= (1u<<T_MAX_LOG)) {
+		message("t_addchunk: chunk cut to %d bytes\n", 1<<T_MAX_LOG);
+		size = (1u<<T_MAX_LOG) - T_ALIGN;
+	}
 
-    t_free( (void*)(hp+1) ); // and "free" this block
+	// one free block, then an empty used block so that it's never merged past the end
+	Block *b = (Block *)start;
+	b->size = size | T_FREE;
+	Block *end_block = t_next_phys(b);
+	end_block->size = T_PREV_FREE;
+	end_block->prev_phys = b;
+	t_insert(b);
+
+	stats.total += T_HEADER + size;
+	if (nb_chunks < T_MAX_CHUNKS)
+		chunks[nb_chunks++] = b;
 }
 
 // gets available mem (but not in one chunk !)
 int t_available()
 {
-	int nb;
-	Header *p;
-	for (nb=0,p=freep->s.next; p!=freep; p=p->s.next)
-        nb += p->s.size;
-	nb += p->s.size;
-	return nb*sizeof(Header);
+	return stats.total - stats.used;
 }
 
-void t_print_stack()
+void t_stats(struct t_stats *st)
 {
-	Header *p, *prevp=freep;
+	*st = stats;
+	st->largest = 0;
+	if (fl_bitmap) { // largest block is in the highest non empty class
+		const int fl = t_fls(fl_bitmap);
+		for (Block *b = free_lists[fl][t_fls(sl_bitmap[fl])]; b; b = b->next_free)
+			if (T_SIZE(b) > st->largest)
+				st->largest = T_SIZE(b);
+	}
+	const unsigned int free = stats.total - stats.used;
+	st->fragmentation = free ? 100 - (uint64_t)(st->largest + T_HEADER) * 100 / free : 0;
+}
 
-	for (p = prevp->s.next; p!=freep; prevp = p, p = p->s.next) {
-		message("chunk at %p size %u\n",p,p->s.size*sizeof(Header));
+void t_print_stack()
+{
+	for (int i=0; i<nb_chunks; i++) {
+		for (Block *b = chunks[i]; T_SIZE(b); b = t_next_phys(b))
+			message("%s at %p size %u\n", b->size & T_FREE ? "free" : "used", b, T_SIZE(b));
+		message("-\n");
 	}
-	message("chunk at %p size %u\n",p,p->s.size*sizeof(Header));
-	message("-\n");
+	message("used %u/%u peak %u\n", stats.used, stats.total, stats.peak);
 }
 
-#endif
\ No newline at end of file
+#endif
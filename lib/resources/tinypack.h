@@ -0,0 +1,278 @@
+/* tiny pack : O(1) access to the entries of a resource pack made by respack.py
+
+   The pack can be
+	- linked in flash as one blob (respack.py --incbin) : pack_open
+	- mapped whole with f_map (mmap'ed by the emulator, loaded in RAM on device) : pack_map_file
+	- left on the SD card, only its directory in RAM, entries read on demand : pack_open_file
+
+   On device, f_map loads into memory from tinymalloc (see fatfs/ff_map.h) : the directory of
+   a pack file, a whole mapped pack, and compressed entries while pack_read decodes them.
+
+   Entries are found by name, hashed : names are not stored in the pack.
+   Raw entries in memory can be used in place (pack_get). Entries compressed with
+   respack.py -z are decoded with pack_read (needs tinylz4.h implemented somewhere).
+
+   Raw entries of a pack on SD can also be given to the loader, to load them over several
+   frames : loader_add("game.pak", e.offset, e.stored, dest, done).
+
+   define TINYPACK_IMPLEMENTATION before including it in exactly one file.
+   File functions are available with USE_SDCARD.
+
+   Example :
+
+	extern const uint8_t pack_data[]; // respack.py -o game.pak --incbin game_pak.c *.spr *.tmap
+	struct pack pak;
+	pack_open(&pak, pack_data);
+	const void *tiles = pack_get(&pak, "tiles.spr", 0);
+*/
+
+#pragma once
+#include <stdint.h>
+
+#define PACK_CODEC_RAW 0
+#define PACK_CODEC_LZ4 1
+
+struct pack {
+	const uint8_t *data;   // whole pack in memory, or 0 if on file
+	const uint8_t *dir;    // slots : hash, offset, size, stored | codec<<24
+	uint32_t mask;         // nb_slots-1
+	uint32_t nb_entries;
+	uint32_t mapped;       // bytes to f_unmap at pack_close (data, or dir if on file)
+	const char *path;      // file, if opened with pack_open_file / pack_map_file
+};
+
+struct pack_entry {
+	uint32_t offset;       // from the start of the pack
+	uint32_t size;         // decoded size
+	uint32_t stored;       // size in the pack
+	uint8_t codec;
+};
+
+// FNV-1a of name, as respack.py
+uint32_t pack_hash (const char *name);
+
+// pack in memory (linked blob). Returns 0 or -1 if invalid
+int pack_open (struct pack *p, const void *data);
+
+// pack file on SD, keeping only its directory in memory. path is not copied
+int pack_open_file (struct pack *p, const char *path);
+
+// whole pack file f_map'ed : in place access on the emulator. path is not copied
+int pack_map_file (struct pack *p, const char *path);
+
+// frees what pack_open_file / pack_map_file mapped
+void pack_close (struct pack *p);
+
+// finds an entry by name or hash. Returns 0 if found, -1 if not.
+int pack_find (const struct pack *p, const char *name, struct pack_entry *e);
+int pack_find_hash (const struct pack *p, uint32_t hash, struct pack_entry *e);
+
+// raw entry in place, for packs in memory. Sets *size if not 0. 0 if not found or compressed.
+const void *pack_get (const struct pack *p, const char *name, uint32_t *size);
+
+// decodes an entry to dest (e->size bytes). Returns the size, or -1 on error.
+int pack_read (const struct pack *p, const struct pack_entry *e, void *dest);
+
+// ----- IMPLEMENTATION -----------------------------------------------------------------------------------
+
+#ifdef TINYPACK_IMPLEMENTATION
+
+#include <string.h>
+#include <bitbox.h>
+#include "lib/resources/tinylz4.h"
+#ifdef USE_SDCARD
+#include "fatfs/ff.h"
+#include "fatfs/ff_map.h"
+#endif
+
+#define PACK_HEADER 16
+#define PACK_SLOT 16
+
+static uint32_t pack_u32(const uint8_t *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+uint32_t pack_hash (const char *name)
+{
+	uint32_t h = 2166136261u;
+	for (; *name; name++)
+		h = (h ^ (uint8_t)*name) * 16777619u;
+	return h ? h : 1;
+}
+
+// checks header, returns directory size or 0
+static uint32_t pack_header(struct pack *p, const uint8_t *header)
+{
+	const uint32_t nb_slots = pack_u32(header+4);
+	if (memcmp(header, "RPAK", 4) || !nb_slots || (nb_slots & (nb_slots-1))) {
+		message("pack: bad header\n");
+		return 0;
+	}
+	p->mask = nb_slots-1;
+	p->nb_entries = pack_u32(header+8);
+	return PACK_HEADER + nb_slots*PACK_SLOT;
+}
+
+int pack_open (struct pack *p, const void *data)
+{
+	memset(p, 0, sizeof(*p));
+	if (!pack_header(p, data))
+		return -1;
+	p->data = data;
+	p->dir = p->data + PACK_HEADER;
+	return 0;
+}
+
+int pack_find_hash (const struct pack *p, uint32_t hash, struct pack_entry *e)
+{
+	for (uint32_t i = hash & p->mask; ; i = (i+1) & p->mask) {
+		const uint8_t *slot = p->dir + i*PACK_SLOT;
+		const uint32_t h = pack_u32(slot);
+		if (!h)
+			return -1; // tables have empty slots, so this ends
+		if (h == hash) {
+			e->offset = pack_u32(slot+4);
+			e->size = pack_u32(slot+8);
+			e->stored = pack_u32(slot+12) & 0xffffff;
+			e->codec = slot[15];
+			return 0;
+		}
+	}
+}
+
+int pack_find (const struct pack *p, const char *name, struct pack_entry *e)
+{
+	return pack_find_hash(p, pack_hash(name), e);
+}
+
+const void *pack_get (const struct pack *p, const char *name, uint32_t *size)
+{
+	struct pack_entry e;
+	if (!p->data || pack_find(p, name, &e) || e.codec != PACK_CODEC_RAW)
+		return 0;
+	if (size)
+		*size = e.size;
+	return p->data + e.offset;
+}
+
+// decodes stored data, which can be corrupted if it comes from SD
+static int pack_decode(const struct pack_entry *e, const uint8_t *src, void *dest, int safe)
+{
+	switch (e->codec) {
+	case PACK_CODEC_RAW :
+		memcpy(dest, src, e->size);
+		return e->size;
+	case PACK_CODEC_LZ4 :
+		if (!safe) {
+			lz4_block_decompress(src, e->stored, dest);
+			return e->size;
+		}
+		return lz4_block_decompress_safe(src, e->stored, dest, e->size) == (int)e->size ? (int)e->size : -1;
+	default :
+		message("pack: unknown codec %d\n", e->codec);
+		return -1;
+	}
+}
+
+#ifdef USE_SDCARD
+
+int pack_open_file (struct pack *p, const char *path)
+{
+	memset(p, 0, sizeof(*p));
+
+	// header read directly, the directory size is not known yet
+	uint8_t header[PACK_HEADER];
+	FIL f;
+	UINT br = 0;
+	FRESULT res = f_open(&f, path, FA_READ | FA_OPEN_EXISTING);
+	if (res == FR_OK) {
+		res = f_read(&f, header, PACK_HEADER, &br);
+		f_close(&f);
+	}
+	if (res != FR_OK || br != PACK_HEADER) {
+		message("pack: error %d reading %s\n", res, path);
+		return -1;
+	}
+	const uint32_t dir_size = pack_header(p, header);
+	if (!dir_size)
+		return -1;
+
+	DWORD len = dir_size;
+	const uint8_t *dir = f_map(path, 0, &len);
+	if (!dir)
+		return -1;
+	if (len != dir_size) {
+		f_unmap(dir, len);
+		return -1;
+	}
+	p->dir = dir + PACK_HEADER;
+	p->mapped = len;
+	p->path = path;
+	return 0;
+}
+
+int pack_map_file (struct pack *p, const char *path)
+{
+	DWORD len = 0;
+	const uint8_t *data = f_map(path, 0, &len);
+	if (!data)
+		return -1;
+	if (len < PACK_HEADER || pack_open(p, data)) {
+		f_unmap(data, len);
+		return -1;
+	}
+	p->mapped = len;
+	p->path = path;
+	return 0;
+}
+
+void pack_close (struct pack *p)
+{
+	if (p->mapped)
+		f_unmap(p->data ? p->data : p->dir - PACK_HEADER, p->mapped);
+	memset(p, 0, sizeof(*p));
+}
+
+// entry from the pack file
+static int pack_read_file(const struct pack *p, const struct pack_entry *e, void *dest)
+{
+	if (e->codec == PACK_CODEC_RAW) { // straight to dest
+		FIL f;
+		UINT br = 0;
+		FRESULT res = f_open(&f, p->path, FA_READ | FA_OPEN_EXISTING);
+		if (res == FR_OK) {
+			res = f_lseek(&f, e->offset);
+			if (res == FR_OK)
+				res = f_read(&f, dest, e->size, &br);
+			f_close(&f);
+		}
+		if (res != FR_OK || br != e->size) {
+			message("pack: error %d reading %s\n", res, p->path);
+			return -1;
+		}
+		return e->size;
+	}
+
+	DWORD len = e->stored;
+	const uint8_t *src = f_map(p->path, e->offset, &len);
+	if (!src)
+		return -1;
+	const int res = len == e->stored ? pack_decode(e, src, dest, 1) : -1;
+	f_unmap(src, len);
+	return res;
+}
+
+#endif // USE_SDCARD
+
+int pack_read (const struct pack *p, const struct pack_entry *e, void *dest)
+{
+#ifdef USE_SDCARD
+	if (!p->data)
+		return pack_read_file(p, e, dest);
+#endif
+	// a mapped file could be corrupted, a linked blob not
+	return pack_decode(e, p->data + e->offset, dest, p->mapped != 0);
+}
+
+#endif // TINYPACK_IMPLEMENTATION
@@ -1,54 +1,254 @@
-// tinyriff.c
+// tinyriff.c : RIFF chunk index and WAV reader, see tinyriff.h
 
 #include <stdint.h>
+#include <string.h>
 
-const char * parse_chunk(const char *buf)
+#include "bitbox.h"
+#include "tinyriff.h"
+#include "lib/sampler/sampler.h"
+
+#ifdef USE_SDCARD
+#include "fatfs/ff.h"
+static FIL *riff_file; // file being indexed
+#endif
+
+static uint32_t riff_u32(const uint8_t *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+static uint16_t riff_u16(const uint8_t *p)
+{
+	return p[0] | p[1]<<8;
+}
+
+// chunk header (and list type) at offset. Returns bytes available
+static uint32_t riff_header(const struct riff *r, uint32_t offset, uint8_t *buf)
 {
-    uint32_t info = *(uint32_t*)buf;
-	buf+=4;
-	uint32_t sz = *(uint32_t *)buf;
-	buf+=4;
+	uint32_t n = r->size-offset < 12 ? r->size-offset : 12;
+	if (r->data) {
+		memcpy(buf, r->data+offset, n);
+		return n;
+	}
+#ifdef USE_SDCARD
+	UINT br;
+	if (f_lseek(riff_file, offset) != FR_OK || f_read(riff_file, buf, n, &br) != FR_OK)
+		return 0;
+	return br;
+#else
+	return 0;
+#endif
+}
 
-	#ifdef TEST
-	printf("chunk: %.4s size:%d\n",info,sz);
-	#endif
+// indexes chunks from start to end, inside a list of type list
+static int riff_parse(struct riff *r, uint32_t start, uint32_t end, uint32_t list)
+{
+	uint8_t buf[12];
 
-	const char *tgtbuf = buf+sz;
+	while (start+8 <= end) {
+		const uint32_t n = riff_header(r, start, buf);
+		if (n < 8)
+			return -1;
 
-	if ( info == *(uint32_t*)"RIFF" || info == *(uint32_t*)"LIST") {
-		const char *listname = buf;
-		buf+=4;
-		#ifdef TEST
-		printf("list : %.4s\n",listname);
-		#endif
+		const uint32_t id = riff_u32(buf);
+		uint32_t size = riff_u32(buf+4);
+		if (size > end-start-8) {
+			message("riff: chunk %.4s truncated\n", buf);
+			size = end-start-8;
+		}
 
-		while (buf<tgtbuf) {
-			buf = parse_chunk(buf);
+		if (id == RIFF_ID("LIST")) {
+			if (n == 12 && riff_parse(r, start+12, start+8+size, riff_u32(buf+8)) < 0)
+				return -1;
+		} else if (r->nb_chunks < RIFF_MAX_CHUNKS) {
+			r->chunks[r->nb_chunks++] = (struct riff_chunk) {
+				.id=id, .list=list, .offset=start+8, .size=size
+			};
+		} else {
+			message("riff: more than %d chunks, %.4s ignored\n", RIFF_MAX_CHUNKS, buf);
 		}
-	} else {
-		// use chunk !
-		buf += sz;
+		start += 8 + size + size%2;
+	}
+	return r->nb_chunks;
+}
+
+static int riff_index(struct riff *r)
+{
+	uint8_t buf[12];
+	r->nb_chunks = 0;
+	if (r->size < 12 || riff_header(r, 0, buf) < 12 || riff_u32(buf) != RIFF_ID("RIFF")) {
+		message("riff: bad header\n");
+		return -1;
+	}
+
+	uint32_t end = 8 + riff_u32(buf+4);
+	if (end > r->size)
+		end = r->size;
+	r->form = riff_u32(buf+8);
+	return riff_parse(r, 12, end, r->form);
+}
+
+int riff_open (struct riff *r, const void *data, uint32_t size)
+{
+	r->data = data;
+	r->path = 0;
+	r->size = size;
+	return riff_index(r);
+}
+
+#ifdef USE_SDCARD
+int riff_open_file (struct riff *r, const char *path)
+{
+	FIL f;
+	FRESULT res = f_open(&f, path, FA_READ | FA_OPEN_EXISTING);
+	if (res != FR_OK) {
+		message("riff: error %d opening %s\n", res, path);
+		return -1;
+	}
+	r->data = 0;
+	r->path = path;
+	r->size = f_size(&f);
+
+	riff_file = &f;
+	const int nb = riff_index(r);
+	riff_file = 0;
+	f_close(&f);
+	return nb;
+}
+#endif
+
+const struct riff_chunk *riff_find (const struct riff *r, uint32_t id, int n)
+{
+	for (int i=0; i<r->nb_chunks; i++)
+		if (r->chunks[i].id == id && !n--)
+			return &r->chunks[i];
+	return 0;
+}
+
+const void *riff_data (const struct riff *r, const struct riff_chunk *c)
+{
+	return r->data ? r->data + c->offset : 0;
+}
+
+int riff_read (const struct riff *r, const struct riff_chunk *c, void *dest, uint32_t max)
+{
+	const uint32_t n = c->size < max ? c->size : max;
+	if (r->data) {
+		memcpy(dest, r->data + c->offset, n);
+		return n;
+	}
+#ifdef USE_SDCARD
+	FIL f;
+	UINT br = 0;
+	FRESULT res = f_open(&f, r->path, FA_READ | FA_OPEN_EXISTING);
+	if (res == FR_OK) {
+		res = f_lseek(&f, c->offset);
+		if (res == FR_OK)
+			res = f_read(&f, dest, n, &br);
+		f_close(&f);
+	}
+	if (res == FR_OK && br == n)
+		return n;
+	message("riff: error %d reading %s\n", res, r->path);
+#endif
+	return -1;
+}
+
+// -- WAV
+
+int wav_open (struct wav *w, const struct riff *r)
+{
+	uint8_t fmt[16];
+	const struct riff_chunk *c_fmt = riff_find(r, RIFF_ID("fmt "), 0);
+	const struct riff_chunk *c_data = riff_find(r, RIFF_ID("data"), 0);
+
+	if (r->form != RIFF_ID("WAVE") || !c_fmt || !c_data || riff_read(r, c_fmt, fmt, sizeof(fmt)) != sizeof(fmt)) {
+		message("wav: not a WAV file\n");
+		return -1;
 	}
 
-	buf += sz%2;
+	w->channels = riff_u16(fmt+2);
+	w->rate = riff_u32(fmt+4);
+	w->bits = riff_u16(fmt+14);
+	if (riff_u16(fmt) != 1 || w->channels < 1 || w->channels > 2 || (w->bits != 8 && w->bits != 16)) {
+		message("wav: unsupported format %d, %d channels, %d bits\n", riff_u16(fmt), w->channels, w->bits);
+		return -1;
+	}
+
+	w->sample_format = (w->bits == 8 ? SAMPLE_U8 : SAMPLE_S16) | (w->channels == 2 ? SAMPLE_STEREO : 0);
+	w->frames = c_data->size / (w->channels * w->bits/8);
+	w->data = riff_data(r, c_data);
+	w->data_offset = c_data->offset;
 
-	return buf;
+	// sampler chunk : unity note and first loop
+	uint8_t smpl[60];
+	const struct riff_chunk *c_smpl = riff_find(r, RIFF_ID("smpl"), 0);
+	w->unity_note = 60;
+	w->loop_start = -1;
+	w->loop_end = w->frames;
+	if (c_smpl && riff_read(r, c_smpl, smpl, sizeof(smpl)) >= 36) {
+		w->unity_note = riff_u32(smpl+12);
+		if (c_smpl->size >= 60 && riff_u32(smpl+28)) {
+			const uint32_t start = riff_u32(smpl+36+8);
+			const uint32_t end = riff_u32(smpl+36+12) + 1; // inclusive in the file
+			if (start < end && end <= w->frames) {
+				w->loop_start = start;
+				w->loop_end = end;
+			}
+		}
+	}
+	return 0;
+}
+
+uint16_t wav_speed (const struct wav *w)
+{
+	return (uint64_t)w->rate * 256 / BITBOX_SAMPLERATE;
 }
 
 
 #ifdef TEST
 #include <stdio.h>
 #include <stdlib.h>
-#define SZ 10000
-int main()
+#include <stdarg.h>
+
+// gcc -DTEST -DEMULATOR -DBOARD_BITBOX -I../.. -I../../kernel tinyriff.c -o tinyriff && ./tinyriff file.wav
+void message(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+int main(int argc, char **argv)
 {
-    printf("parsing file\n");
-    void *buf=malloc(SZ);
-    FILE *f=fopen("go_ahead.wav","r");
-    const size_t n=fread(buf,1,SZ,f);
-    printf("%d bytes read.\n",n);
+	FILE *f = fopen(argc>1 ? argv[1] : "go_ahead.wav", "rb");
+	if (!f) {
+		perror("open");
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	rewind(f);
+	void *buf = malloc(size);
+	printf("%zu bytes read.\n", fread(buf, 1, size, f));
+	fclose(f);
+
+	struct riff r;
+	if (riff_open(&r, buf, size) < 0) {
+		free(buf);
+		return 1;
+	}
+	for (int i=0; i<r.nb_chunks; i++)
+		printf("chunk: %.4s in %.4s at %u size:%u\n", (char *)&r.chunks[i].id, (char *)&r.chunks[i].list,
+			r.chunks[i].offset, r.chunks[i].size);
 
-    parse_chunk(buf);
+	struct wav w;
+	if (wav_open(&w, &r) == 0)
+		printf("wav: %d channels %d bits %u Hz, %u frames, loop %d-%d, note %d, speed %d\n",
+			w.channels, w.bits, w.rate, w.frames, w.loop_start, w.loop_end, w.unity_note, wav_speed(&w));
+	free(buf);
+	return 0;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,78 @@
+/* tinyriff : RIFF chunk index and WAV front-end
+
+   riff_open indexes the chunks of a RIFF file in memory (linked, f_map'ed, from a pack ...) :
+   chunk data is used in place, nothing is copied. riff_open_file (with USE_SDCARD) only
+   reads the chunk headers of a file on SD, chunk data can then be read or streamed from
+   the chunk offsets.
+
+   wav_open gets the format, samples and loop points (smpl chunk) of a WAV file, ready for
+   the sampler :
+
+	struct riff r;
+	struct wav w;
+	if (riff_open(&r, data_go_ahead_wav, sizeof(data_go_ahead_wav))>0 && !wav_open(&w, &r))
+		play_sample_format(w.data, wav_play_len(&w), w.sample_format, wav_speed(&w), w.loop_start, 255, 255);
+
+   Only PCM WAV files are supported, 8 bit (unsigned) or 16 bit, mono or stereo.
+*/
+#pragma once
+#include <stdint.h>
+
+#ifndef RIFF_MAX_CHUNKS
+#define RIFF_MAX_CHUNKS 16
+#endif
+
+#define RIFF_ID(s) ((uint32_t)(s)[0] | (s)[1]<<8 | (s)[2]<<16 | (uint32_t)(s)[3]<<24)
+
+struct riff_chunk {
+	uint32_t id;      // as RIFF_ID("fmt ")
+	uint32_t list;    // type of the enclosing RIFF or LIST chunk, as RIFF_ID("WAVE")
+	uint32_t offset;  // of chunk data from start of file
+	uint32_t size;
+};
+
+struct riff {
+	const uint8_t *data; // file in memory, or 0 if opened with riff_open_file
+	const char *path;
+	uint32_t size;
+	uint32_t form;       // RIFF form type, as RIFF_ID("WAVE")
+	int nb_chunks;
+	struct riff_chunk chunks[RIFF_MAX_CHUNKS];
+};
+
+struct wav {
+	uint8_t channels;       // 1 or 2
+	uint8_t bits;           // 8 or 16
+	uint32_t rate;          // sample frames per second
+	uint32_t frames;        // number of sample frames
+	const void *data;       // samples, 0 for a file on SD
+	uint32_t data_offset;   // offset of samples in the file
+	int32_t loop_start;     // in frames, -1 if no loop
+	int32_t loop_end;       // in frames, first frame after the loop
+	int8_t unity_note;      // MIDI note played at rate, 60 if not given
+	int sample_format;      // SAMPLE_xx format for play_sample_format, see lib/sampler
+};
+
+// indexes chunks of a RIFF file in memory. Returns the number of chunks, or -1 if invalid
+int riff_open (struct riff *r, const void *data, uint32_t size);
+
+// same, reading only chunk headers of a file on SD. path is not copied.
+int riff_open_file (struct riff *r, const char *path);
+
+// n-th chunk of this id (0 : first), 0 if none
+const struct riff_chunk *riff_find (const struct riff *r, uint32_t id, int n);
+
+// chunk data in place, 0 for a file on SD
+const void *riff_data (const struct riff *r, const struct riff_chunk *c);
+
+// copies at most max bytes of chunk data to dest, from memory or file. Returns bytes copied or -1
+int riff_read (const struct riff *r, const struct riff_chunk *c, void *dest, uint32_t max);
+
+// reads a WAV format, data and loop. Returns 0, or -1 if unsupported
+int wav_open (struct wav *w, const struct riff *r);
+
+// sampler speed to play at the file rate
+uint16_t wav_speed (const struct wav *w);
+
+// length for play_sample_format : up to the end of loop if any, so that the loop starts again there
+static inline int wav_play_len (const struct wav *w) { return w->loop_start<0 ? (int)w->frames : w->loop_end; }
@@ -1,8 +1,6 @@
 /*
 TODO : 
 	- acceleration of mixing func
-	- read data from WAV (u8, mono only) see http://stackoverflow.com/questions/14948442/code-to-read-wav-header-file-producing-strange-results-c
-			(or embed wavs)
 
 	- vol enveloppes ?
 	- interpolation
@@ -11,7 +9,6 @@ TODO :
 	- synth voices ?
 	- funny small noises when playing on bitbox itself (?)
 	- slow tempo ?
-	- voices can be cut (see line 172)
 */
 #include <stdint.h>
 #include <string.h> 
@@ -27,6 +24,7 @@ struct Voice {
 	int32_t data_loop; // offset from start. -1 : dont loop.
 
 	uint16_t speed; // output samples per input sample, *256. 0x100 = normal speed
+	uint8_t format; // SAMPLE_xx
 
 	uint8_t vol_left, vol_right; // 0-255 per channel if 0,0 sample not used (free)
 };
@@ -73,12 +71,13 @@ static inline int find_free_voice()
 }
 
 
-int play_sample(const int8_t *data, int data_len, uint16_t speed, int loop_pos, uint8_t vol_left, uint8_t vol_right)
+int play_sample_format(const void *data, int data_len, int format, uint16_t speed, int loop_pos, uint8_t vol_left, uint8_t vol_right)
 {
 	int idx=find_free_voice();
 	if (idx>=0) {
 		struct Voice *v = &s.voices[idx];
 		v->data=(int8_t*) data; // non-const
+		v->format=format;
 		v->data_len=data_len*256;
 		v->vol_left=vol_left;
 		v->vol_right=vol_right;
@@ -91,6 +90,16 @@ int play_sample(const int8_t *data, int data_len, uint16_t speed, int loop_pos,
 	return idx;
 }
 
+int play_sample(const int8_t *data, int data_len, uint16_t speed, int loop_pos, uint8_t vol_left, uint8_t vol_right)
+{
+	return play_sample_format(data, data_len, SAMPLE_S8, speed, loop_pos, vol_left, vol_right);
+}
+
+int sample_position(int voice_id)
+{
+	return s.voices[voice_id].data_pos>>8;
+}
+
 void stop_sample(int sample_id)
 {
 	s.voices[sample_id].vol_right=s.voices[sample_id].vol_left=0;
@@ -104,6 +113,36 @@ void stop_all_samples()
 
 void player_step(uint32_t ticks);
 
+// sample n of voice data, as signed 8 bit
+static inline int8_t read_sample(const struct Voice *v, uint32_t n, const int format)
+{
+	switch (format & ~SAMPLE_STEREO) {
+		case SAMPLE_U8  : return ((const uint8_t *)v->data)[n] ^ 0x80;
+		case SAMPLE_S16 : return ((const int16_t *)v->data)[n] >> 8;
+		default         : return v->data[n];
+	}
+}
+
+// mixes nb samples of a voice, inlined with a constant format for each format
+static inline __attribute__((always_inline)) void mix_voice(struct Voice *v, uint8_t *buffer8, int nb, const int format)
+{
+	for (int i=0;i<nb;v->data_pos+=v->speed,i++) {
+		// FIXME use assembly / SIMD instrs !
+		int8_t smp_l, smp_r;
+		if (format & SAMPLE_STEREO) {
+			smp_l = read_sample(v, (v->data_pos>>8)*2, format); // XXX linear interp
+			smp_r = read_sample(v, (v->data_pos>>8)*2+1, format);
+		} else {
+			smp_l = smp_r = read_sample(v, v->data_pos>>8, format);
+		}
+
+		int8_t a = (smp_l*v->vol_left)>>8;
+		int8_t b = (smp_r*v->vol_right)>>8;
+		buffer8[i*2] +=  a;
+		buffer8[i*2+1] +=  b;
+	};
+}
+
 void game_snd_buffer(uint16_t *buffer, int len)
 {
 	
@@ -120,32 +159,34 @@ void game_snd_buffer(uint16_t *buffer, int len)
 		struct Voice *v;
 		v = &s.voices[vi];
 
-		int nb = (v->data_len-v->data_pos)*256/v->speed; // number of samples available in memory, as output samples
-		if (len<nb) nb=len; 
-
-		// mixing available data to buffer
-		for (int i=0;i<nb;v->data_pos+=v->speed,i++) {
-			// FIXME use assembly / SIMD instrs !
-
-			int8_t smp = v->data[v->data_pos>>8]; // XXX linear interp
-
-			int8_t a = (smp*v->vol_left)>>8;
-			int8_t b = (smp*v->vol_right)>>8;
-			buffer8[i*2] +=  a;
-			buffer8[i*2+1] +=  b;
-		};
-
-		// end of memory / filebuffer ?
-		if (v->data_pos>=v->data_len) {
-			// end of sample : loop ?
-			if (v->data_loop<0) {
-				// end of sample
-				v->vol_left = v->vol_right = 0;
-			} else {
-				v->data_pos = v->data_loop;
-			} // XXX pingpong: speed = -speed, ...
-
-		} 
+		// mix up to the end of data, go on from the loop point if it loops
+		for (int done=0; done<len && !is_free(vi);) {
+			int nb = (v->data_len-v->data_pos+v->speed-1)/v->speed; // number of samples available in memory, as output samples
+			if (len-done<nb) nb=len-done;
+
+			// mixing available data to buffer
+			uint8_t *dst = buffer8+2*done;
+			switch (v->format) {
+				case SAMPLE_S8 : mix_voice(v, dst, nb, SAMPLE_S8); break;
+				case SAMPLE_U8 : mix_voice(v, dst, nb, SAMPLE_U8); break;
+				case SAMPLE_S16 : mix_voice(v, dst, nb, SAMPLE_S16); break;
+				case SAMPLE_S8|SAMPLE_STEREO : mix_voice(v, dst, nb, SAMPLE_S8|SAMPLE_STEREO); break;
+				case SAMPLE_U8|SAMPLE_STEREO : mix_voice(v, dst, nb, SAMPLE_U8|SAMPLE_STEREO); break;
+				case SAMPLE_S16|SAMPLE_STEREO : mix_voice(v, dst, nb, SAMPLE_S16|SAMPLE_STEREO); break;
+			}
+			done += nb;
+
+			// end of memory / filebuffer ?
+			if (v->data_pos>=v->data_len) {
+				// end of sample : loop ?
+				if (v->data_loop<0 || v->data_loop>=v->data_len) {
+					// end of sample
+					v->vol_left = v->vol_right = 0;
+				} else {
+					v->data_pos -= v->data_len - v->data_loop; // keeps the fractional position
+				} // XXX pingpong: speed = -speed, ...
+			}
+		}
 	}
 
 	// Play current track
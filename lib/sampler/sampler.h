@@ -3,6 +3,7 @@
 plays a number of sounds, 
  - directly from data in memory 
  - from a raw file (i8 raw)
+ - from WAV data, 8 or 16 bit, mono or stereo, in place (see lib/resources/tinyriff.h)
 
 
 to use it, 
@@ -30,6 +31,16 @@ to use it,
 
 int play_sample(const int8_t *data, int data_len, uint16_t speed, int loop_pos, uint8_t vol_left, uint8_t vol_right);
 
+// sample formats
+#define SAMPLE_S8     0 // signed 8 bit, as raw .i8 files
+#define SAMPLE_U8     1 // unsigned 8 bit, as 8 bit WAV files
+#define SAMPLE_S16    2 // signed 16 bit
+#define SAMPLE_STEREO 4 // interleaved left and right samples
+
+/* same as play_sample, with data in a SAMPLE_xx format (ORed with SAMPLE_STEREO).
+   data_len and loop_pos are in sample frames (a left and right pair for stereo). */
+int play_sample_format(const void *data, int data_len, int format, uint16_t speed, int loop_pos, uint8_t vol_left, uint8_t vol_right);
+
 void set_vol(int voice_id, uint8_t vol_left, uint8_t vol_right);
 
 // stop all samples from playing
@@ -38,6 +49,9 @@ void stop_all_samples( void );
 // stop a given sample (other samples continue playing)
 void stop_sample(int voice_id);
 
+// position of a voice in its data, in sample frames. Lets a player refill data already played
+int sample_position(int voice_id);
+
 // reading and playing songs
 struct NoteEvent {
 	uint16_t tick; // as 96 PPQ since last one.